@@ -0,0 +1,379 @@
+/** @file
+Streaming digital filters and decimation for magnetometer sample streams.
+
+Fixed-coefficient IIR (biquad) and FIR filters, a median filter for spike rejection, and an
+integer-factor decimator. Each filter is available in a floating point variant (`float` samples
+and coefficients) and a fixed-point variant (`int16_t` samples - e.g. raw counts from
+`HMC5883L::readRawValues()` - with Q14 coefficients and 32-bit accumulators).
+
+All filter state is held in fixed-size member arrays sized by template parameters, so no memory
+is allocated at run time. Every filter shares the same interface:
+
+  - `bool process(T x, T *y)` pushes a single sample and returns `true` if an output sample was
+    written to `y`.
+  - `uint16_t processBlock(const T *in, T *out, uint16_t n)` processes a block of `n` samples and
+    returns the number of output samples written. `in` and `out` may be the same array.
+  - `void reset()` clears the filter history.
+
+so filters can be composed with `FilterChain` and applied to all three axes of a `Vec3Block` with
+`Vec3Filter`.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <Vec3.h>
+#include <Vec3Block.h>
+
+/** @defgroup FilterConstants Filter constants
+@{ */
+#define FILTER_Q 14                 /*!< Fractional bits in fixed-point filter coefficients. */
+
+/** Convert a floating point coefficient to a Q14 fixed-point coefficient (range [-2, 2)). */
+#define FILTER_Q14(c) ((int16_t)((c) * (1 << FILTER_Q) + ((c) < 0 ? -0.5 : 0.5)))
+/** @} */
+
+template<typename T> struct FilterArith;
+
+template<> struct FilterArith<float> {
+    /** Arithmetic for floating point filters. */
+    typedef float coef_t;
+    typedef float acc_t;
+
+    static acc_t mul(coef_t c, float x) { return c * x; }
+    static float result(acc_t a) { return a; }
+};
+
+template<> struct FilterArith<int16_t> {
+    /** Arithmetic for fixed-point filters.
+
+    Samples are `int16_t` and coefficients are Q14 (see `FILTER_Q14()`). Products are accumulated
+    in 32 bits, which leaves headroom for up to 32 taps at the full 13-bit range of the device
+    (-4096 to 4095), then rounded and saturated back to `int16_t`.
+    */
+    typedef int16_t coef_t;
+    typedef int32_t acc_t;
+
+    static acc_t mul(coef_t c, int16_t x) { return (int32_t)c * x; }
+    static int16_t result(acc_t a) {
+        a = (a + (1 << (FILTER_Q - 1))) >> FILTER_Q;
+        if (a > 32767) { return 32767; }
+        if (a < -32768) { return -32768; }
+        return (int16_t)a;
+    }
+};
+
+template<typename T> class BiquadFilter {
+    /** Second-order IIR (biquad) filter with fixed coefficients.
+
+    Implements the difference equation (direct form I):
+
+        y[n] = b0*x[n] + b1*x[n-1] + b2*x[n-2] - a1*y[n-1] - a2*y[n-2]
+
+    Direct form I is used so that the fixed-point variant never has to store intermediate values
+    with more range than the input and output. Higher orders can be built by chaining biquads with
+    `FilterChain`.
+    */
+public:
+    typedef T sample_type;
+    typedef typename FilterArith<T>::coef_t coef_t;
+    typedef typename FilterArith<T>::acc_t acc_t;
+
+    BiquadFilter(coef_t B0, coef_t B1, coef_t B2, coef_t A1, coef_t A2) {
+        /** Constructor. Coefficients are normalized so that `a0 == 1`. */
+        b0 = B0;
+        b1 = B1;
+        b2 = B2;
+        a1 = A1;
+        a2 = A2;
+        reset();
+    }
+
+    void reset(void) {
+        /** Clear the filter history. */
+        x1 = x2 = y1 = y2 = 0;
+    }
+
+    bool process(T x, T *y) {
+        /** Filter a single sample. Always produces an output. */
+        acc_t acc = FilterArith<T>::mul(b0, x) + FilterArith<T>::mul(b1, x1)
+                  + FilterArith<T>::mul(b2, x2) - FilterArith<T>::mul(a1, y1)
+                  - FilterArith<T>::mul(a2, y2);
+        T out = FilterArith<T>::result(acc);
+
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        y1 = out;
+
+        *y = out;
+        return true;
+    }
+
+    uint16_t processBlock(const T *in, T *out, uint16_t n) {
+        /** Filter a block of `n` samples. Returns `n`. */
+        for (uint16_t i = 0; i < n; i++) {
+            process(in[i], &out[i]);
+        }
+
+        return n;
+    }
+
+private:
+    coef_t b0, b1, b2, a1, a2;
+    T x1, x2, y1, y2;
+};
+
+template<typename T, uint8_t N> class FIRFilter {
+    /** FIR filter with `N` fixed coefficients.
+
+    Computes `y[n] = c[0]*x[n] + c[1]*x[n-1] + ... + c[N-1]*x[n-N+1]`, using a circular history of
+    the last `N` samples.
+    */
+public:
+    typedef T sample_type;
+    typedef typename FilterArith<T>::coef_t coef_t;
+    typedef typename FilterArith<T>::acc_t acc_t;
+
+    FIRFilter(const coef_t *coefficients) {
+        /** Constructor. `coefficients` must have `N` elements, and is copied. */
+        for (uint8_t i = 0; i < N; i++) {
+            coefs[i] = coefficients[i];
+        }
+        reset();
+    }
+
+    void reset(void) {
+        /** Clear the filter history. */
+        for (uint8_t i = 0; i < N; i++) {
+            history[i] = 0;
+        }
+        head = 0;
+    }
+
+    bool process(T x, T *y) {
+        /** Filter a single sample. Always produces an output. */
+        history[head] = x;
+
+        // Walk backwards through the history from the newest sample.
+        acc_t acc = 0;
+        uint8_t j = head;
+        for (uint8_t i = 0; i < N; i++) {
+            acc += FilterArith<T>::mul(coefs[i], history[j]);
+            j = (j == 0) ? N - 1 : j - 1;
+        }
+
+        head = (head + 1 == N) ? 0 : head + 1;
+
+        *y = FilterArith<T>::result(acc);
+        return true;
+    }
+
+    uint16_t processBlock(const T *in, T *out, uint16_t n) {
+        /** Filter a block of `n` samples. Returns `n`. */
+        for (uint16_t i = 0; i < n; i++) {
+            process(in[i], &out[i]);
+        }
+
+        return n;
+    }
+
+private:
+    coef_t coefs[N];
+    T history[N];
+    uint8_t head;                      /*!< Index where the next sample will be stored. */
+};
+
+template<typename T, uint8_t N> class MedianFilter {
+    /** Running median of the last `N` samples, for rejecting isolated spikes.
+
+    `N` should be odd. The window is kept both in arrival order (to know which sample to evict) and
+    in sorted order, so each update is an O(N) remove-and-insert rather than a full sort. Until `N`
+    samples have been seen, the median of the samples seen so far is returned.
+    */
+public:
+    typedef T sample_type;
+
+    MedianFilter() { reset(); }
+
+    void reset(void) {
+        /** Clear the filter history. */
+        count = 0;
+        head = 0;
+    }
+
+    bool process(T x, T *y) {
+        /** Filter a single sample. Always produces an output.
+
+        A NaN sample can't be ordered, so it is dropped rather than entered into the window, and
+        the output is the current median (or the NaN itself, if the window is still empty).
+        */
+        uint8_t i;
+        if (x != x) {
+            *y = count ? sorted[count / 2] : x;
+            return true;
+        }
+
+        if (count == N) {
+            // Remove the oldest sample from the sorted window.
+            T oldest = window[head];
+            for (i = 0; i + 1 < count && sorted[i] != oldest; i++) {}
+            for (; i + 1 < count; i++) {
+                sorted[i] = sorted[i + 1];
+            }
+            count--;
+        }
+
+        window[head] = x;
+        head = (head + 1 == N) ? 0 : head + 1;
+
+        // Insert the new sample into the sorted window.
+        for (i = count; i > 0 && sorted[i - 1] > x; i--) {
+            sorted[i] = sorted[i - 1];
+        }
+        sorted[i] = x;
+        count++;
+
+        *y = sorted[count / 2];
+        return true;
+    }
+
+    uint16_t processBlock(const T *in, T *out, uint16_t n) {
+        /** Filter a block of `n` samples. Returns `n`. */
+        for (uint16_t i = 0; i < n; i++) {
+            process(in[i], &out[i]);
+        }
+
+        return n;
+    }
+
+private:
+    T window[N];                       /*!< Samples in arrival order. */
+    T sorted[N];                       /*!< Samples in ascending order. */
+    uint8_t count;
+    uint8_t head;
+};
+
+template<typename T, uint8_t M> class Decimator {
+    /** Integer-factor decimator, which keeps one of every `M` samples.
+
+    No anti-aliasing is performed - chain a low-pass `FIRFilter` or `BiquadFilter` in front of the
+    decimator with `FilterChain` if the input has content above the new Nyquist frequency.
+    */
+public:
+    typedef T sample_type;
+
+    Decimator() { reset(); }
+
+    void reset(void) {
+        /** Reset the phase, so the next sample is kept. */
+        phase = 0;
+    }
+
+    bool process(T x, T *y) {
+        /** Push a single sample. Returns `true` and writes `y` on every `M`th sample. */
+        bool keep = (phase == 0);
+        if (keep) {
+            *y = x;
+        }
+
+        phase = (phase + 1 == M) ? 0 : phase + 1;
+        return keep;
+    }
+
+    uint16_t processBlock(const T *in, T *out, uint16_t n) {
+        /** Decimate a block of `n` samples. Returns the number of samples written to `out`. */
+        uint16_t j = 0;
+        for (uint16_t i = 0; i < n; i++) {
+            if (process(in[i], &out[j])) {
+                j++;
+            }
+        }
+
+        return j;
+    }
+
+private:
+    uint8_t phase;
+};
+
+template<typename F1, typename F2> class FilterChain {
+    /** Two filters applied in series (`F1` then `F2`). Chains can be nested. */
+public:
+    typedef typename F1::sample_type sample_type;
+
+    FilterChain(const F1 &First, const F2 &Second) : first(First), second(Second) {}
+
+    void reset(void) {
+        /** Clear the history of both filters. */
+        first.reset();
+        second.reset();
+    }
+
+    bool process(sample_type x, sample_type *y) {
+        /** Push a single sample through both filters. */
+        sample_type tmp;
+        if (!first.process(x, &tmp)) {
+            return false;
+        }
+
+        return second.process(tmp, y);
+    }
+
+    uint16_t processBlock(const sample_type *in, sample_type *out, uint16_t n) {
+        /** Process a block through both filters, using `out` as the intermediate buffer. */
+        uint16_t m = first.processBlock(in, out, n);
+        return second.processBlock(out, out, m);
+    }
+
+    F1 first;
+    F2 second;
+};
+
+template<typename F> class Vec3Filter {
+    /** Applies an independent copy of the filter `F` to each axis of a 3-vector stream. */
+public:
+    typedef typename F::sample_type sample_type;
+
+    Vec3Filter(const F &filter) : x(filter), y(filter), z(filter) {}
+
+    void reset(void) {
+        /** Clear the history on all three axes. */
+        x.reset();
+        y.reset();
+        z.reset();
+    }
+
+    bool process(Vec3<sample_type> v, Vec3<sample_type> *out) {
+        /** Push a single 3-vector. Returns `true` if an output vector was written to `out`. */
+        bool rv = x.process(v.x, &out->x);
+        y.process(v.y, &out->y);
+        z.process(v.z, &out->z);
+
+        return rv;
+    }
+
+    uint16_t processBlock(Vec3Block<sample_type> in, Vec3Block<sample_type> *out) {
+        /** Filter a whole block, one axis at a time.
+
+        @param[in] in The input block.
+        @param[out] out The output block, which may point to the same arrays as `in`. Its `length`
+                        is set to the number of output samples.
+
+        @return Returns the number of output samples.
+        */
+        uint16_t n = x.processBlock(in.x, out->x, in.length);
+        y.processBlock(in.y, out->y, in.length);
+        z.processBlock(in.z, out->z, in.length);
+
+        out->length = n;
+        return n;
+    }
+
+    F x, y, z;
+};
+
+#endif
@@ -0,0 +1,363 @@
+/** @file
+Class file for Mahony orientation fusion of magnetometer samples, optionally with an
+accelerometer and a gyroscope.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <Fusion.h>
+#include <Vec3.h>
+#include <Vec3Block.h>
+#include <math.h>
+
+#define FUSION_ONE ((int64_t)1 << FUSION_Q)        // 1.0 in Q30
+#define FUSION_GYRO_SHIFT 8     // Q30 rates are shifted down by this much before scaling by dt
+
+static inline float inv_norm(Vec3<float> v) {
+    /** Reciprocal of the length of `v`, or 0 for the zero vector. */
+    float n2 = v.x * v.x + v.y * v.y + v.z * v.z;
+    return n2 > 0 ? 1.0f / sqrtf(n2) : 0;
+}
+
+MahonyFusion::MahonyFusion(float Kp, float Ki) {
+    /** Constructor for the float fusion filter.
+
+    @param[in] Kp The proportional gain, in 1/s. Higher values trust the magnetometer and
+                  accelerometer more and the gyroscope less. Default is `FUSION_KP`.
+    @param[in] Ki The integral gain, which estimates the gyroscope bias, in 1/s^2. Default is
+                  `FUSION_KI` (disabled).
+    */
+    setGains(Kp, Ki);
+    reset();
+}
+
+void MahonyFusion::reset() {
+    /** Reset to the identity orientation and clear the integral term. */
+    q = Quaternion<float>(1, 0, 0, 0);
+    integral = Vec3<float>(0, 0, 0);
+}
+
+void MahonyFusion::setGains(float Kp, float Ki) {
+    /** Change the proportional and integral gains. */
+    kp = Kp;
+    ki = Ki;
+    if (ki <= 0) {
+        integral = Vec3<float>(0, 0, 0);
+    }
+}
+
+void MahonyFusion::setQuaternion(Quaternion<float> Q) {
+    /** Set the orientation, e.g. to start from a known attitude instead of converging to it. */
+    q = Q;
+}
+
+void MahonyFusion::update(Vec3<float> mag, float dt, const Vec3<float> *gyro,
+                          const Vec3<float> *accel) {
+    /** Advance the orientation by one sample.
+
+    @param[in] mag The magnetometer sample, e.g. from `HMC5883L::readCalibratedValues()`. A zero
+                   vector (e.g. from a failed read) is ignored.
+    @param[in] dt The time since the previous update, in seconds.
+    @param[in] gyro The angular rate, in rad/s. Pass `NULL` (default) if there is no gyroscope.
+    @param[in] accel The accelerometer sample, in any units. Pass `NULL` (default) if there is no
+                     accelerometer.
+    */
+
+    float q0 = q.w, q1 = q.x, q2 = q.y, q3 = q.z;
+    float q0q0 = q0 * q0, q0q1 = q0 * q1, q0q2 = q0 * q2, q0q3 = q0 * q3;
+    float q1q1 = q1 * q1, q1q2 = q1 * q2, q1q3 = q1 * q3;
+    float q2q2 = q2 * q2, q2q3 = q2 * q3, q3q3 = q3 * q3;
+
+    // The predicted direction of "up" in the sensor frame.
+    Vec3<float> v(2 * (q1q3 - q0q2), 2 * (q0q1 + q2q3), q0q0 - q1q1 - q2q2 + q3q3);
+    Vec3<float> e(0, 0, 0);
+
+    float n = inv_norm(mag);
+    if (n > 0) {
+        Vec3<float> m = mag * n;
+
+        // The field in the earth frame, with its horizontal part rotated onto north.
+        float hx = 2 * (m.x * (0.5f - q2q2 - q3q3) + m.y * (q1q2 - q0q3) + m.z * (q1q3 + q0q2));
+        float hy = 2 * (m.x * (q1q2 + q0q3) + m.y * (0.5f - q1q1 - q3q3) + m.z * (q2q3 - q0q1));
+        float bx = sqrtf(hx * hx + hy * hy);
+        float bz = 2 * (m.x * (q1q3 - q0q2) + m.y * (q2q3 + q0q1) + m.z * (0.5f - q1q1 - q2q2));
+
+        // The predicted direction of that reference field in the sensor frame.
+        float wx = 2 * (bx * (0.5f - q2q2 - q3q3) + bz * (q1q3 - q0q2));
+        float wy = 2 * (bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3));
+        float wz = 2 * (bx * (q0q2 + q1q3) + bz * (0.5f - q1q1 - q2q2));
+
+        // Keep only the rotation about the vertical, so the field never tilts the estimate.
+        Vec3<float> c(m.y * wz - m.z * wy, m.z * wx - m.x * wz, m.x * wy - m.y * wx);
+        e = v * (c.x * v.x + c.y * v.y + c.z * v.z);
+    }
+
+    n = accel != NULL ? inv_norm(*accel) : 0;
+    if (n > 0) {
+        Vec3<float> a = *accel;
+        a = a * n;
+        e = e + Vec3<float>(a.y * v.z - a.z * v.y, a.z * v.x - a.x * v.z, a.x * v.y - a.y * v.x);
+    }
+
+    Vec3<float> g = gyro != NULL ? *gyro : Vec3<float>(0, 0, 0);
+    if (ki > 0) {
+        integral = integral + e * (ki * dt);
+        g = g + integral;
+    }
+    g = g + e * kp;
+
+    // Integrate the rate of change of the quaternion, q' = q * (0, g) / 2.
+    g = g * (0.5f * dt);
+    q.w = q0 + (-q1 * g.x - q2 * g.y - q3 * g.z);
+    q.x = q1 + (q0 * g.x + q2 * g.z - q3 * g.y);
+    q.y = q2 + (q0 * g.y - q1 * g.z + q3 * g.x);
+    q.z = q3 + (q0 * g.z + q1 * g.y - q2 * g.x);
+
+    n = 1.0f / sqrtf(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+    q = Quaternion<float>(q.w * n, q.x * n, q.y * n, q.z * n);
+}
+
+uint16_t MahonyFusion::replay(Vec3Block<float> mag, float dt, const Vec3Block<float> *gyro,
+                              const Vec3Block<float> *accel, Quaternion<float> *out) {
+    /** Run `update()` over a block of captured samples taken at a fixed interval.
+
+    @param[in] mag The magnetometer samples.
+    @param[in] dt The time between samples, in seconds.
+    @param[in] gyro The gyroscope samples, or `NULL` (default). Must have as many samples as `mag`.
+    @param[in] accel The accelerometer samples, or `NULL` (default). Must have as many samples as
+                     `mag`.
+    @param[out] out Receives the orientation after each sample, `mag.length` of them. Pass `NULL`
+                    (default) if only the final orientation is wanted.
+
+    @return Returns the number of samples processed, `mag.length`.
+    */
+
+    for (uint16_t i = 0; i < mag.length; i++) {
+        Vec3<float> g, a;
+        if (gyro != NULL) { g = Vec3<float>(gyro->x[i], gyro->y[i], gyro->z[i]); }
+        if (accel != NULL) { a = Vec3<float>(accel->x[i], accel->y[i], accel->z[i]); }
+
+        update(mag.get(i), dt, gyro != NULL ? &g : NULL, accel != NULL ? &a : NULL);
+        if (out != NULL) {
+            out[i] = q;
+        }
+    }
+
+    return mag.length;
+}
+
+Quaternion<float> MahonyFusion::getQuaternion() {
+    /** The current orientation, rotating sensor-frame vectors into the earth frame. */
+    return q;
+}
+
+float MahonyFusion::heading() {
+    /** The heading of the sensor's x axis in degrees clockwise from magnetic north, in [0, 360). */
+    float h = atan2f(-2 * (q.x * q.y + q.w * q.z), 1 - 2 * (q.y * q.y + q.z * q.z));
+    h *= (float)(180.0 / M_PI);
+    return h < 0 ? h + 360 : h;
+}
+
+static uint32_t isqrt64(uint64_t v) {
+    /** Integer square root, rounded down. */
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+    while (bit > v) {
+        bit >>= 2;
+    }
+
+    while (bit) {
+        if (v >= root + bit) {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)root;
+}
+
+static bool unit_q30(const Vec3<int32_t> &v, int64_t *u) {
+    /** Normalize `v` (in any fixed-point format) to a Q30 unit vector. Returns `false` for zero. */
+    int64_t c[3] = {v.x, v.y, v.z};
+
+    // Keep every component below 2^30, so the sum of squares fits in 62 bits.
+    int64_t peak = 0;
+    for (uint8_t i = 0; i < 3; i++) {
+        int64_t a = c[i] < 0 ? -c[i] : c[i];
+        peak = a > peak ? a : peak;
+    }
+
+    if (peak == 0) {
+        return false;
+    }
+
+    uint8_t shift = 0;
+    while ((peak >> shift) >= FUSION_ONE) {
+        shift++;
+    }
+
+    for (uint8_t i = 0; i < 3; i++) {
+        c[i] >>= shift;
+    }
+
+    uint64_t n = isqrt64((uint64_t)(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]));
+    if (n == 0) {
+        return false;
+    }
+
+    // One division for the reciprocal, Q60 / n, then a multiply per component.
+    int64_t inv = (int64_t)(((uint64_t)1 << (2 * FUSION_Q)) / n);
+    for (uint8_t i = 0; i < 3; i++) {
+        u[i] = (c[i] * inv) >> FUSION_Q;
+    }
+
+    return true;
+}
+
+static inline int64_t mul_q30(int64_t a, int64_t b) {
+    /** Product of two Q30 values. */
+    return (a * b) >> FUSION_Q;
+}
+
+MahonyFusionQ16::MahonyFusionQ16(int32_t Kp, int32_t Ki) {
+    /** Constructor for the fixed-point fusion filter.
+
+    @param[in] Kp The proportional gain, in Q16 1/s. Default is `FUSION_Q16(FUSION_KP)`.
+    @param[in] Ki The integral gain, in Q16 1/s^2. Default is `FUSION_Q16(FUSION_KI)`.
+    */
+    setGains(Kp, Ki);
+    reset();
+}
+
+void MahonyFusionQ16::reset() {
+    /** Reset to the identity orientation and clear the integral term. */
+    q = Quaternion<int32_t>(FUSION_ONE, 0, 0, 0);
+    integral[0] = integral[1] = integral[2] = 0;
+}
+
+void MahonyFusionQ16::setGains(int32_t Kp, int32_t Ki) {
+    /** Change the proportional and integral gains, in Q16. */
+    kp = Kp;
+    ki = Ki;
+    if (ki <= 0) {
+        integral[0] = integral[1] = integral[2] = 0;
+    }
+}
+
+void MahonyFusionQ16::setQuaternion(Quaternion<int32_t> Q) {
+    /** Set the orientation, as a Q30 unit quaternion. */
+    q = Q;
+}
+
+void MahonyFusionQ16::update(Vec3<int32_t> mag, uint32_t dt_us, const Vec3<int32_t> *gyro,
+                             const Vec3<int32_t> *accel) {
+    /** Advance the orientation by one sample. See `MahonyFusion::update()`.
+
+    @param[in] mag The magnetometer sample, e.g. from `HMC5883L::readCalibratedValuesQ16()`.
+    @param[in] dt_us The time since the previous update, in microseconds, at most 1 s.
+    @param[in] gyro The angular rate, in Q16 rad/s, or `NULL` (default).
+    @param[in] accel The accelerometer sample, in Q16 of any unit, or `NULL` (default).
+    */
+
+    const int64_t half = FUSION_ONE / 2;
+    int64_t q0 = q.w, q1 = q.x, q2 = q.y, q3 = q.z;
+    int64_t q0q0 = mul_q30(q0, q0), q0q1 = mul_q30(q0, q1), q0q2 = mul_q30(q0, q2);
+    int64_t q0q3 = mul_q30(q0, q3), q1q1 = mul_q30(q1, q1), q1q2 = mul_q30(q1, q2);
+    int64_t q1q3 = mul_q30(q1, q3), q2q2 = mul_q30(q2, q2), q2q3 = mul_q30(q2, q3);
+    int64_t q3q3 = mul_q30(q3, q3);
+
+    int64_t v[3] = {2 * (q1q3 - q0q2), 2 * (q0q1 + q2q3), q0q0 - q1q1 - q2q2 + q3q3};
+    int64_t e[3] = {0, 0, 0};
+    int64_t m[3];
+    if (unit_q30(mag, m)) {
+        int64_t hx = 2 * (mul_q30(m[0], half - q2q2 - q3q3) + mul_q30(m[1], q1q2 - q0q3)
+                          + mul_q30(m[2], q1q3 + q0q2));
+        int64_t hy = 2 * (mul_q30(m[0], q1q2 + q0q3) + mul_q30(m[1], half - q1q1 - q3q3)
+                          + mul_q30(m[2], q2q3 - q0q1));
+        int64_t bx = isqrt64((uint64_t)(hx * hx + hy * hy));
+        int64_t bz = 2 * (mul_q30(m[0], q1q3 - q0q2) + mul_q30(m[1], q2q3 + q0q1)
+                          + mul_q30(m[2], half - q1q1 - q2q2));
+
+        int64_t wx = 2 * (mul_q30(bx, half - q2q2 - q3q3) + mul_q30(bz, q1q3 - q0q2));
+        int64_t wy = 2 * (mul_q30(bx, q1q2 - q0q3) + mul_q30(bz, q0q1 + q2q3));
+        int64_t wz = 2 * (mul_q30(bx, q0q2 + q1q3) + mul_q30(bz, half - q1q1 - q2q2));
+
+        int64_t c[3] = {mul_q30(m[1], wz) - mul_q30(m[2], wy),
+                        mul_q30(m[2], wx) - mul_q30(m[0], wz),
+                        mul_q30(m[0], wy) - mul_q30(m[1], wx)};
+        int64_t cv = mul_q30(c[0], v[0]) + mul_q30(c[1], v[1]) + mul_q30(c[2], v[2]);
+        for (uint8_t i = 0; i < 3; i++) {
+            e[i] = mul_q30(v[i], cv);
+        }
+    }
+
+    int64_t a[3];
+    if (accel != NULL && unit_q30(*accel, a)) {
+        e[0] += mul_q30(a[1], v[2]) - mul_q30(a[2], v[1]);
+        e[1] += mul_q30(a[2], v[0]) - mul_q30(a[0], v[2]);
+        e[2] += mul_q30(a[0], v[1]) - mul_q30(a[1], v[0]);
+    }
+
+    // The time step in Q30 seconds, so scaling by it is a multiply and a shift.
+    int64_t dt = ((int64_t)dt_us << FUSION_Q) / 1000000;
+
+    int64_t g[3] = {0, 0, 0};
+    if (gyro != NULL) {
+        g[0] = (int64_t)gyro->x << (FUSION_Q - FUSION_IN_Q);
+        g[1] = (int64_t)gyro->y << (FUSION_Q - FUSION_IN_Q);
+        g[2] = (int64_t)gyro->z << (FUSION_Q - FUSION_IN_Q);
+    }
+
+    for (uint8_t i = 0; i < 3; i++) {
+        if (ki > 0) {
+            integral[i] += ((((e[i] * ki) >> FUSION_IN_Q) >> FUSION_GYRO_SHIFT) * dt)
+                           >> (FUSION_Q - FUSION_GYRO_SHIFT);
+            g[i] += integral[i];
+        }
+        g[i] += (e[i] * kp) >> FUSION_IN_Q;
+
+        // Half the rotation over the time step, in Q30 radians.
+        g[i] = ((g[i] >> FUSION_GYRO_SHIFT) * dt) >> (FUSION_Q + 1 - FUSION_GYRO_SHIFT);
+    }
+
+    int64_t n0 = q0 + (-mul_q30(q1, g[0]) - mul_q30(q2, g[1]) - mul_q30(q3, g[2]));
+    int64_t n1 = q1 + (mul_q30(q0, g[0]) + mul_q30(q2, g[2]) - mul_q30(q3, g[1]));
+    int64_t n2 = q2 + (mul_q30(q0, g[1]) - mul_q30(q1, g[2]) + mul_q30(q3, g[0]));
+    int64_t n3 = q3 + (mul_q30(q0, g[2]) + mul_q30(q1, g[1]) - mul_q30(q2, g[0]));
+
+    uint64_t norm = isqrt64((uint64_t)(n0 * n0 + n1 * n1 + n2 * n2 + n3 * n3));
+    if (norm == 0) {
+        return;
+    }
+
+    int64_t inv = (int64_t)(((uint64_t)1 << (2 * FUSION_Q)) / norm);
+    q = Quaternion<int32_t>(mul_q30(n0, inv), mul_q30(n1, inv), mul_q30(n2, inv),
+                            mul_q30(n3, inv));
+}
+
+uint16_t MahonyFusionQ16::replay(Vec3Block<int32_t> mag, uint32_t dt_us,
+                                 const Vec3Block<int32_t> *gyro,
+                                 const Vec3Block<int32_t> *accel, Quaternion<int32_t> *out) {
+    /** Run `update()` over a block of captured samples. See `MahonyFusion::replay()`. */
+    for (uint16_t i = 0; i < mag.length; i++) {
+        Vec3<int32_t> g, a;
+        if (gyro != NULL) { g = Vec3<int32_t>(gyro->x[i], gyro->y[i], gyro->z[i]); }
+        if (accel != NULL) { a = Vec3<int32_t>(accel->x[i], accel->y[i], accel->z[i]); }
+
+        update(mag.get(i), dt_us, gyro != NULL ? &g : NULL, accel != NULL ? &a : NULL);
+        if (out != NULL) {
+            out[i] = q;
+        }
+    }
+
+    return mag.length;
+}
+
+Quaternion<int32_t> MahonyFusionQ16::getQuaternion() {
+    /** The current orientation as a Q30 unit quaternion. */
+    return q;
+}
@@ -0,0 +1,116 @@
+/** @file
+Header file for Mahony orientation fusion of magnetometer samples, optionally with an
+accelerometer and a gyroscope.
+
+Two variants share the same algorithm and interface: `MahonyFusion`, in `float`, and
+`MahonyFusionQ16`, in fixed point for targets without a floating point unit, which takes its
+inputs as Q16.16 values - e.g. the magnetometer from `HMC5883L::readCalibratedValuesQ16()` - and
+keeps the quaternion in Q30. Neither allocates memory, and both can replay captured data held in
+`Vec3Block`s.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <Vec3.h>
+#include <Vec3Block.h>
+
+/** @defgroup FusionConstants Fusion constants
+@{ */
+#define FUSION_KP 0.5               /*!< Default proportional gain, in 1/s */
+#define FUSION_KI 0.0               /*!< Default integral gain, in 1/s^2 (0 disables it) */
+#define FUSION_IN_Q 16              /*!< Fractional bits of `MahonyFusionQ16` inputs and gains */
+#define FUSION_Q 30                 /*!< Fractional bits of the `MahonyFusionQ16` quaternion */
+
+/** Convert a floating point gain or input to Q16.16, for `MahonyFusionQ16`. */
+#define FUSION_Q16(c) ((int32_t)((c) * (1L << FUSION_IN_Q) + ((c) < 0 ? -0.5 : 0.5)))
+/** @} */
+
+template<typename T> struct Quaternion {
+    /** A quaternion `w + xi + yj + zk`. Orientations are unit quaternions. */
+    T w, x, y, z;
+
+    Quaternion() {}
+    Quaternion(T W, T X, T Y, T Z) {
+        w = W;
+        x = X;
+        y = Y;
+        z = Z;
+    }
+};
+
+class MahonyFusion {
+    /** Mahony's nonlinear complementary filter on SO(3), in `float`.
+
+    The orientation is a unit quaternion which rotates vectors from the sensor frame to the earth
+    frame, whose x axis points to magnetic north (horizontally), and whose z axis points up -
+    i.e. along the reading of an accelerometer at rest.
+
+    Each update rotates the quaternion by the gyroscope rate (if given), corrected by feedback
+    proportional to the misalignment between the measured and the predicted directions of
+    gravity (if an accelerometer sample is given) and of the magnetic field. The magnetic
+    reference is taken from the current estimate, projected onto the north-up plane, and the
+    magnetometer's correction is restricted to rotation about the estimated vertical, so it only
+    ever corrects heading and doesn't pull the estimate off level by the field's inclination.
+    Without an accelerometer, the tilt is unobservable: it is held (or follows the gyroscope)
+    and only the heading is corrected.
+
+    The inputs can be in any units - only their directions are used - except the gyroscope,
+    which is in rad/s.
+    */
+public:
+    MahonyFusion(float kp=FUSION_KP, float ki=FUSION_KI);
+
+    void reset(void);
+    void setGains(float kp, float ki);
+    void setQuaternion(Quaternion<float> q);
+
+    void update(Vec3<float> mag, float dt, const Vec3<float> *gyro=NULL,
+                const Vec3<float> *accel=NULL);
+    uint16_t replay(Vec3Block<float> mag, float dt, const Vec3Block<float> *gyro=NULL,
+                    const Vec3Block<float> *accel=NULL, Quaternion<float> *out=NULL);
+
+    Quaternion<float> getQuaternion(void);
+    float heading(void);
+
+private:
+    float kp, ki;
+    Quaternion<float> q;
+    Vec3<float> integral;              /*!< Integral of the error, scaled by `ki`, in rad/s. */
+};
+
+class MahonyFusionQ16 {
+    /** Fixed-point equivalent of `MahonyFusion`.
+
+    The magnetometer, accelerometer and gyroscope (rad/s) samples and the gains are Q16.16
+    (`FUSION_IN_Q`), and the time step is in microseconds. Internally, unit vectors and the
+    quaternion are Q2.30 (`FUSION_Q`) with 64-bit intermediates, so given the same inputs the
+    quaternion stays within about 10^-5 of the `float` variant's. Each update costs one 64-bit
+    division per normalized vector, and no floating point at all.
+    */
+public:
+    MahonyFusionQ16(int32_t kp=FUSION_Q16(FUSION_KP), int32_t ki=FUSION_Q16(FUSION_KI));
+
+    void reset(void);
+    void setGains(int32_t kp, int32_t ki);
+    void setQuaternion(Quaternion<int32_t> q);
+
+    void update(Vec3<int32_t> mag, uint32_t dt_us, const Vec3<int32_t> *gyro=NULL,
+                const Vec3<int32_t> *accel=NULL);
+    uint16_t replay(Vec3Block<int32_t> mag, uint32_t dt_us, const Vec3Block<int32_t> *gyro=NULL,
+                    const Vec3Block<int32_t> *accel=NULL, Quaternion<int32_t> *out=NULL);
+
+    Quaternion<int32_t> getQuaternion(void);
+
+private:
+    int32_t kp, ki;
+    Quaternion<int32_t> q;
+    int64_t integral[3];               /*!< Integral of the error, scaled by `ki`, Q30 rad/s. */
+};
+
+#endif
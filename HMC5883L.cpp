@@ -10,18 +10,60 @@ This code is released under a Creative Commons Attribution 4.0 International lic
 */
 
 #include <HMC5883L.h>
-#include <I2CDev.h>
+#include <HMCTrace.h>
+#include <HMCTime.h>
 #include <Vec3.h>
+#include <string.h>
 #include <unistd.h>
 
-HMC5883L::HMC5883L() {
+HMC5883L::HMC5883L() : I2CDevice(HMC5883L_ADDR) {
     /**  Constructor for HMC5883L compass / magnetometer class. */
-    I2CDevice = I2CDev(HMC5883L_ADDR);
 }
 
-const float HMC5883L::outputRates[] = {0.75, 1.50, 3.00, 7.50, 15.00, 30.00, 75.00};
-const float HMC5883L::gainRanges[] = {880, 1300, 1900, 2500, 4000, 4700, 5600, 8100};
-const float HMC5883L::gainValues[] = {0.73, 0.92, 1.22, 1.52, 2.27, 2.56, 3.03, 4.35};
+#if defined(HMC5883L_USE_IIO)
+HMC5883L::HMC5883L(const char *sysfs_dir, const char *buffer_dev)
+        : I2CDevice(sysfs_dir, buffer_dev) {
+    /** Constructor for HMC5883L compass / magnetometer class, through a particular IIO device.
+
+    The `IIODev` is constructed in place, since it owns the buffer device and can't be copied.
+
+    @param[in] sysfs_dir The device's sysfs directory, or `NULL` for `IIODEV_SYSFS_DIR`.
+    @param[in] buffer_dev The device's buffer character device, or `NULL` for
+                          `IIODEV_BUFFER_DEV`.
+    */
+}
+#else
+HMC5883L::HMC5883L(const HMC5883LBus &device) : I2CDevice(device) {
+    /** Constructor for HMC5883L compass / magnetometer class, using a copy of an existing
+    transport.
+
+    @param[in] device The transport to communicate with the device over, e.g. a `SimI2CDev` set
+                      up with a field and faults.
+    */
+}
+#endif
+
+const float HMC5883L::outputRates[] HMC_PROGMEM = {0.75, 1.50, 3.00, 7.50, 15.00, 30.00, 75.00};
+const float HMC5883L::gainRanges[] HMC_PROGMEM = {880, 1300, 1900, 2500, 4000, 4700, 5600, 8100};
+const float HMC5883L::gainValues[] HMC_PROGMEM = {0.73, 0.92, 1.22, 1.52, 2.27, 2.56, 3.03, 4.35};
+const uint16_t HMC5883L::gainValuesMicroGauss[] HMC_PROGMEM = {730, 920, 1220, 1520, 2270, 2560,
+                                                               3030, 4350};
+
+static HMCCalibration calibration_from_float(Vec3<float> c) {
+    /** Convert per-axis scale factors to the stored calibration, see `HMCCalibration`. */
+#if defined(HMC5883L_SMALL)
+    float v[3] = {c.x, c.y, c.z};
+    int16_t q[3];
+    for (uint8_t i = 0; i < 3; i++) {
+        float f = v[i] * (1 << HMC_CAL_Q);
+        f = f > 32767 ? 32767 : (f < -32768 ? -32768 : f);
+        q[i] = (int16_t)(f + (f < 0 ? -0.5 : 0.5));
+    }
+    return HMCCalibration(q[0], q[1], q[2]);
+#else
+    return c;
+#endif
+}
 
 uint8_t HMC5883L::initialize(bool noConfig) {
     /** Initialize the magnetometer communications.
@@ -48,12 +90,20 @@ uint8_t HMC5883L::initialize(bool noConfig) {
 
     @return Returns `0` on no error, or an error code. See `HMC5883L_Errors.h` for details.
     */
+    HMC_TRACE_SCOPE("HMC5883L::initialize");
 
     // Start communication with the device.
     I2CDevice.start();
 
-    // Initialize the calibration to (1.0, 1.0, 1.0)
-    calibration = Vec3<float>(1.0, 1.0, 1.0);
+    // Initialize the calibration to (1.0, 1.0, 1.0), and the fixed-point scale to match.
+    calibration = calibration_from_float(Vec3<float>(1.0, 1.0, 1.0));
+    gain = sampleGain = lastSampleGain = HMC_GAIN130;
+    nextSampleUs = 0;
+    autoRangeLowCount = 0;
+#if HMC_VERIFY_INTERVAL > 0
+    verifyCountdown = HMC_VERIFY_INTERVAL;
+#endif
+    updateFixedScale();
 
     uint8_t rv;
     if (!noConfig) {
@@ -122,34 +172,77 @@ Vec3<int> HMC5883L::readRawValues(uint8_t *saturated) {
 
     @return Returns an integer 3-vector (x, y, z), or (0, 0, 0) on 
     */
+    HMC_TRACE_SCOPE("HMC5883L::readRawValues");
     
+    HMCSample sample = readSample();
+    if (err_code) {
+        return Vec3<int>(0, 0, 0);
+    }
+
+    if (saturated != NULL) {
+        *saturated = sample.saturated;
+    }
+
+    return sample.rawValues();
+}
+
+HMCSample HMC5883L::readSample() {
+    /** Read a sample from the device without converting it.
+
+    The returned sample holds the raw data registers, the gain they were measured at, the
+    saturation flags and a reference to this device's calibration, so the scaled and calibrated
+    field and the heading can all be derived later from this one read (see `HMCSample`).
+
+    Every `HMC_VERIFY_INTERVAL` reads, and on the first read after a failed one, this first calls
+    `recover()` to check that the device hasn't reset, and restore its configuration if it has.
+
+    @return Returns the sample. On error, the sample is all zeros and `err_code` is set.
+    */
+    HMC_TRACE_SCOPE("HMC5883L::readSample");
+
+    HMCSample sample;
+    memset(&sample, 0, sizeof(sample));
+
+#if HMC_VERIFY_INTERVAL > 0
+    // recover() restarts the countdown.
+    if (!--verifyCountdown && recover()) {
+        verifyCountdown = 1;
+        return sample;
+    }
+#endif
+
     // Read the data from all three axes (two's complement)
     uint8_t *regValue = I2CDevice.read_data(DataRegister, 6);
 
     if (err_code = I2CDevice.get_err_code()) {
-        return Vec3<int>(0, 0, 0);
+#if HMC_VERIFY_INTERVAL > 0
+        // Errors often come with a brown-out, so check the configuration before the next read.
+        verifyCountdown = 1;
+#endif
+        return sample;
     }
 
-    int16_t x = regValue[0] << 8 | regValue[1];     // First two bytes are x.
-    int16_t y = regValue[4] << 8 | regValue[5];     // Bytes 4 and 5 are y.
-    int16_t z = regValue[2] << 8 | regValue[3];     // Bytes 2 and 3 are z.
+    memcpy(sample.raw, regValue, sizeof(sample.raw));
+
+    countMeasurements();
+
+    sample.gain = lastSampleGain;
+    sample.calibration = &calibration;
 
     // Set the appropriate warning flags if the sensor is saturated.
-    if (saturated != NULL) {
-        *saturated = 0;
-        if (x == -4096) { *saturated |= WC_X_SATURATED; }
-        if (y == -4096) { *saturated |= WC_Y_SATURATED; }
-        if (z == -4096) { *saturated |= WC_Z_SATURATED; }
-    }
+    if (sample.x() == -4096) { sample.saturated |= WC_X_SATURATED; }
+    if (sample.y() == -4096) { sample.saturated |= WC_Y_SATURATED; }
+    if (sample.z() == -4096) { sample.saturated |= WC_Z_SATURATED; }
 
-    return Vec3<int>(x, y, z);
+    return sample;
 }
 
 Vec3<float>  HMC5883L::readScaledValues(uint8_t *saturated) {
     /** Read the field vector and return the value in milliGauss.
 
     Scales the integers returned by `readRawValues()` by the appropriate gain value determined by
-    the value set by `setGain()`.
+    the value set by `setGain()`. The first measurement after a gain change is made at the previous
+    gain (see `setGain()`), and is scaled accordingly.
 
     @param[out] *saturated Warning flags in case any of the channels are saturated. Pass `NULL` if
                            you don't want to read these out. Default value is `NULL`.
@@ -157,6 +250,7 @@ Vec3<float>  HMC5883L::readScaledValues(uint8_t *saturated) {
     @return Returns a `Vec3<float>` containing the scaled values for the x, y and z channels or
             (0, 0, 0) on error.
     */
+    HMC_TRACE_SCOPE("HMC5883L::readScaledValues");
 
     Vec3<int> rawValues = readRawValues(saturated);
 
@@ -166,21 +260,24 @@ Vec3<float>  HMC5883L::readScaledValues(uint8_t *saturated) {
 
     Vec3<float> rv = Vec3<float>(rawValues.x, rawValues.y, rawValues.z);
 
-    return rv * gainValues[gain];
+    return rv * gainValue(lastSampleGain);
 }
 
 Vec3<float> HMC5883L::readScaledValuesSingle(uint8_t *saturated, uint32_t max_retries, 
                                              uint32_t delay_time) {
     /** Wrapper for `readScaledValues()` which makes a single measurement
 
-    The device is put into single measurement mode, then wait `delay_time` (in milliseconds), 
-    a single `readScaledValues()` measurement is made, then the measurement mode is restored to the
-    initial mode.
+    The device is put into single measurement mode, then after the conversion time (see
+    `conversionTimeUs()`) the status is checked every `delay_time` (in milliseconds) until the
+    data is ready, a single `readScaledValues()` measurement is made, then the measurement mode is
+    restored to the initial mode. The status can't be checked any sooner, since RDY still shows
+    the previous measurement until the device starts writing the new one.
     
     @param[out] *saturated Warning flags in case any of the channels are saturated. Pass `NULL` if
                            you don't want to read these out. Default value is `NULL`.
-    @param[in] max_retries The maximum number of times to try to read the measurement. Pass 0 if
-                           you don't want to limit the number of retries. Default is 0.
+    @param[in] max_retries The maximum number of times to check the status before reading the
+                           measurement. Pass 0 to read as soon as the conversion time has passed,
+                           without checking. Default is 0.
     @param[in] delay_time  Time to delay before checking whether or not data is ready to be read
                            from the device (also the repetition delay between checks for whether
                            data is ready), in milliseconds. The default is `HMC_SLEEP_DELAY`, which
@@ -191,6 +288,7 @@ Vec3<float> HMC5883L::readScaledValuesSingle(uint8_t *saturated, uint32_t max_re
             (0, 0, 0) on error. In addition to errors returned from `I2CDevice` calls, this
             returns `EC_INVALID_UFLOAT` if a negative `delay_time` is passed.
     */
+    HMC_TRACE_SCOPE("HMC5883L::readScaledValuesSingle");
 
     Vec3<float> zv = Vec3<float>(0.0, 0.0, 0.0);    // Returned on error
     if (delay_time < 0.0) {
@@ -204,10 +302,15 @@ Vec3<float> HMC5883L::readScaledValuesSingle(uint8_t *saturated, uint32_t max_re
         return zv;
     }
 
+    {
+        HMC_TRACE_SCOPE("usleep");
+        usleep(conversionTimeUs(averagingRate));
+    }
+
     uint32_t retries = 0;
     bool locked, ready;
     while (max_retries && retries++ < max_retries) {
-        if (err_code = getStatus(&locked, &ready)) {
+        if (getStatus(&locked, &ready) > 3) {
             return zv;
         }
 
@@ -215,6 +318,7 @@ Vec3<float> HMC5883L::readScaledValuesSingle(uint8_t *saturated, uint32_t max_re
             break;
         }
 
+        HMC_TRACE_SCOPE("usleep");
         usleep(delay_time*1e3);        // Convert milliseconds to microseconds
     }
 
@@ -246,13 +350,14 @@ Vec3<float> HMC5883L::readCalibratedValues(uint8_t *saturated) {
     @return Returns the value of `readScaledValues()`, scaled by the calibration, in mG. On error,
             returns (0, 0, 0) and sets the error code.
     */
+    HMC_TRACE_SCOPE("HMC5883L::readCalibratedValues");
 
     // No need to check for error code - scaledValues returns a zero vector on error
-    return readScaledValues(saturated) * calibration;
+    return readScaledValues(saturated) * hmc_calibration_float(calibration);
 }
 
 Vec3<float> HMC5883L::readCalibratedValuesSingle(uint8_t *saturated, uint32_t max_retries,
-                                                 uint32_t delay_time) {
+                                                 float delay_time) {
     /** Return the field vector, scaled by the calibration, in milliGauss.
 
     Makes a single call to `readScaledValuesSingle()`, then scales the results by the calibration
@@ -272,16 +377,174 @@ Vec3<float> HMC5883L::readCalibratedValuesSingle(uint8_t *saturated, uint32_t ma
     @return Returns the value of `readScaledValuesSingle()`, scaled by the calibration, in mG. On
             error, returns (0, 0, 0) and sets the error code.
     */
+    HMC_TRACE_SCOPE("HMC5883L::readCalibratedValuesSingle");
 
     // No need to check for error code - scaledValuesSingle returns a zero vector on error
-    return readScaledValuesSingle(saturated, max_retries, delay_time) * calibration;
+    return readScaledValuesSingle(saturated, max_retries, delay_time)
+           * hmc_calibration_float(calibration);
+}
+
+Vec3<float> HMC5883L::readAutoRangedValues(uint8_t *saturated, uint8_t *gain_used) {
+    /** Read the field vector in milliGauss, adjusting the gain to keep the signal in range.
+
+    Reads the field as `readScaledValues()` does, then steps the gain:
+      - Up to the next larger range if any channel is saturated or reads above
+        `HMC_AUTORANGE_HIGH` counts.
+      - Down to the next smaller range once `HMC_AUTORANGE_HOLD` consecutive samples would read
+        below `HMC_AUTORANGE_LOW` counts at that range.
+
+    The gap between the two thresholds and the hold count provide hysteresis, so a field near a
+    range boundary doesn't make the gain oscillate. Only samples measured at the current gain are
+    used for the decision - the first sample after a change, which the device still measures at the
+    previous gain, is scaled by that gain and reported as such in `gain_used`.
+
+    @param[out] *saturated Warning flags in case any of the channels are saturated. Pass `NULL` if
+                           you don't want to read these out. Default value is `NULL`.
+    @param[out] *gain_used The gain setting (see \ref GainSettings) the returned sample was
+                           measured at. Pass `NULL` if you don't want to read this out.
+
+    @return Returns a `Vec3<float>` containing the scaled values for the x, y and z channels or
+            (0, 0, 0) on error. Returns I2C errors from calls to `readRawValues()` and `setGain()`.
+    */
+    HMC_TRACE_SCOPE("HMC5883L::readAutoRangedValues");
+
+    uint8_t sat;
+    Vec3<float> rv = readScaledValues(&sat);
+    if (saturated != NULL) {
+        *saturated = sat;
+    }
+
+    if (err_code) {
+        return rv;
+    }
+
+    uint8_t used = lastSampleGain;
+    if (gain_used != NULL) {
+        *gain_used = used;
+    }
+
+    if (used != gain) {
+        return rv;          // Stale sample from before the last change - don't act on it.
+    }
+
+    float ax = rv.x < 0 ? -rv.x : rv.x;
+    float ay = rv.y < 0 ? -rv.y : rv.y;
+    float az = rv.z < 0 ? -rv.z : rv.z;
+    float peak = ax > ay ? ax : ay;
+    peak = peak > az ? peak : az;
+
+    uint8_t new_gain = gain;
+    if (sat || peak > HMC_AUTORANGE_HIGH * gainValue(gain)) {
+        autoRangeLowCount = 0;
+        if (gain < HMC_GAIN810) {
+            new_gain = gain + 1;
+        }
+    } else if (gain > HMC_GAIN088 && peak < HMC_AUTORANGE_LOW * gainValue(gain - 1)) {
+        if (++autoRangeLowCount >= HMC_AUTORANGE_HOLD) {
+            autoRangeLowCount = 0;
+            new_gain = gain - 1;
+        }
+    } else {
+        autoRangeLowCount = 0;
+    }
+
+    if (new_gain != gain) {
+        if (err_code = setGain(new_gain)) {
+            return Vec3<float>(0.0, 0.0, 0.0);
+        }
+    }
+
+    return rv;
+}
+
+Vec3<int32_t> HMC5883L::readScaledValuesMicroGauss(uint8_t *saturated) {
+    /** Read the field vector and return the value in integer microGauss.
+
+    Integer-only equivalent of `readScaledValues()`, for targets without a floating point unit.
+    The resolution of every gain setting is a whole number of microGauss per LSB (see
+    `gainValuesMicroGauss`), so the result is exactly `1000 * readScaledValues()`, up to the
+    rounding of the `float` result.
+
+    @param[out] *saturated Warning flags in case any of the channels are saturated. Pass `NULL` if
+                           you don't want to read these out. Default value is `NULL`.
+
+    @return Returns a `Vec3<int32_t>` containing the scaled values for the x, y and z channels in
+            µG or (0, 0, 0) on error.
+    */
+    HMC_TRACE_SCOPE("HMC5883L::readScaledValuesMicroGauss");
+
+    Vec3<int> rawValues = readRawValues(saturated);
+
+    if (err_code) {
+        return Vec3<int32_t>(0, 0, 0);
+    }
+
+    Vec3<int32_t> rv = Vec3<int32_t>(rawValues.x, rawValues.y, rawValues.z);
+
+    int32_t scale = gainValueMicroGauss(lastSampleGain);
+    return rv * Vec3<int32_t>(scale, scale, scale);
+}
+
+Vec3<int32_t> HMC5883L::readCalibratedValuesQ16(uint8_t *saturated) {
+    /** Return the calibrated field vector in milliGauss, as Q16.16 fixed-point values.
+
+    Integer-only equivalent of `readCalibratedValues()`, for targets without a floating point
+    unit. The gain and calibration are folded into a single per-axis Q16 scale factor whenever
+    either of them changes (`setGain()`, `getGain(true)`, `getCalibration(true)`), so each read
+    costs one 32-bit multiply per axis (plus a 64-bit division per axis for the one sample
+    measured before a gain change). Divide the result by `1 << HMC_FIXED_Q` (65536) to get mG.
+
+    The only error relative to `readCalibratedValues()` is the rounding of the scale factor to
+    Q16, so the two agree to within `|raw| / 2^17` mG - less than 1/32 mG over the full range of
+    the device. The combined scale (gain resolution times calibration) must be below 8 mG / LSB
+    for the product to fit in 32 bits, which holds for any calibration below 1.8.
+
+    @param[out] *saturated Warning flags in case any of the channels are saturated. Pass `NULL` if
+                           you don't want to read these out. Default value is `NULL`.
+
+    @return Returns a `Vec3<int32_t>` containing the calibrated values for the x, y and z channels
+            in Q16.16 mG, or (0, 0, 0) on error.
+    */
+    HMC_TRACE_SCOPE("HMC5883L::readCalibratedValuesQ16");
+
+    Vec3<int> rawValues = readRawValues(saturated);
+
+    if (err_code) {
+        return Vec3<int32_t>(0, 0, 0);
+    }
+
+    Vec3<int32_t> rv = Vec3<int32_t>(rawValues.x, rawValues.y, rawValues.z);
+
+    // Scale by the gain the sample was measured at, which is not yet the current gain for the
+    // first sample read after a gain change.
+    int32_t g = gainValueMicroGauss(lastSampleGain);
+
+#if defined(HMC5883L_SMALL)
+    // No cached scale in the small profile: µG / LSB times the Q14 calibration, over 250, is the
+    // Q16 mG / LSB scale.
+    return rv * Vec3<int32_t>((g * calibration.x + 125) / 250, (g * calibration.y + 125) / 250,
+                              (g * calibration.z + 125) / 250);
+#else
+    if (lastSampleGain == gain) {
+        return rv * calibratedScaleQ16;
+    }
+
+    // µG / LSB times the Q24 calibration, over 1000 * 2^8, is the Q16 mG / LSB scale. Rounding
+    // this (rather than converting the raw value between gains) keeps the error the same as for
+    // the cached scale.
+    const int64_t d = 1000L << (24 - HMC_FIXED_Q);
+    return rv * Vec3<int32_t>((int32_t)(((int64_t)g * calibrationQ24.x + d / 2) / d),
+                              (int32_t)(((int64_t)g * calibrationQ24.y + d / 2) / d),
+                              (int32_t)(((int64_t)g * calibrationQ24.z + d / 2) / d));
+#endif
 }
 
 Vec3<float> HMC5883L::getCalibration(bool update, uint8_t *saturated,
                                      uint32_t max_retries, float delay_time) {
     /** Runs a positive and negative bias test and sets the calibration from the average
 
-    Runs `runPosTest()`, then `runNegTest()` and averages the values, and sets the calibration.
+    Runs `runPosTest()`, then `runNegTest()` and averages the magnitudes of the two responses, and
+    sets the calibration to the ratio of that average to the known bias field.
 
     @param[in] update If evaluates to true, run the calibration and update the cache. Otherwise
                       just returns the cached value.
@@ -298,6 +561,7 @@ Vec3<float> HMC5883L::getCalibration(bool update, uint8_t *saturated,
     @return Returns the new calibration value. On error, returns (0, 0, 0) and sets `err_code` to
             the error.
     */
+    HMC_TRACE_SCOPE("HMC5883L::getCalibration");
 
     if (update) {
         Vec3<float> zero_vec = Vec3<float>(0.0, 0.0, 0.0);      // Returned on error
@@ -313,13 +577,17 @@ Vec3<float> HMC5883L::getCalibration(bool update, uint8_t *saturated,
         }
 
         // Update the calibration
-        calibration = (pos_test+neg_test)/2.0;
-        calibration.x /= HMC_BIAS_XY;
-        calibration.y /= HMC_BIAS_XY;
-        calibration.z /= HMC_BIAS_Z;
+        // The negative bias test reads the bias field with the opposite sign.
+        Vec3<float> cal = (pos_test-neg_test)/2.0;
+        cal.x /= HMC_BIAS_XY;
+        cal.y /= HMC_BIAS_XY;
+        cal.z /= HMC_BIAS_Z;
+
+        calibration = calibration_from_float(cal);
+        updateFixedScale();
     }
 
-    return calibration;
+    return hmc_calibration_float(calibration);
 }
 
 Vec3<float> HMC5883L::runPosTest(uint8_t *saturated, uint32_t max_retries, float delay_time) {
@@ -331,6 +599,7 @@ Vec3<float> HMC5883L::runPosTest(uint8_t *saturated, uint32_t max_retries, float
     @return Returns the value of a positive-biased measurement. On error, returns (0, 0, 0) and
             sets `err_code` to the error.
     */
+    HMC_TRACE_SCOPE("HMC5883L::runPosTest");
 
     Vec3<float> zero_vec = Vec3<float>(0.0, 0.0, 0.0);      // Returned on error
 
@@ -353,7 +622,7 @@ Vec3<float> HMC5883L::runPosTest(uint8_t *saturated, uint32_t max_retries, float
     return rv;
 }
 
-Vec3<float> HMC5883L::runNegTest(uint8_t *saturated, uint32_t max_retries, uint32_t delay_time) {
+Vec3<float> HMC5883L::runNegTest(uint8_t *saturated, uint32_t max_retries, float delay_time) {
     /** Runs the negative bias self-test
 
     Sets the bias mode to `HMC_BIAS_NEGATIVE`, makes a measurement, then returns the bias mode to
@@ -362,6 +631,7 @@ Vec3<float> HMC5883L::runNegTest(uint8_t *saturated, uint32_t max_retries, uint3
     @return Returns the value of a negative-biased measurement. On error, returns (0, 0, 0) and
             sets `err_code` to the error.
     */
+    HMC_TRACE_SCOPE("HMC5883L::runNegTest");
 
     Vec3<float> zero_vec = Vec3<float>(0.0, 0.0, 0.0);
 
@@ -384,6 +654,231 @@ Vec3<float> HMC5883L::runNegTest(uint8_t *saturated, uint32_t max_retries, uint3
     return rv;
 }
 
+static uint8_t state_crc8(const uint8_t *data, uint8_t length) {
+    /** CRC-8 (polynomial 0x07) used to check saved state blobs. */
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t b = 0; b < 8; b++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+uint8_t HMC5883L::saveState(uint8_t *blob, uint8_t length) {
+    /** Serialize the device settings and calibration, for a fast warm start with `restoreState()`.
+
+    The blob is `HMC_STATE_SIZE` bytes and can be stored anywhere - EEPROM on a microcontroller, a
+    file on Linux. The settings come from the cache, so the only bus traffic is a read of the
+    identification registers, which are saved as a fingerprint of the device. The calibration is
+    stored in the native `float` format, so a blob should be restored on the same platform.
+
+    | Offset | Size | Contents                                             |
+    | :----: | :--: | :--------------------------------------------------- |
+    |    0   |   2  | Magic, "hs"                                          |
+    |    2   |   1  | Version (1)                                          |
+    |    3   |   3  | Identification registers                             |
+    |    6   |   3  | Configuration registers A and B, mode register       |
+    |    9   |  12  | Calibration, x, y, z                                 |
+    |   21   |   1  | CRC-8 of bytes 0-20                                  |
+
+    @param[out] blob The output buffer.
+    @param[in] length The size of `blob`, which must be at least `HMC_STATE_SIZE`.
+
+    @return Returns `0` on no error. Returns I2C errors from reading the identification registers,
+            as well as:
+            - \c `EC_STATE_BUFFER` Returned if `length` is less than `HMC_STATE_SIZE`.
+    */
+    HMC_TRACE_SCOPE("HMC5883L::saveState");
+
+    if (length < HMC_STATE_SIZE) {
+        err_code = EC_STATE_BUFFER;
+        return err_code;
+    }
+
+    uint8_t *ident = I2CDevice.read_data(IdentRegister, 3);
+    if (err_code = I2CDevice.get_err_code()) {
+        return err_code;
+    }
+
+    blob[0] = 'h';
+    blob[1] = 's';
+    blob[2] = 1;
+    memcpy(&blob[3], ident, 3);
+
+    configRegisters(&blob[6]);
+
+    Vec3<float> c = hmc_calibration_float(calibration);
+    float cal[3] = {c.x, c.y, c.z};
+    memcpy(&blob[9], cal, sizeof(cal));
+    blob[21] = state_crc8(blob, 21);
+
+    return 0;
+}
+
+uint8_t HMC5883L::restoreState(const uint8_t *blob, uint8_t length, float tolerance,
+                               bool *recalibrated) {
+    /** Warm start from a blob written by `saveState()`, in place of `initialize()`.
+
+    Starts communication, checks the identification registers against the saved fingerprint and
+    writes all three configuration registers in a single burst. The settings cache and the
+    calibration are restored from the blob, so the device is ready to read calibrated values after
+    two transactions instead of the mode and bias register churn of `getCalibration(true)`.
+
+    If `tolerance` is positive, the calibration is then validated with a single positive self-test
+    (`runPosTest()`), which should read the known bias field scaled by the calibration. If any axis
+    is off by more than `tolerance` (relative), the device is recalibrated with
+    `getCalibration(true)`. Each self-test measurement is read once the conversion time has passed
+    and RDY is set, checking the status up to `HMC_STATE_RETRIES` times.
+
+    @param[in] blob A blob written by `saveState()`.
+    @param[in] length The size of `blob`.
+    @param[in] tolerance The relative drift of the self-test response tolerated before
+                         recalibrating. Pass 0 to skip validation. Default is
+                         `HMC_STATE_TOLERANCE`.
+    @param[out] recalibrated Set to `true` if validation failed and the device was recalibrated.
+                             Pass `NULL` (default) if you don't want to read this out.
+
+    @return Returns `0` on no error. Returns I2C errors, errors from `runPosTest()` and
+            `getCalibration()`, as well as:
+            - \c `EC_STATE_INVALID` Returned if the blob is truncated, corrupt or from another
+                                    version. The device is not touched.
+            - \c `EC_STATE_MISMATCH` Returned if the device doesn't match the saved fingerprint.
+
+            Errors are also stored in `err_code`.
+    */
+    HMC_TRACE_SCOPE("HMC5883L::restoreState");
+
+    if (recalibrated != NULL) {
+        *recalibrated = false;
+    }
+
+    if (length < HMC_STATE_SIZE || blob[0] != 'h' || blob[1] != 's' || blob[2] != 1
+            || state_crc8(blob, 21) != blob[21]) {
+        err_code = EC_STATE_INVALID;
+        return err_code;
+    }
+
+    I2CDevice.start();
+
+    uint8_t *ident = I2CDevice.read_data(IdentRegister, 3);
+    if (err_code = I2CDevice.get_err_code()) {
+        return err_code;
+    }
+
+    if (memcmp(ident, &blob[3], 3)) {
+        err_code = EC_STATE_MISMATCH;
+        return err_code;
+    }
+
+    if (err_code = I2CDevice.write_data(ConfigRegisterA, &blob[6], 3)) {
+        return err_code;
+    }
+
+    averagingRate = (blob[6] >> 5) & 0x3;
+    outputRate = (blob[6] >> 2) & 0x7;
+    biasMode = blob[6] & 0x3;
+    gain = sampleGain = lastSampleGain = blob[7] >> 5;
+    measurementMode = blob[8] & 0x3;
+    nextSampleUs = hmc_micros() + conversionTimeUs(averagingRate);
+    autoRangeLowCount = 0;
+
+    float cal[3];
+    memcpy(cal, &blob[9], sizeof(cal));
+    calibration = calibration_from_float(Vec3<float>(cal[0], cal[1], cal[2]));
+    updateFixedScale();
+
+    if (tolerance <= 0) {
+        return 0;
+    }
+
+    Vec3<float> pos = runPosTest(NULL, HMC_STATE_RETRIES);
+    if (err_code) {
+        return err_code;
+    }
+
+    Vec3<float> expected = hmc_calibration_float(calibration)
+                           * Vec3<float>(HMC_BIAS_XY, HMC_BIAS_XY, HMC_BIAS_Z);
+    Vec3<float> drift = (pos - expected) / expected;
+    if (drift.x > tolerance || drift.x < -tolerance || drift.y > tolerance
+            || drift.y < -tolerance || drift.z > tolerance || drift.z < -tolerance) {
+        getCalibration(true, NULL, HMC_STATE_RETRIES);
+        if (recalibrated != NULL) {
+            *recalibrated = true;
+        }
+        return err_code;
+    }
+
+    return 0;
+}
+
+uint8_t HMC5883L::recover(bool *restored) {
+    /** Check that the device still holds the cached configuration, and restore it if not.
+
+    A brown-out or glitch can reset the device to its power-on configuration without the host
+    noticing - every later sample is then taken at the wrong gain, rate or mode. This reads back
+    the configuration and mode registers (one 3-byte read) and, if they don't match the settings
+    cached by this object, rewrites all three in a single burst. The calibration and other cached
+    state are kept, so this is much cheaper than `initialize()` followed by reconfiguration.
+
+    The power-on configuration is the same as the `initialize()` defaults, so a reset of a device
+    left at the defaults is only detected if it was in continuous mode - but then there is also
+    nothing else to restore.
+
+    `readSample()`, and so every read built on it, calls this every `HMC_VERIFY_INTERVAL` reads
+    and after a failed read, just before reading the data registers. That order matters on the
+    device: reading the mode register sets LOCK, which holds back new measurements until the data
+    registers have all been read. Call it yourself after other long pauses, or with
+    `HMC_VERIFY_INTERVAL` set to 0.
+
+    @param[out] restored Set to `true` if the configuration had to be restored. Pass `NULL`
+                         (default) if you don't want to read this out.
+
+    @return Returns `0` on no error, otherwise I2C errors from the read or the write.
+    */
+    HMC_TRACE_SCOPE("HMC5883L::recover");
+
+    if (restored != NULL) {
+        *restored = false;
+    }
+
+#if HMC_VERIFY_INTERVAL > 0
+    verifyCountdown = HMC_VERIFY_INTERVAL;
+#endif
+
+    uint8_t *regs = I2CDevice.read_data(ConfigRegisterA, 3);
+    if (err_code = I2CDevice.get_err_code()) {
+        return err_code;
+    }
+
+    uint8_t expected[3];
+    configRegisters(expected);
+
+    // Finished single measurements leave the device idle, so only the continuous bit is checked.
+    bool continuous = (regs[2] & 0x3) == HMC_MeasurementContinuous;
+    if (regs[0] == expected[0] && regs[1] == expected[1]
+            && continuous == (expected[2] == HMC_MeasurementContinuous)) {
+        return 0;
+    }
+
+    if (err_code = I2CDevice.write_data(ConfigRegisterA, expected, 3)) {
+        return err_code;
+    }
+
+    // Whatever is in the data registers was measured at the power-on gain, as is the next sample.
+    sampleGain = lastSampleGain = HMC_GAIN130;
+    nextSampleUs = hmc_micros() + conversionTimeUs(averagingRate);
+    autoRangeLowCount = 0;
+
+    if (restored != NULL) {
+        *restored = true;
+    }
+
+    return 0;
+}
+
 uint8_t  HMC5883L::getStatus(bool *isLocked, bool *isReady) {
     /** Read the status register
     
@@ -393,6 +888,7 @@ uint8_t  HMC5883L::getStatus(bool *isLocked, bool *isReady) {
     @return Returns the value of the status register, or a value >= 4 on error (no valid status
             register values are > 3). On error, `err_code` is also set.
     */
+    HMC_TRACE_SCOPE("HMC5883L::getStatus");
     
     // Read the status register and mask out the bottom two bits.
     uint8_t regValue = I2CDevice.read_data_byte(StatusRegister) & 0x3;
@@ -427,10 +923,16 @@ uint8_t HMC5883L::setGain(uint8_t gain_level) {
     | `HMC_GAIN560` |    6   |     330      |   ±5.60   |        3.03           |
     | `HMC_GAIN810` |    7   |     230      |   ±8.10   |        4.35           |
 
+    The new gain is only effective from the second measurement after the change - the next
+    measurement is still made at the previous gain, and is scaled by it in `readScaledValues()`
+    and the functions built on it. Measurements are counted as single measurements are triggered
+    and, in continuous mode, by the output period.
+
     @return Returns `0` on no error. Otherwise returns error code. Returns I2C errors from calls to
             `write_data()`, as well as:
             - \c `EC_BAD_GAIN_LEVEL` Returned if input gain level is out of range.
     */
+    HMC_TRACE_SCOPE("HMC5883L::setGain");
 
     // Validate input
     if (gain_level > 7) {
@@ -442,8 +944,11 @@ uint8_t HMC5883L::setGain(uint8_t gain_level) {
     // Write the data to the configuration register. On failure, return error code.
     if(rv = I2CDevice.write_data(ConfigRegisterB, gain_level << 5)) { return rv; }
 
-    // Update gain value cache.
+    // Update gain value cache. The device applies the new gain from the second measurement on,
+    // which `newMeasurement()` keeps track of.
+    countMeasurements();
     gain = gain_level;
+    updateFixedScale();
 
     return 0;
 }
@@ -467,6 +972,7 @@ uint8_t HMC5883L::setAveragingRate(uint8_t avg_rate) {
             `read_data()` and `write_data()`, as well as:
             - \c `EC_INVALID_NAVG` Returned if the number of averages is out of range.
     */
+    HMC_TRACE_SCOPE("HMC5883L::setAveragingRate");
     
     // Validate input
     if (avg_rate > 3) {
@@ -510,6 +1016,7 @@ uint8_t HMC5883L::setOutputRate(uint8_t out_rate) {
             `I2CDev.write_data()`, as well as:
             - \c `EC_INVALID_OUTRATE` Returned if the output rate is out of range.
     */
+    HMC_TRACE_SCOPE("HMC5883L::setOutputRate");
 
     // Validate input
     if (out_rate > 6) {
@@ -547,6 +1054,7 @@ uint8_t HMC5883L::setMeasurementMode(uint8_t mode) {
             `I2CDev.write_data()`, as well as:
             - \c `EC_INVALID_MEASUREMENT_MODE` Returned if the measurement mode is out of range. 
     */
+    HMC_TRACE_SCOPE("HMC5883L::setMeasurementMode");
 
     if (mode > 2) {
         return EC_INVALID_MEASUREMENT_MODE;
@@ -564,7 +1072,14 @@ uint8_t HMC5883L::setMeasurementMode(uint8_t mode) {
     }
 
     // Update cache
+    countMeasurements();
     measurementMode = mode;
+    if (mode == HMC_MeasurementSingle) {
+        newMeasurement();
+    } else if (mode == HMC_MeasurementContinuous) {
+        nextSampleUs = hmc_micros() + conversionTimeUs(averagingRate);
+    }
+
     return 0;
 }
 
@@ -590,6 +1105,7 @@ uint8_t HMC5883L::setBiasMode(uint8_t mode) {
     @return Returns `0` on no error. Returns I2C errors from calls to `I2CDev.read_data()` and
             `I2CDev.write_data()`
     */
+    HMC_TRACE_SCOPE("HMC5883L::setBiasMode");
     if (mode > 2) {
         return EC_INVALID_BIAS_MODE;
     }
@@ -616,6 +1132,7 @@ uint8_t HMC5883L::setHighSpeedI2CMode(bool enabled) {
     @return Returns `0` on no error. returns I2C errors from calls to `I2CDev.read_data()` and
             `I2CDev.write_data()`. 
     */
+    HMC_TRACE_SCOPE("HMC5883L::setHighSpeedI2CMode");
 
     // Get the configuration register and mask out bit 7
     uint8_t modeRegister = I2CDevice.read_data_byte(ModeRegister) & 0x80;
@@ -642,13 +1159,15 @@ uint8_t HMC5883L::getGain(bool updateCache) {
     @return Returns `0` on no error. Returns I2C errors from call to `I2CDev.read_data()` if
             `updateCache` is `true`. Otherwise no errors are returned.
     */
+    HMC_TRACE_SCOPE("HMC5883L::getGain");
     if (updateCache) {
         uint8_t regValue = I2CDevice.read_data_byte(ConfigRegisterB);
         if (err_code = I2CDevice.get_err_code()) {
             return err_code;
         }
 
-        gain = regValue >> 5;
+        gain = sampleGain = regValue >> 5;
+        updateFixedScale();
     }
 
     return gain;
@@ -666,6 +1185,7 @@ uint8_t HMC5883L::getAveragingRate(bool updateCache) {
     @return Returns `0` on no error. Returns I2C errors from call to `I2CDev.read_data()` if
             `updateCache` is `true`. Otherwise no errors are returned.
     */
+    HMC_TRACE_SCOPE("HMC5883L::getAveragingRate");
 
     if (updateCache) {
         uint8_t regValue = I2CDevice.read_data_byte(ConfigRegisterA);
@@ -692,6 +1212,7 @@ uint8_t HMC5883L::getOutputRate(bool updateCache) {
     @return Returns `0` on no error. Returns I2C errors from call to `I2CDev.read_data()` if
             `updateCache` is `true`. Otherwise no errors are returned.
     */
+    HMC_TRACE_SCOPE("HMC5883L::getOutputRate");
 
     if (updateCache) {
         uint8_t regValue = I2CDevice.read_data_byte(ConfigRegisterA);
@@ -720,6 +1241,7 @@ uint8_t HMC5883L::getMeasurementMode(bool updateCache) {
     @return Returns `0` on no error. Returns I2C errors from call to `I2CDev.read_data()` if
             `updateCache` is `true`. Otherwise no errors are returned.
     */
+    HMC_TRACE_SCOPE("HMC5883L::getMeasurementMode");
 
     if (updateCache || measurementMode == HMC_MeasurementSingle) {
         uint8_t regValue = I2CDevice.read_data_byte(ModeRegister);
@@ -743,6 +1265,7 @@ uint8_t HMC5883L::getBiasMode(bool updateCache) {
     @return Returns `0` on no error. Returns I2C errors from call to `I2CDev.read_data()` if
             `updateCache` is `true`. Otherwise no errors are returned.
     */
+    HMC_TRACE_SCOPE("HMC5883L::getBiasMode");
 
     if (updateCache) {
         uint8_t regValue = I2CDevice.read_data_byte(ConfigRegisterA);
@@ -754,7 +1277,89 @@ uint8_t HMC5883L::getBiasMode(bool updateCache) {
     return biasMode;
 }
 
-uint8_t HMC5883L:get_error_code() {
+uint8_t HMC5883L::getSampleGain() {
+    /** Retrieve the gain setting the last sample read was measured at.
+
+    This is the same as `getGain()`, except for the first measurement after a gain change, which
+    the device still makes at the previous gain (see `setGain()`). Use it to scale values from
+    `readRawValues()`.
+
+    @return Returns the gain setting (see \ref GainSettings) of the last sample read.
+    */
+    return lastSampleGain;
+}
+
+uint8_t HMC5883L::get_error_code() {
     /** Return the error code set by one of the functions. */
     return err_code;
+}
+
+HMC5883LBus *HMC5883L::getBus() {
+    /** Returns the transport, e.g. to configure a `RetryDev` or `SimI2CDev`. */
+    return &I2CDevice;
+}
+
+void HMC5883L::newMeasurement() {
+    /** Account for a new measurement: the one now in the data registers was made at the gain
+    noted for the next one, and the next one is made at the gain set now. */
+    lastSampleGain = sampleGain;
+    sampleGain = gain;
+}
+
+void HMC5883L::countMeasurements() {
+    /** In continuous mode, account for the measurements written since the last call, going by the
+    output period. Only the last two matter: one for the data, the one before for its gain. */
+    if (measurementMode != HMC_MeasurementContinuous) {
+        return;
+    }
+
+    int32_t late = (int32_t)(hmc_micros() - nextSampleUs);
+    if (late < 0) {
+        return;
+    }
+
+    uint32_t period = 1e6 / outputRateHz(outputRate);
+    uint32_t conversion = conversionTimeUs(averagingRate);
+    period = period > conversion ? period : conversion;
+
+    uint32_t n = late / period + 1;
+    nextSampleUs += n * period;
+    newMeasurement();
+    if (n > 1) {
+        newMeasurement();
+    }
+}
+
+void HMC5883L::configRegisters(uint8_t *regs) {
+    /** Compose configuration registers A and B and the mode register from the cached settings. */
+
+    // A single measurement finishes in idle, so that's the mode to come back up in.
+    uint8_t mode = measurementMode == HMC_MeasurementSingle ? HMC_MeasurementIdle : measurementMode;
+    regs[0] = (averagingRate << 5) | (outputRate << 2) | biasMode;
+    regs[1] = gain << 5;
+    regs[2] = mode;
+}
+
+void HMC5883L::updateFixedScale() {
+    /** Recompute the fixed-point scale used by `readCalibratedValuesQ16()`.
+
+    Combines the resolution of the current gain setting with the calibration into a per-axis Q16
+    scale factor, and keeps the calibration alone in Q24 to scale samples measured at a previous
+    gain. This is the only place the fixed-point path touches floating point, and it is
+    only called when the gain or calibration changes. The small profile computes the scale on each
+    read instead, so there is nothing to do.
+    */
+
+#if !defined(HMC5883L_SMALL)
+    Vec3<float> scale = calibration * (gainValue(gain) * (1L << HMC_FIXED_Q));
+
+    calibratedScaleQ16 = Vec3<int32_t>((int32_t)(scale.x + (scale.x < 0 ? -0.5 : 0.5)),
+                                       (int32_t)(scale.y + (scale.y < 0 ? -0.5 : 0.5)),
+                                       (int32_t)(scale.z + (scale.z < 0 ? -0.5 : 0.5)));
+
+    Vec3<float> cal = calibration * (float)(1L << 24);
+    calibrationQ24 = Vec3<int32_t>((int32_t)(cal.x + (cal.x < 0 ? -0.5 : 0.5)),
+                                   (int32_t)(cal.y + (cal.y < 0 ? -0.5 : 0.5)),
+                                   (int32_t)(cal.z + (cal.z < 0 ? -0.5 : 0.5)));
+#endif
 }
\ No newline at end of file
@@ -12,9 +12,53 @@ This code is released under a Creative Commons Attribution 4.0 International lic
 #ifndef HMC5883L_H
 #define HMC5883L_H
 
-#include <I2CDev.h>
 #include <Vec3.h>
+#include <HMCSample.h>
+
+/* The register-level transport. By default this is the Arduino Wire-based `I2CDev`; define
+   `HMC5883L_USE_IIO` to go through the Linux kernel's IIO driver with `IIODev` instead, or
+   `HMC5883L_USE_SIM` to run against the simulated device in `SimI2CDev`. Define
+   `HMC5883L_USE_RETRY` as well to wrap the transport in a `RetryDev`. */
+#if defined(HMC5883L_USE_IIO)
+#include <IIODev.h>
+typedef IIODev HMC5883LBaseBus;
+#elif defined(HMC5883L_USE_SIM)
+#include <SimI2CDev.h>
+typedef SimI2CDev HMC5883LBaseBus;
+#else
+#include <I2CDev.h>
 #include <Wire.h>
+typedef I2CDev HMC5883LBaseBus;
+#endif
+
+#if defined(HMC5883L_USE_RETRY)
+#include <RetryDev.h>
+typedef RetryDev<HMC5883LBaseBus> HMC5883LBus;
+#else
+typedef HMC5883LBaseBus HMC5883LBus;
+#endif
+
+/* Footprint profile for small microcontrollers. Define `HMC5883L_SMALL` (for every translation
+   unit, since it changes the layout of the classes) to pack the cached settings into bit-fields,
+   keep the calibration as Q14 fixed point (see `HMCCalibration`) without a cached Q16 scale, shrink
+   the `I2CDev` read buffer and, on AVR, move the lookup tables to flash. The tables must then be
+   read through the accessors, e.g. `HMC5883L::gainValue()`, rather than indexed directly. */
+#if defined(HMC5883L_SMALL)
+#define HMC_BITS(n) : n
+#else
+#define HMC_BITS(n)
+#endif
+
+#if defined(HMC5883L_SMALL) && defined(__AVR__)
+#include <avr/pgmspace.h>
+#define HMC_PROGMEM PROGMEM
+#define hmc_read_float(p) pgm_read_float(p)
+#define hmc_read_word(p) pgm_read_word(p)
+#else
+#define HMC_PROGMEM
+#define hmc_read_float(p) (*(p))
+#define hmc_read_word(p) (*(p))
+#endif
 
 /** @defgroup DeviceAddrs Device addresses
 @{ */
@@ -46,6 +90,8 @@ This code is released under a Creative Commons Attribution 4.0 International lic
                                          `DZRB` (LSB), `DYRA` (MSB), `DYRB` (LSB). */
 #define StatusRegister 0x09         /*!< Register address for the status register, which contains
                                          the `LOCK` [1] and `RDY` [0]. See `getStatus()`. */
+#define IdentRegister 0x0A          /*!< Starting address for the three identification registers,
+                                         which always read `HMC_IDENT` ("H43"). */
 
 /** @}*/
 
@@ -53,8 +99,27 @@ This code is released under a Creative Commons Attribution 4.0 International lic
 Constants related to device operations. 
 @{ */
 #define HMC_SLEEP_DELAY 7           /*!< Sleep delay in milliseconds (rounded up from 160 Hz) */
+#define HMC_CONVERSION_US 6000      /*!< Time of one conversion, in microseconds, see
+                                         `HMC5883L::conversionTimeUs()` */
 #define HMC_BIAS_XY 1160.0          /*!< Bias applied by the self-test coils along X and Y, in mG */
 #define HMC_BIAS_Z 1080.0           /*!< Bias applied by the self-test coils along Z, in mG */
+#define HMC_AUTORANGE_HIGH 1800     /*!< Auto-ranging: step up a range above this many counts */
+#define HMC_AUTORANGE_LOW 1200      /*!< Auto-ranging: step down a range if the field would read
+                                         below this many counts at the smaller range */
+#define HMC_AUTORANGE_HOLD 8        /*!< Auto-ranging: low samples in a row before stepping down
+                                         (at most 15) */
+#define HMC_IDENT "H43"             /*!< Contents of the identification registers */
+#define HMC_STATE_SIZE 22           /*!< Size in bytes of the blob written by `saveState()` */
+#define HMC_STATE_TOLERANCE 0.05    /*!< Default relative drift of the self-test response tolerated
+                                         by `restoreState()` before recalibrating */
+#define HMC_STATE_RETRIES 3         /*!< Status checks before reading each self-test measurement
+                                         of `restoreState()` */
+#define HMC_FIXED_Q 16              /*!< Fractional bits of fixed-point values, see
+                                         `HMC5883L::readCalibratedValuesQ16()` */
+#ifndef HMC_VERIFY_INTERVAL
+#define HMC_VERIFY_INTERVAL 16      /*!< Reads between automatic `HMC5883L::recover()` checks for a
+                                         device reset (at most 255), or 0 for none */
+#endif
 /** @} */
 
 /** @defgroup DeviceSettings Device settings
@@ -128,6 +193,9 @@ Error codes and warning codes. Error codes can be retrieved from `HMC5883L::get_
 #define EC_INVALID_MEASUREMENT_MODE 11      /*!< Invalid measurement mode specified.  */
 #define EC_INVALID_BIAS_MODE 12             /*!< Invalid bias mode specified. */
 #define EC_INVALID_UFLOAT 13                /*!< Float specified cannot be negative. */
+#define EC_STATE_INVALID 22                 /*!< Saved state is corrupt or from another version. */
+#define EC_STATE_MISMATCH 23                /*!< Saved state is from a different kind of device. */
+#define EC_STATE_BUFFER 24                  /*!< Buffer too small for the saved state. */
 
 /** @defgroup SaturationWarningCodes Saturation warning codes
 @ingroup ErrorCodes
@@ -146,10 +214,16 @@ class HMC5883L {
     /** HMC5883L 3-axis digital magnetometer class object */
 public:
     HMC5883L();
+#if defined(HMC5883L_USE_IIO)
+    HMC5883L(const char *sysfs_dir, const char *buffer_dev);
+#else
+    HMC5883L(const HMC5883LBus &device);
+#endif
 
     uint8_t initialize(bool noConfig=false);
 
     Vec3<int> readRawValues(uint8_t *saturated=NULL);
+    HMCSample readSample(void);
     Vec3<float> readScaledValues(uint8_t *saturated=NULL);
     Vec3<float> readScaledValuesSingle(uint8_t *saturated=NULL, uint32_t max_retries=0,
                                        uint32_t delay_time=HMC_SLEEP_DELAY);
@@ -157,6 +231,11 @@ public:
     Vec3<float> readCalibratedValuesSingle(uint8_t *saturated=NULL, uint32_t max_retries=0,
                                            float delay_time=HMC_SLEEP_DELAY);
 
+    Vec3<float> readAutoRangedValues(uint8_t *saturated=NULL, uint8_t *gain_used=NULL);
+
+    Vec3<int32_t> readScaledValuesMicroGauss(uint8_t *saturated=NULL);
+    Vec3<int32_t> readCalibratedValuesQ16(uint8_t *saturated=NULL);
+
     Vec3<float> getCalibration(bool update, uint8_t *saturated=NULL, 
                                uint32_t max_retries=0, float delay_time=HMC_SLEEP_DELAY);
 
@@ -165,6 +244,12 @@ public:
     Vec3<float> runNegTest(uint8_t *saturated=NULL, uint32_t max_retries=0,
                            float delay_time=HMC_SLEEP_DELAY);
 
+    uint8_t saveState(uint8_t *blob, uint8_t length);
+    uint8_t restoreState(const uint8_t *blob, uint8_t length,
+                         float tolerance=HMC_STATE_TOLERANCE, bool *recalibrated=NULL);
+
+    uint8_t recover(bool *restored=NULL);
+
     uint8_t getStatus(bool *isLocked, bool *isReady);
 
     uint8_t setGain(uint8_t gain_level);
@@ -179,25 +264,59 @@ public:
     uint8_t getOutputRate(bool updateCache=false);
     uint8_t getMeasurementMode(bool updateCache=false);
     uint8_t getBiasMode(bool updateCache=false);
+    uint8_t getSampleGain(void);
 
     uint8_t get_error_code(void);
+    HMC5883LBus *getBus(void);
 
     static const float outputRates[];  /*!< Output rates in Hz (see \ref OutputRates). */
     static const float gainRanges[];   /*!< Saturation ranges in mG. See \ref GainSettings */
+    static const float gainValues[];   /*!< Resolution in mG / LSB. See \ref GainSettings */
+    static const uint16_t gainValuesMicroGauss[]; /*!< Resolution in µG / LSB. */
+
+    static float outputRateHz(uint8_t out_rate) { return hmc_read_float(&outputRates[out_rate]); }
+    static float gainRange(uint8_t gain_level) { return hmc_read_float(&gainRanges[gain_level]); }
+    static float gainValue(uint8_t gain_level) { return hmc_read_float(&gainValues[gain_level]); }
+    static uint16_t gainValueMicroGauss(uint8_t gain_level) {
+        return hmc_read_word(&gainValuesMicroGauss[gain_level]);
+    }
+    static uint32_t conversionTimeUs(uint8_t avg_rate) {
+        /** Time for a single measurement to complete at averaging rate `avg_rate` (see
+        \ref AvgSettings), in microseconds: one `HMC_CONVERSION_US` conversion per
+        averaged sample. Wait this long after triggering a single measurement before reading it. */
+        return (uint32_t)HMC_CONVERSION_US << avg_rate;
+    }
 
 private:
-    I2CDev I2CDevice;                  /*!< The I2C interface device */
-    Vec3<float> calibration;           /*!< The current calibration for the magnetometer */
-
-    uint8_t gain;
-    uint8_t averagingRate;
-    uint8_t outputRate;
-    uint8_t measurementMode;
-    uint8_t biasMode;
+    void configRegisters(uint8_t *regs);
+    void newMeasurement(void);
+    void countMeasurements(void);
+
+    HMC5883LBus I2CDevice;             /*!< The I2C interface device */
+    HMCCalibration calibration;        /*!< The current calibration for the magnetometer */
+#if !defined(HMC5883L_SMALL)
+    Vec3<int32_t> calibratedScaleQ16;  /*!< Gain and calibration combined, in Q16 mG / LSB */
+    Vec3<int32_t> calibrationQ24;      /*!< The calibration alone, in Q24, for other gains */
+#endif
+    uint32_t nextSampleUs;             /*!< When the next continuous measurement is written, in
+                                            `hmc_micros()` time */
+
+    // Ordered so that, as bit-fields, no field straddles a byte.
+    uint8_t gain HMC_BITS(3);
+    uint8_t sampleGain HMC_BITS(3);        /*!< Gain the next measurement is made at */
+    uint8_t measurementMode HMC_BITS(2);
+    uint8_t lastSampleGain HMC_BITS(3);    /*!< Gain the data registers were measured at */
+    uint8_t outputRate HMC_BITS(3);
+    uint8_t biasMode HMC_BITS(2);
+    uint8_t autoRangeLowCount HMC_BITS(4); /*!< Consecutive samples below `HMC_AUTORANGE_LOW` */
+    uint8_t averagingRate HMC_BITS(2);
 
     uint8_t err_code;
+#if HMC_VERIFY_INTERVAL > 0
+    uint8_t verifyCountdown;           /*!< Reads left before the next `recover()` check */
+#endif
 
-    static const float gainValues[];
+    void updateFixedScale(void);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+/** @file
+Definition for template class HMC5883LArray, which calibrates whole frames of readings from an
+array of HMC5883L magnetometers at once.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#ifndef HMC5883LARRAY_H
+#define HMC5883LARRAY_H
+
+#include <HMC5883L.h>
+#include <Vec3.h>
+#include <Vec3Block.h>
+#include <math.h>
+
+template<uint16_t N> class HMC5883LArray {
+    /** Batched calibration and vector math for up to `N` sensors.
+
+    A frame is one reading from each sensor, held as a `Vec3Block` whose `i`th element belongs to
+    sensor `i`. Each sensor's calibration is an offset in raw counts (hard iron) followed by a 3x3
+    matrix taking counts to mG (gain, scale and soft iron):
+
+        field = M * (raw - offset)
+
+    Offsets and matrix elements are stored structure-of-arrays - one array per component, indexed
+    by sensor - so every transform is a single branch-free loop over sensors with unit stride,
+    which the compiler can auto-vectorize (GCC does so at `-O3`, but not at `-O2`).
+    */
+public:
+    HMC5883LArray() {
+        /** Constructor. Sensors start with zero offsets and the default gain, uncalibrated. */
+        n_sensors = 0;
+        float s = HMC5883L::gainValue(HMC_GAIN130);      // Power-on default gain
+        float m[9] = {s, 0, 0, 0, s, 0, 0, 0, s};
+        for (uint16_t i = 0; i < N; i++) {
+            setCalibration(i, Vec3<float>(0.0, 0.0, 0.0), m);
+        }
+    }
+
+    void setSensorCount(uint16_t n) {
+        /** Set the number of sensors in each frame, at most `N`. */
+        n_sensors = n < N ? n : N;
+    }
+
+    uint16_t getSensorCount(void) {
+        /** Retrieve the number of sensors in each frame. */
+        return n_sensors;
+    }
+
+    void setCalibration(uint16_t sensor, Vec3<float> offset, const float *matrix) {
+        /** Set the calibration of one sensor.
+
+        @param[in] sensor The index of the sensor.
+        @param[in] offset The offset to subtract from the raw counts.
+        @param[in] matrix The 3x3 matrix from offset counts to mG, row-major (9 elements).
+        */
+        off_x[sensor] = offset.x;
+        off_y[sensor] = offset.y;
+        off_z[sensor] = offset.z;
+        for (uint8_t k = 0; k < 9; k++) {
+            m[k][sensor] = matrix[k];
+        }
+    }
+
+    void setCalibration(uint16_t sensor, HMC5883L *dev) {
+        /** Set the calibration of one sensor from its device object.
+
+        Uses the device's current gain and its self-test calibration (`getCalibration(false)`),
+        i.e. the same scaling as `HMC5883L::readCalibratedValues()`, with zero offset. Readings in
+        the frame must be taken at the gain in effect now.
+        */
+        Vec3<float> scale = dev->getCalibration(false) * HMC5883L::gainValue(dev->getGain());
+        float matrix[9] = {scale.x, 0, 0, 0, scale.y, 0, 0, 0, scale.z};
+        setCalibration(sensor, Vec3<float>(0.0, 0.0, 0.0), matrix);
+    }
+
+    void apply(Vec3Block<int16_t> raw, Vec3Block<float> *field) {
+        /** Calibrate a frame of raw counts.
+
+        @param[in] raw One raw reading per sensor.
+        @param[out] field Receives the field at each sensor in mG. Its `length` is set to the
+                          number of sensors.
+        */
+        uint16_t n = n_sensors;
+        float *fx = field->x, *fy = field->y, *fz = field->z;
+        for (uint16_t i = 0; i < n; i++) {
+            float rx = raw.x[i] - off_x[i];
+            float ry = raw.y[i] - off_y[i];
+            float rz = raw.z[i] - off_z[i];
+            fx[i] = m[0][i] * rx + m[1][i] * ry + m[2][i] * rz;
+            fy[i] = m[3][i] * rx + m[4][i] * ry + m[5][i] * rz;
+            fz[i] = m[6][i] * rx + m[7][i] * ry + m[8][i] * rz;
+        }
+
+        field->length = n;
+    }
+
+    void magnitude(Vec3Block<float> field, float *out) {
+        /** Compute the field magnitude at each sensor of a calibrated frame, in mG. */
+        for (uint16_t i = 0; i < field.length; i++) {
+            out[i] = sqrtf(field.x[i] * field.x[i] + field.y[i] * field.y[i]
+                           + field.z[i] * field.z[i]);
+        }
+    }
+
+    void heading(Vec3Block<float> field, float *out) {
+        /** Compute the heading of each sensor of a calibrated frame.
+
+        Headings are in degrees clockwise from magnetic north, in [0, 360), assuming the sensors
+        are level with their X axis forward. No tilt or declination correction is applied.
+        */
+        for (uint16_t i = 0; i < field.length; i++) {
+            float h = atan2f(field.y[i], field.x[i]) * (float)(180.0 / M_PI);
+            out[i] = h < 0 ? h + 360 : h;
+        }
+    }
+
+    void gradient(Vec3Block<float> field, const uint16_t *from, const uint16_t *to,
+                  const float *inv_baseline, uint16_t n_pairs, Vec3Block<float> *out) {
+        /** Compute the spatial gradient of a calibrated frame between pairs of sensors.
+
+        @param[in] field The calibrated frame.
+        @param[in] from, to The sensor indices of each pair, `n_pairs` of each.
+        @param[in] inv_baseline The reciprocal of the distance between the sensors of each pair
+                                (e.g. in 1/m, giving mG/m), or `NULL` to get the plain difference.
+        @param[in] n_pairs The number of pairs.
+        @param[out] out Receives `field[to] - field[from]` (scaled) for each pair. Its `length` is
+                        set to `n_pairs`.
+        */
+        for (uint16_t p = 0; p < n_pairs; p++) {
+            float s = inv_baseline != NULL ? inv_baseline[p] : 1.0f;
+            out->x[p] = (field.x[to[p]] - field.x[from[p]]) * s;
+            out->y[p] = (field.y[to[p]] - field.y[from[p]]) * s;
+            out->z[p] = (field.z[to[p]] - field.z[from[p]]) * s;
+        }
+
+        out->length = n_pairs;
+    }
+
+private:
+    uint16_t n_sensors;
+    float off_x[N], off_y[N], off_z[N];   /*!< Offsets in raw counts, per sensor */
+    float m[9][N];                        /*!< Calibration matrix, row-major, per sensor */
+};
+
+#endif
@@ -0,0 +1,138 @@
+/** @file
+Class file for a rate-aware reader of the HMC5883L in continuous measurement mode.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#include <HMC5883LContinuousReader.h>
+#include <HMC5883L.h>
+#include <HMCTime.h>
+#include <Vec3.h>
+
+HMC5883LContinuousReader::HMC5883LContinuousReader(HMC5883L *device) {
+    /** Constructor for the continuous reader.
+
+    @param[in] device An initialized `HMC5883L` object. The reader does not take ownership.
+    */
+    dev = device;
+    period_us = 0;
+    last_us = 0;
+    due_us = 0;
+    have_sample = false;
+    last = Vec3<float>(0.0, 0.0, 0.0);
+    last_saturated = 0;
+    seq = 0;
+    missed = 0;
+}
+
+uint8_t HMC5883LContinuousReader::begin() {
+    /** Start reading at the device's currently configured output rate.
+
+    Puts the device in continuous measurement mode, using the output rate cached by the
+    `HMC5883L` object (see `HMC5883L::getOutputRate()`).
+
+    @return Returns `0` on no error, or errors from `HMC5883L::setMeasurementMode()`.
+    */
+
+    uint8_t rv;
+    if (rv = dev->setMeasurementMode(HMC_MeasurementContinuous)) {
+        return rv;
+    }
+
+    // The first measurement is written one conversion after the mode is set, the rest one output
+    // period after the one before.
+    period_us = (uint32_t)(1e6 / HMC5883L::outputRateHz(dev->getOutputRate()) + 0.5);
+    due_us = hmc_micros() + HMC5883L::conversionTimeUs(dev->getAveragingRate());
+    have_sample = false;
+    return 0;
+}
+
+uint8_t HMC5883LContinuousReader::begin(uint8_t out_rate) {
+    /** Set the output rate and start reading in continuous mode.
+
+    @param[in] out_rate The output rate, see `HMC5883L::setOutputRate()`.
+
+    @return Returns `0` on no error, or errors from `HMC5883L::setOutputRate()` and
+            `HMC5883L::setMeasurementMode()`.
+    */
+
+    uint8_t rv;
+    if (rv = dev->setOutputRate(out_rate)) {
+        return rv;
+    }
+
+    return begin();
+}
+
+Vec3<float> HMC5883LContinuousReader::read(uint8_t *saturated, uint32_t *sequence, bool *fresh) {
+    /** Return the latest sample, reading the device only if a new one is due.
+
+    @param[out] *saturated Warning flags of the returned sample. Pass `NULL` if you don't want to
+                           read these out. Default value is `NULL`.
+    @param[out] *sequence Sequence number of the returned sample. Consecutive device samples have
+                          consecutive numbers, so a jump of more than one means samples were
+                          missed. Pass `NULL` if you don't want to read this out.
+    @param[out] *fresh Set to `true` if the returned sample is new since the last call. Pass `NULL`
+                       if you don't want to read this out.
+
+    @return Returns the latest sample in mG (as `HMC5883L::readScaledValues()`). On error, returns
+            (0, 0, 0) and the error can be retrieved from `HMC5883L::get_error_code()`.
+    */
+
+    bool is_fresh = false;
+    uint32_t now = hmc_micros();
+    int32_t since_due = (int32_t)(now - due_us);
+
+    // Wait an eighth of a period past the due time, in case the device's clock runs slow. RDY
+    // stays set after a read, so it can't tell whether the sample is new - reading any earlier
+    // could return the previous sample again.
+    if (since_due >= (int32_t)(period_us / 8)) {
+        bool locked, ready;
+        if (dev->getStatus(&locked, &ready) > 3) {
+            return Vec3<float>(0.0, 0.0, 0.0);
+        }
+
+        if (ready && !locked) {
+            uint8_t sat;
+            Vec3<float> value = dev->readScaledValues(&sat);
+            if (dev->get_error_code()) {
+                return Vec3<float>(0.0, 0.0, 0.0);
+            }
+
+            // The sample due at `due_us`, and one more for each whole period since, have been
+            // written; only the latest of them was read.
+            uint32_t periods = 1 + (uint32_t)since_due / period_us;
+            if (have_sample) {
+                seq += periods;
+                missed += periods - 1;
+            }
+            due_us += periods * period_us;
+
+            last = value;
+            last_saturated = sat;
+            last_us = now;
+            have_sample = true;
+            is_fresh = true;
+        }
+    }
+
+    if (saturated != NULL) { *saturated = last_saturated; }
+    if (sequence != NULL) { *sequence = seq; }
+    if (fresh != NULL) { *fresh = is_fresh; }
+
+    return last;
+}
+
+uint32_t HMC5883LContinuousReader::getSampleTime() {
+    /** Returns the time (from `hmc_micros()`) at which the latest sample was read. */
+    return last_us;
+}
+
+uint32_t HMC5883LContinuousReader::getMissed() {
+    /** Returns the total number of device samples skipped because the reader was polled late. */
+    return missed;
+}
@@ -0,0 +1,59 @@
+/** @file
+Header file for a rate-aware reader of the HMC5883L in continuous measurement mode.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#ifndef HMC5883LCONTINUOUSREADER_H
+#define HMC5883LCONTINUOUSREADER_H
+
+#include <HMC5883L.h>
+#include <Vec3.h>
+
+class HMC5883LContinuousReader {
+    /** Continuous-mode reader which only touches the bus when a new sample is due.
+
+    In continuous mode the device produces a sample every `1 / HMC5883L::outputRateHz(rate)`
+    seconds. `HMC5883L::readScaledValues()` reads the data registers every time it is called, so
+    polling faster than the output rate re-reads the same sample, and polling slower silently
+    drops samples. This reader tracks when the device writes each sample - one conversion time
+    after `begin()`, then every output period, independent of when the samples are read - and:
+
+      - Returns the cached sample without any bus traffic until the next one is due. RDY stays set
+        after a read, so it can't be used to tell a new sample from one already read.
+      - Once it is due, reads the status register and only reads the data registers if RDY is set
+        and LOCK is clear, so a sample that is being written is never read. (A fused 7-byte read of
+        data and status isn't possible - the device's register pointer rolls back from the last
+        data register to the first, rather than on to the status register.)
+      - Numbers each sample, advancing the sequence number by the number of samples the device has
+        written since the previous one was read, so consumers can detect gaps from the jumps.
+    */
+public:
+    HMC5883LContinuousReader(HMC5883L *device);
+
+    uint8_t begin(void);
+    uint8_t begin(uint8_t out_rate);
+
+    Vec3<float> read(uint8_t *saturated=NULL, uint32_t *sequence=NULL, bool *fresh=NULL);
+
+    uint32_t getSampleTime(void);
+    uint32_t getMissed(void);
+
+private:
+    HMC5883L *dev;                     /*!< The magnetometer being read. */
+    uint32_t period_us;                /*!< Output period of the device. */
+    uint32_t last_us;                  /*!< Time at which the last sample was read. */
+    uint32_t due_us;                   /*!< Time at which the next sample is written. */
+    bool have_sample;
+
+    Vec3<float> last;                  /*!< The last sample read. */
+    uint8_t last_saturated;
+    uint32_t seq;
+    uint32_t missed;                   /*!< Total number of samples skipped. */
+};
+
+#endif
@@ -0,0 +1,215 @@
+/** @file
+Class file for a power-aware duty-cycling scheduler for the HMC5883L.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#include <HMC5883LDutyCycle.h>
+#include <HMC5883L.h>
+#include <HMCTime.h>
+#include <Vec3.h>
+#include <math.h>
+
+HMC5883LDutyCycle::HMC5883LDutyCycle(HMC5883L *device) {
+    /** Constructor for the duty-cycle scheduler.
+
+    @param[in] device An initialized `HMC5883L` object. The scheduler does not take ownership.
+    */
+    dev = device;
+    period_us = 0;
+    bus_clock = DUTY_BUS_HZ;
+    conversion_us = HMC_CONVERSION_US;
+    averaging = 1;
+    converting = false;
+    trigger_us = next_us = 0;
+    missed = 0;
+    rechecks = 0;
+    last = Vec3<float>(0.0, 0.0, 0.0);
+    last_saturated = 0;
+}
+
+uint8_t HMC5883LDutyCycle::begin(uint32_t period_ms, float noise_target, uint32_t bus_hz) {
+    /** Configure the device and start the schedule. The first sample is triggered immediately.
+
+    @param[in] period_ms The time between samples, in milliseconds.
+    @param[in] noise_target The largest acceptable noise per sample, in mG, used to choose the
+                            averaging rate (see `chooseAveraging()`). Pass 0 (default) to keep the
+                            device's current averaging rate.
+    @param[in] bus_hz The I2C clock frequency, used only for the budget. Default is 100 kHz.
+
+    @return Returns `0` on no error, or errors from `HMC5883L::setAveragingRate()` and
+            `HMC5883L::setMeasurementMode()`.
+    */
+
+    uint8_t rv;
+    if (noise_target > 0.0) {
+        if (rv = dev->setAveragingRate(chooseAveraging(noise_target, dev->getGain()))) {
+            return rv;
+        }
+    }
+
+    if (rv = dev->setMeasurementMode(HMC_MeasurementIdle)) {
+        return rv;
+    }
+
+    averaging = 1 << dev->getAveragingRate();
+    conversion_us = HMC5883L::conversionTimeUs(dev->getAveragingRate());
+    period_us = period_ms * 1000;
+    bus_clock = bus_hz;
+
+    converting = false;
+    next_us = hmc_micros();
+    return 0;
+}
+
+Vec3<float> HMC5883LDutyCycle::poll(uint8_t *saturated, bool *fresh) {
+    /** Advance the schedule, touching the bus only if a trigger or read is due.
+
+    @param[out] *saturated Warning flags of the returned sample. Pass `NULL` if you don't want to
+                           read these out. Default value is `NULL`.
+    @param[out] *fresh Set to `true` if the returned sample is new since the last call. Pass `NULL`
+                       if you don't want to read this out.
+
+    @return Returns the latest sample in mG (as `HMC5883L::readScaledValues()`). On error, returns
+            (0, 0, 0), the error can be retrieved from `HMC5883L::get_error_code()` and the sample
+            is retried at the next scheduled time.
+    */
+
+    Vec3<float> zv = Vec3<float>(0.0, 0.0, 0.0);    // Returned on error
+    bool is_fresh = false;
+    uint32_t now = hmc_micros();
+
+    if (fresh != NULL) { *fresh = false; }
+
+    if ((int32_t)(now - next_us) >= 0) {
+        if (!converting) {
+            if (dev->setMeasurementMode(HMC_MeasurementSingle)) {
+                trigger_us = next_us;
+                schedule(now);
+                return zv;
+            }
+
+            trigger_us = next_us;
+            converting = true;
+            rechecks = 0;
+            next_us = now + conversion_us;
+        } else {
+            bool locked, ready;
+            if (dev->getStatus(&locked, &ready) > 3) {
+                converting = false;
+                schedule(now);
+                return zv;
+            }
+
+            if ((!ready || locked) && rechecks < DUTY_MAX_RECHECKS) {
+                rechecks++;
+                next_us = now + DUTY_RETRY_US;
+            } else if (!ready || locked) {
+                converting = false;
+                missed++;
+                schedule(now);
+            } else {
+                uint8_t sat;
+                Vec3<float> value = dev->readScaledValues(&sat);
+                converting = false;
+                schedule(now);
+                if (dev->get_error_code()) {
+                    return zv;
+                }
+
+                last = value;
+                last_saturated = sat;
+                is_fresh = true;
+            }
+        }
+    }
+
+    if (saturated != NULL) { *saturated = last_saturated; }
+    if (fresh != NULL) { *fresh = is_fresh; }
+
+    return last;
+}
+
+uint32_t HMC5883LDutyCycle::getTimeToNext() {
+    /** Returns the time until `poll()` next needs to be called, in microseconds. */
+    int32_t remaining = (int32_t)(next_us - hmc_micros());
+    return remaining > 0 ? remaining : 0;
+}
+
+uint32_t HMC5883LDutyCycle::getMissed() {
+    /** Returns the total number of scheduled samples skipped, because `poll()` was called late or
+    the device was still writing the sample after `DUTY_MAX_RECHECKS` status rechecks. */
+    return missed;
+}
+
+DutyCycleBudget HMC5883LDutyCycle::getBudget() {
+    /** Estimate the per-hour cost of the current schedule.
+
+    Device-active time is the conversion time of every averaged conversion. Bus-active time counts
+    `DUTY_BUS_CLOCKS` per sample at the configured I2C clock, i.e. assumes no status rechecks.
+    Charge is the idle current for the whole hour, plus the extra charge of each conversion,
+    derived from the datasheet's average current when measuring at 7.5 Hz.
+    */
+
+    DutyCycleBudget b;
+    b.samples = period_us ? 3600000000u / period_us : 0;
+    b.averaging = averaging;
+    b.noise = expectedNoise(dev->getAveragingRate(), dev->getGain());
+
+    float conversions = (float)b.samples * averaging;
+    float conversion_uC = (DUTY_MEASURE_UA - DUTY_IDLE_UA) / 7.5;
+    b.device_active_s = conversions * HMC_CONVERSION_US / 1e6;
+    b.bus_active_s = (float)b.samples * DUTY_BUS_CLOCKS / bus_clock;
+    b.charge_uAh = DUTY_IDLE_UA + conversions * conversion_uC / 3600.0;
+
+    return b;
+}
+
+float HMC5883LDutyCycle::expectedNoise(uint8_t avg_rate, uint8_t gain) {
+    /** Expected noise of one sample, in mG.
+
+    Combines the single-conversion noise `DUTY_NOISE_MG`, reduced by averaging, with the
+    quantization noise of the gain's resolution.
+
+    @param[in] avg_rate The averaging rate, see `HMC5883L::setAveragingRate()`.
+    @param[in] gain The gain setting, see `HMC5883L::setGain()`.
+    */
+    float q = HMC5883L::gainValue(gain);
+    return sqrt(DUTY_NOISE_MG * DUTY_NOISE_MG / (1 << avg_rate) + q * q / 12.0);
+}
+
+uint8_t HMC5883LDutyCycle::chooseAveraging(float noise_target, uint8_t gain) {
+    /** Choose the smallest averaging rate meeting a noise target.
+
+    @param[in] noise_target The largest acceptable noise per sample, in mG.
+    @param[in] gain The gain setting the samples will be measured at.
+
+    @return Returns the averaging rate (`HMC_AVG1` to `HMC_AVG8`). If even `HMC_AVG8` misses the
+            target, `HMC_AVG8` is returned.
+    */
+    for (uint8_t avg = HMC_AVG1; avg < HMC_AVG8; avg++) {
+        if (expectedNoise(avg, gain) <= noise_target) {
+            return avg;
+        }
+    }
+
+    return HMC_AVG8;
+}
+
+void HMC5883LDutyCycle::schedule(uint32_t now) {
+    /** Schedule the next trigger one period after the last, skipping any already missed. */
+    if (period_us == 0) {
+        next_us = now;
+        return;
+    }
+
+    next_us = trigger_us + period_us;
+    while ((int32_t)(now - next_us) >= 0) {
+        next_us += period_us;
+        missed++;
+    }
+}
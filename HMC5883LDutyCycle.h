@@ -0,0 +1,95 @@
+/** @file
+Header file for a power-aware duty-cycling scheduler for the HMC5883L.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#ifndef HMC5883LDUTYCYCLE_H
+#define HMC5883LDUTYCYCLE_H
+
+#include <HMC5883L.h>
+#include <Vec3.h>
+
+/** @defgroup DutyCycleConstants Duty-cycle constants
+Timing and supply current figures used for scheduling and for the power budget. Currents are
+typical values from the datasheet.
+@{ */
+#define DUTY_RETRY_US 500           /*!< Status recheck interval while the device is writing a
+                                         sample (RDY clear or LOCK set) */
+#define DUTY_MAX_RECHECKS 4         /*!< Status rechecks before a sample is given up as missed */
+#define DUTY_NOISE_MG 2.0           /*!< Noise of a single conversion, in mG */
+#define DUTY_IDLE_UA 2.0            /*!< Supply current in idle mode, in µA */
+#define DUTY_MEASURE_UA 100.0       /*!< Average supply current measuring at 7.5 Hz without
+                                         averaging, in µA */
+#define DUTY_BUS_CLOCKS 154         /*!< SCL clocks per sample: trigger, status and data reads */
+#define DUTY_BUS_HZ 100000          /*!< Default I2C clock, in Hz */
+/** @} */
+
+struct DutyCycleBudget {
+    /** Estimated cost of a duty-cycle schedule, per hour. */
+    uint32_t samples;                  /*!< Samples per hour. */
+    uint8_t averaging;                 /*!< Conversions averaged per sample. */
+    float noise;                       /*!< Expected noise of each sample, in mG. */
+    float device_active_s;             /*!< Seconds per hour the device spends converting. */
+    float bus_active_s;                /*!< Seconds per hour the I2C bus is busy. */
+    float charge_uAh;                  /*!< Charge drawn by the device per hour, in µAh. */
+};
+
+class HMC5883LDutyCycle {
+    /** Scheduler which keeps the device idle between precisely timed single measurements.
+
+    Unlike `HMC5883L::readScaledValuesSingle()`, which blocks for the conversion and restores the
+    previous mode on every call, the device stays in idle mode (it returns there by itself after
+    each single measurement), and `poll()` never blocks. Call it at least as often as
+    `getTimeToNext()` says; it triggers a conversion when the next sample is due, and reads the
+    result once the conversion time has passed. Triggers are scheduled from the previous trigger
+    rather than from the previous read, so the cadence does not drift.
+
+    RDY keeps showing the previous sample until the device starts writing the new one, so the
+    status read before each data read can't tell a conversion that runs long from one that has
+    finished - the wait is the full `HMC5883L::conversionTimeUs()`. The status only shows a write
+    in progress (RDY clear or LOCK set), which is rechecked up to `DUTY_MAX_RECHECKS` times; after
+    that (e.g. LOCK stuck after a truncated read) the sample is counted as missed and the next one
+    is triggered on schedule, which also clears LOCK.
+
+    The hardware averaging rate can be chosen from a noise target: averaging `n` conversions
+    reduces the noise by `sqrt(n)`, but costs `n` times the conversion time and energy.
+    */
+public:
+    HMC5883LDutyCycle(HMC5883L *device);
+
+    uint8_t begin(uint32_t period_ms, float noise_target=0.0, uint32_t bus_hz=DUTY_BUS_HZ);
+
+    Vec3<float> poll(uint8_t *saturated=NULL, bool *fresh=NULL);
+    uint32_t getTimeToNext(void);
+    uint32_t getMissed(void);
+
+    DutyCycleBudget getBudget(void);
+
+    static float expectedNoise(uint8_t avg_rate, uint8_t gain);
+    static uint8_t chooseAveraging(float noise_target, uint8_t gain);
+
+private:
+    void schedule(uint32_t now);
+
+    HMC5883L *dev;
+    uint32_t period_us;
+    uint32_t bus_clock;
+    uint32_t conversion_us;            /*!< Conversion time at the current averaging rate. */
+    uint8_t averaging;
+
+    bool converting;
+    uint32_t trigger_us;               /*!< Scheduled time of the last trigger. */
+    uint32_t next_us;                  /*!< Time of the next trigger or read. */
+    uint32_t missed;                   /*!< Total number of scheduled samples skipped. */
+    uint8_t rechecks;                  /*!< Status rechecks of the current conversion. */
+
+    Vec3<float> last;
+    uint8_t last_saturated;
+};
+
+#endif
@@ -0,0 +1,131 @@
+/** @file
+Class file for interleaved single-shot measurements on a group of HMC5883L magnetometers.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#include <HMC5883LGroup.h>
+#include <HMC5883L.h>
+#include <HMCTime.h>
+#include <Vec3.h>
+#include <unistd.h>
+
+HMC5883LGroup::HMC5883LGroup() {
+    /** Constructor for the sensor group. */
+    n_sensors = 0;
+    select = NULL;
+    select_ctx = NULL;
+}
+
+int16_t HMC5883LGroup::addSensor(HMC5883L *dev) {
+    /** Add an initialized sensor to the group. The group does not take ownership.
+
+    @return Returns the index of the sensor, which is also its position in the trigger order, or
+            `-EC_GROUP_FULL`.
+    */
+
+    if (n_sensors >= GROUP_MAX_SENSORS) {
+        return -EC_GROUP_FULL;
+    }
+
+    sensors[n_sensors] = dev;
+    return n_sensors++;
+}
+
+void HMC5883LGroup::setSelect(GroupSelect sel, void *ctx) {
+    /** Set the function called to select a sensor before talking to it (e.g. a mux). */
+    select = sel;
+    select_ctx = ctx;
+}
+
+uint8_t HMC5883LGroup::readSingle(Vec3<float> *values, uint8_t *saturated, uint8_t *errors,
+                                  uint32_t max_retries) {
+    /** Make a single measurement on every sensor in the group.
+
+    Each sensor's measurement mode is restored after it has been read, as in
+    `HMC5883L::readScaledValuesSingle()`.
+
+    @param[out] values Receives the scaled values of each sensor in mG, in trigger order. A sensor
+                       which failed reads (0, 0, 0).
+    @param[out] saturated Receives the saturation flags of each sensor. Pass `NULL` (default) if
+                          you don't want to read these out.
+    @param[out] errors Receives the error code of each sensor. Pass `NULL` (default) if you don't
+                       want to read these out.
+    @param[in] max_retries The maximum number of times to check a sensor's status before reading
+                           it, waiting `HMC_SLEEP_DELAY` between checks. Pass 0 (default) to read
+                           as soon as the conversion time has passed, without checking.
+
+    @return Returns `0` if every sensor was read, otherwise the first error encountered.
+    */
+
+    uint8_t rv = 0;
+    uint8_t modes[GROUP_MAX_SENSORS];
+    uint8_t err[GROUP_MAX_SENSORS];
+    uint32_t triggered[GROUP_MAX_SENSORS];
+
+    for (uint8_t i = 0; i < n_sensors; i++) {
+        HMC5883L *dev = sensors[i];
+        modes[i] = HMC_MeasurementIdle;
+        if (!(err[i] = selectSensor(i))) {
+            modes[i] = dev->getMeasurementMode();
+            err[i] = dev->setMeasurementMode(HMC_MeasurementSingle);
+        }
+        triggered[i] = hmc_micros();
+    }
+
+    for (uint8_t i = 0; i < n_sensors; i++) {
+        HMC5883L *dev = sensors[i];
+        uint8_t sat = 0;
+        values[i] = Vec3<float>(0.0, 0.0, 0.0);
+
+        if (!err[i]) {
+            // Only the first wait is a real one; by then later sensors are mostly done too.
+            uint32_t conversion = HMC5883L::conversionTimeUs(dev->getAveragingRate());
+            int32_t remaining = (int32_t)(conversion - (hmc_micros() - triggered[i]));
+            if (remaining > 0) {
+                usleep(remaining);
+            }
+
+            err[i] = selectSensor(i);
+        }
+
+        uint32_t retries = 0;
+        bool locked, ready;
+        while (!err[i] && max_retries && retries++ < max_retries) {
+            if (dev->getStatus(&locked, &ready) > 3) {
+                err[i] = dev->get_error_code();
+            } else if (!locked && ready) {
+                break;
+            } else {
+                usleep(HMC_SLEEP_DELAY * 1000);
+            }
+        }
+
+        if (!err[i]) {
+            Vec3<float> v = dev->readScaledValues(&sat);
+            if (!(err[i] = dev->get_error_code())) {
+                values[i] = v;
+            }
+        }
+
+        // A single measurement leaves the device idle - only restore any other mode.
+        if (!err[i] && modes[i] != HMC_MeasurementIdle && modes[i] != HMC_MeasurementSingle) {
+            err[i] = dev->setMeasurementMode(modes[i]);
+        }
+
+        if (saturated != NULL) { saturated[i] = sat; }
+        if (errors != NULL) { errors[i] = err[i]; }
+        if (!rv) { rv = err[i]; }
+    }
+
+    return rv;
+}
+
+uint8_t HMC5883LGroup::selectSensor(uint8_t i) {
+    /** Select sensor `i` on the bus, if a select function has been set. */
+    return select != NULL ? select(i, select_ctx) : 0;
+}
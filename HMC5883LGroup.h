@@ -0,0 +1,59 @@
+/** @file
+Header file for interleaved single-shot measurements on a group of HMC5883L magnetometers.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#ifndef HMC5883LGROUP_H
+#define HMC5883LGROUP_H
+
+#include <HMC5883L.h>
+#include <Vec3.h>
+
+/** @addtogroup ErrorCodes
+@{ */
+#define EC_GROUP_FULL 25                    /*!< No room for another sensor in the group. */
+/** @} */
+
+/** @defgroup GroupConstants Sensor group constants
+@{ */
+#define GROUP_MAX_SENSORS 16        /*!< Maximum number of sensors in a group */
+/** @} */
+
+/** Called before each transaction with a sensor, to select it on a shared bus (e.g. set an I2C
+    multiplexer channel). Returns `0` on success or an error code. */
+typedef uint8_t (*GroupSelect)(uint8_t sensor, void *ctx);
+
+class HMC5883LGroup {
+    /** Single-shot measurements of several sensors with overlapping conversions.
+
+    Calling `HMC5883L::readScaledValuesSingle()` on each sensor in turn leaves the bus idle for a
+    whole conversion per sensor. `readSingle()` instead triggers a single measurement on every
+    sensor back to back, waits once for the first conversion to finish, then reads the sensors in
+    the order they were triggered - by which time the later conversions are finished too. A group
+    of N sensors takes about one conversion time plus N triggers and N reads.
+    */
+public:
+    HMC5883LGroup();
+
+    int16_t addSensor(HMC5883L *dev);
+    void setSelect(GroupSelect select, void *ctx);
+
+    uint8_t readSingle(Vec3<float> *values, uint8_t *saturated=NULL, uint8_t *errors=NULL,
+                       uint32_t max_retries=0);
+
+private:
+    uint8_t selectSensor(uint8_t i);
+
+    HMC5883L *sensors[GROUP_MAX_SENSORS];
+    uint8_t n_sensors;
+
+    GroupSelect select;
+    void *select_ctx;
+};
+
+#endif
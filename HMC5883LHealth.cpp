@@ -0,0 +1,216 @@
+/** @file
+Class file for a streaming health monitor for HMC5883L magnetometers.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#include <HMC5883LHealth.h>
+#include <HMC5883L.h>
+#include <Vec3.h>
+
+bool HealthCounter::add(bool hit, uint16_t limit) {
+    /** Count an event, starting a new window if the current one is full.
+
+    @return Returns `true` if the current window has reached `limit` hits.
+    */
+    if (events >= HEALTH_WINDOW) {
+        events = hits = 0;
+    }
+
+    events++;
+    total_events++;
+    if (hit) {
+        hits++;
+        total_hits++;
+    }
+
+    return hits >= limit;
+}
+
+HMC5883LHealth::HMC5883LHealth() {
+    /** Constructor for the health monitor. */
+    reset();
+}
+
+void HMC5883LHealth::reset() {
+    /** Clear all statistics and alerts. */
+    n = 0;
+    for (uint8_t i = 0; i < 3; i++) {
+        mean[i] = m2[i] = 0.0;
+    }
+
+    last_raw = Vec3<int>(0, 0, 0);
+    stuck_run = 0;
+
+    saturation.reset();
+    lock.reset();
+    bus.reset();
+
+    drift = Vec3<float>(0.0, 0.0, 0.0);
+    alerts = 0;
+}
+
+uint8_t HMC5883LHealth::addSample(Vec3<int> raw, uint8_t gain, uint8_t saturated, uint8_t err) {
+    /** Add the result of a data read.
+
+    @param[in] raw The raw values, as returned by `HMC5883L::readRawValues()`.
+    @param[in] gain The gain the sample was measured at, see `HMC5883L::getSampleGain()`.
+    @param[in] saturated The saturation flags returned with the sample. A saturated sample is
+                         counted towards the saturation rate but left out of the mean and
+                         variance, since -4096 flags an overflow rather than measuring the field.
+    @param[in] err The error code of the read (`HMC5883L::get_error_code()`). If non-zero, only
+                   the bus error rate is updated. Default is 0.
+
+    @return Returns any alert flags newly raised by this sample.
+    */
+
+    uint8_t raised = 0;
+    if (bus.add(err != 0, HEALTH_BUS_LIMIT)) {
+        raised |= HEALTH_BUS;
+    }
+
+    if (err) {
+        return raise(raised);
+    }
+
+    if (saturation.add(saturated != 0, HEALTH_SATURATION_LIMIT)) {
+        raised |= HEALTH_SATURATION;
+    }
+
+    // Saturated frames are identical by definition, so they don't count towards being stuck.
+    if (!saturated && n > 0 && raw.x == last_raw.x && raw.y == last_raw.y && raw.z == last_raw.z) {
+        if (++stuck_run >= HEALTH_STUCK_COUNT) {
+            raised |= HEALTH_STUCK;
+        }
+    } else {
+        stuck_run = 0;
+    }
+    last_raw = raw;
+
+    if (saturated) {
+        return raise(raised);
+    }
+
+    // Welford's update, per axis.
+    float scale = HMC5883L::gainValue(gain);
+    float v[3] = {raw.x * scale, raw.y * scale, raw.z * scale};
+    n++;
+    for (uint8_t i = 0; i < 3; i++) {
+        float delta = v[i] - mean[i];
+        mean[i] += delta / n;
+        m2[i] += delta * (v[i] - mean[i]);
+    }
+
+    return raise(raised);
+}
+
+uint8_t HMC5883LHealth::addStatus(bool locked, uint8_t err) {
+    /** Add the result of a status read.
+
+    @param[in] locked The LOCK bit, as returned by `HMC5883L::getStatus()`.
+    @param[in] err The error code of the read. If non-zero, `locked` is ignored. Default is 0.
+
+    @return Returns any alert flags newly raised by this status read.
+    */
+
+    uint8_t raised = 0;
+    if (bus.add(err != 0, HEALTH_BUS_LIMIT)) {
+        raised |= HEALTH_BUS;
+    }
+
+    if (!err && lock.add(locked, HEALTH_LOCK_LIMIT)) {
+        raised |= HEALTH_LOCKED;
+    }
+
+    return raise(raised);
+}
+
+uint8_t HMC5883LHealth::addSelfTest(Vec3<float> pos_test, Vec3<float> calibration,
+                                    float tolerance) {
+    /** Compare a positive self-test response against the stored calibration.
+
+    @param[in] pos_test The result of `HMC5883L::runPosTest()`, in mG.
+    @param[in] calibration The calibration in use, from `HMC5883L::getCalibration(false)`.
+    @param[in] tolerance The relative drift tolerated on any axis. Default is
+                         `HMC_STATE_TOLERANCE`.
+
+    @return Returns `HEALTH_DRIFT` if the alert was newly raised, otherwise 0.
+    */
+
+    Vec3<float> expected = calibration * Vec3<float>(HMC_BIAS_XY, HMC_BIAS_XY, HMC_BIAS_Z);
+    if (expected.x == 0 || expected.y == 0 || expected.z == 0) {
+        return 0;
+    }
+
+    drift = (pos_test - expected) / expected;
+    if (drift.x > tolerance || drift.x < -tolerance || drift.y > tolerance
+            || drift.y < -tolerance || drift.z > tolerance || drift.z < -tolerance) {
+        return raise(HEALTH_DRIFT);
+    }
+
+    return 0;
+}
+
+uint8_t HMC5883LHealth::checkSelfTest(HMC5883L *dev, float tolerance) {
+    /** Run a positive self-test on the device and check it with `addSelfTest()`.
+
+    This interrupts acquisition for the duration of the test, see `HMC5883L::runPosTest()`.
+
+    @return Returns `HEALTH_DRIFT` if the alert was newly raised, `HEALTH_BUS` if the self-test
+            failed on the bus, otherwise 0.
+    */
+
+    Vec3<float> pos = dev->runPosTest();
+    uint8_t err = dev->get_error_code();
+
+    uint8_t raised = 0;
+    if (bus.add(err != 0, HEALTH_BUS_LIMIT)) {
+        raised |= HEALTH_BUS;
+    }
+
+    if (err) {
+        return raise(raised);
+    }
+
+    return raise(raised) | addSelfTest(pos, dev->getCalibration(false), tolerance);
+}
+
+uint8_t HMC5883LHealth::getAlerts() {
+    /** Retrieve the raised alert flags, see \ref HealthAlerts. */
+    return alerts;
+}
+
+void HMC5883LHealth::clearAlerts() {
+    /** Clear all alert flags. The statistics are kept. */
+    alerts = 0;
+}
+
+HealthStats HMC5883LHealth::getStats() {
+    /** Retrieve a snapshot of the statistics. */
+    HealthStats s;
+    s.samples = n;
+    s.mean = Vec3<float>(mean[0], mean[1], mean[2]);
+    if (n > 1) {
+        s.variance = Vec3<float>(m2[0] / (n - 1), m2[1] / (n - 1), m2[2] / (n - 1));
+    } else {
+        s.variance = Vec3<float>(0.0, 0.0, 0.0);
+    }
+    s.stuck_run = stuck_run;
+    s.saturation_rate = saturation.rate();
+    s.lock_rate = lock.rate();
+    s.bus_error_rate = bus.rate();
+    s.drift = drift;
+
+    return s;
+}
+
+uint8_t HMC5883LHealth::raise(uint8_t flags) {
+    /** Latch alert flags, returning those which weren't already raised. */
+    uint8_t raised = flags & ~alerts;
+    alerts |= flags;
+    return raised;
+}
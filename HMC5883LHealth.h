@@ -0,0 +1,109 @@
+/** @file
+Header file for a streaming health monitor for HMC5883L magnetometers.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#ifndef HMC5883LHEALTH_H
+#define HMC5883LHEALTH_H
+
+#include <HMC5883L.h>
+#include <Vec3.h>
+
+/** @defgroup HealthConstants Health monitor constants
+@{ */
+#define HEALTH_WINDOW 64            /*!< Events per window when counting saturation, LOCK and bus
+                                         error rates */
+#define HEALTH_STUCK_COUNT 16       /*!< Identical raw frames in a row reported as stuck */
+#define HEALTH_SATURATION_LIMIT 8   /*!< Saturated samples per window raising an alert */
+#define HEALTH_LOCK_LIMIT 4         /*!< Status reads with LOCK set per window raising an alert */
+#define HEALTH_BUS_LIMIT 4          /*!< Failed transactions per window raising an alert */
+/** @} */
+
+/** @defgroup HealthAlerts Health alert flags
+Flags raised by `HMC5883LHealth`. Alerts stay raised until `HMC5883LHealth::clearAlerts()`.
+@{ */
+#define HEALTH_STUCK 1              /*!< The raw output hasn't changed in `HEALTH_STUCK_COUNT`
+                                         samples. */
+#define HEALTH_SATURATION 2         /*!< Too many saturated samples. */
+#define HEALTH_LOCKED 4             /*!< The data registers are too often locked when read. */
+#define HEALTH_BUS 8                /*!< Too many failed bus transactions. */
+#define HEALTH_DRIFT 16             /*!< The self-test response has drifted from the stored
+                                         calibration. */
+/** @} */
+
+struct HealthCounter {
+    /** Count of events with a property (e.g. saturated), over the current window and in total. */
+    uint16_t events;                   /*!< Events in the current window. */
+    uint16_t hits;                     /*!< Events with the property in the current window. */
+    uint32_t total_events;
+    uint32_t total_hits;
+
+    void reset(void) { events = hits = 0; total_events = total_hits = 0; }
+    float rate(void) const { return total_events ? (float)total_hits / total_events : 0.0; }
+    bool add(bool hit, uint16_t limit);
+};
+
+struct HealthStats {
+    /** Snapshot of the statistics tracked by `HMC5883LHealth`. */
+    uint32_t samples;                  /*!< Samples included in the mean and variance. */
+    Vec3<float> mean;                  /*!< Mean field, in mG. */
+    Vec3<float> variance;              /*!< Sample variance of the field, in mG^2. */
+    uint32_t stuck_run;                /*!< Length of the current run of identical raw frames. */
+    float saturation_rate;             /*!< Fraction of samples with a saturated axis. */
+    float lock_rate;                   /*!< Fraction of status reads with LOCK set. */
+    float bus_error_rate;              /*!< Fraction of transactions that failed. */
+    Vec3<float> drift;                 /*!< Relative drift of the last self-test response. */
+};
+
+class HMC5883LHealth {
+    /** Incremental health monitor for one sensor.
+
+    Feed it from the acquisition path with the results of each read (`addSample()`) and status
+    read (`addStatus()`), and occasionally with a self-test (`addSelfTest()`). Each update is a few
+    arithmetic operations on a fixed set of members, so it can run inline at the full output rate
+    of every sensor.
+
+    The field mean and variance use Welford's algorithm, over the unsaturated samples. Rates are
+    counted over fixed windows of `HEALTH_WINDOW` events, and an alert is raised as soon as a
+    window's count reaches its limit, so a sensor that fails outright is flagged within
+    `HEALTH_*_LIMIT` events (and a stuck one within `HEALTH_STUCK_COUNT` samples).
+    */
+public:
+    HMC5883LHealth();
+
+    void reset(void);
+
+    uint8_t addSample(Vec3<int> raw, uint8_t gain, uint8_t saturated, uint8_t err=0);
+    uint8_t addStatus(bool locked, uint8_t err=0);
+    uint8_t addSelfTest(Vec3<float> pos_test, Vec3<float> calibration,
+                        float tolerance=HMC_STATE_TOLERANCE);
+    uint8_t checkSelfTest(HMC5883L *dev, float tolerance=HMC_STATE_TOLERANCE);
+
+    uint8_t getAlerts(void);
+    void clearAlerts(void);
+    HealthStats getStats(void);
+
+private:
+    uint8_t raise(uint8_t flags);
+
+    uint32_t n;
+    float mean[3];
+    float m2[3];
+
+    Vec3<int> last_raw;
+    uint32_t stuck_run;
+
+    HealthCounter saturation;
+    HealthCounter lock;
+    HealthCounter bus;
+
+    Vec3<float> drift;
+    uint8_t alerts;
+};
+
+#endif
@@ -0,0 +1,173 @@
+/** @file
+Class file for software oversampling of the HMC5883L beyond the 8-sample hardware average.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#include <HMC5883LOversampler.h>
+#include <HMC5883L.h>
+#include <HMCTime.h>
+#include <Vec3.h>
+
+HMC5883LOversampler::HMC5883LOversampler(HMC5883L *device) {
+    /** Constructor for the oversampler.
+
+    @param[in] device An initialized `HMC5883L` object. The oversampler does not take ownership.
+    */
+    dev = device;
+    decimation = 1;
+    periodUs = 1e6 / HMC5883L::outputRateHz(HMC_RATE7500);
+    lastSampleUs = hmc_micros() - periodUs;
+    reset();
+}
+
+uint8_t HMC5883LOversampler::begin(uint16_t decimation_factor, uint8_t avg_rate) {
+    /** Configure the device for oversampling and start a new window.
+
+    Sets the hardware averaging rate, sets the output rate to the maximum (`HMC_RATE7500`) and puts
+    the device in continuous measurement mode. Outputs are then produced at
+    `75 Hz / decimation_factor`, or slower if the conversion time at `avg_rate` is longer than the
+    output period, see `getOutputRate()`.
+
+    @param[in] decimation_factor The number of device samples averaged into each output.
+    @param[in] avg_rate The hardware averaging rate, passed to `HMC5883L::setAveragingRate()`.
+                        Default is `HMC_AVG8`.
+
+    @return Returns `0` on no error. Returns errors from the `HMC5883L` setters, as well as:
+            - \c `EC_INVALID_DECIMATION` Returned if `decimation_factor` is 0.
+    */
+
+    if (decimation_factor == 0) {
+        return EC_INVALID_DECIMATION;
+    }
+
+    uint8_t rv;
+    if (rv = dev->setAveragingRate(avg_rate)) { return rv; }
+    if (rv = dev->setOutputRate(HMC_RATE7500)) { return rv; }
+    if (rv = dev->setMeasurementMode(HMC_MeasurementContinuous)) { return rv; }
+
+    decimation = decimation_factor;
+    periodUs = 1e6 / HMC5883L::outputRateHz(HMC_RATE7500);
+    uint32_t conversion = HMC5883L::conversionTimeUs(avg_rate);
+    periodUs = periodUs > conversion ? periodUs : conversion;
+
+    // The first measurement is written one conversion time from now.
+    lastSampleUs = hmc_micros() + conversion - periodUs;
+    reset();
+
+    return 0;
+}
+
+uint8_t HMC5883LOversampler::update(OversampledValue *out, bool *ready) {
+    /** Poll the device and accumulate a new sample if one is available.
+
+    Call this at least as often as the device output rate (75 Hz). A call within an output period
+    of the last sample doesn't touch the bus; otherwise it costs one status register read, plus one
+    data read if RDY is set.
+
+    @param[out] out The decimated output. Only written when `ready` is set.
+    @param[out] ready Set to `true` when a window has completed and `out` has been written.
+
+    @return Returns `0` on no error, otherwise returns I2C errors from the device. On error, the
+            current window is kept, so a transient bus error only costs the one sample.
+    */
+
+    *ready = false;
+
+    uint32_t now = hmc_micros();
+    if (now - lastSampleUs < periodUs) {
+        return 0;
+    }
+
+    bool locked, dataReady;
+    if (dev->getStatus(&locked, &dataReady) > 3) {
+        return dev->get_error_code();
+    }
+
+    if (!dataReady) {
+        return 0;
+    }
+
+    uint8_t sat;
+    Vec3<int> raw = dev->readRawValues(&sat);
+    uint8_t rv;
+    if (rv = dev->get_error_code()) {
+        return rv;
+    }
+
+    lastSampleUs = now;
+
+    // A window is only meaningful at a single gain - start over if it has changed.
+    uint8_t gain = dev->getSampleGain();
+    if (windowSamples && gain != windowGain) {
+        reset();
+    }
+    windowGain = gain;
+
+    // Accumulate each axis independently, skipping saturated channels.
+    int32_t values[3] = {raw.x, raw.y, raw.z};
+    for (uint8_t i = 0; i < 3; i++) {
+        if (sat & (1 << i)) {           // WC_X_SATURATED, WC_Y_SATURATED, WC_Z_SATURATED
+            continue;
+        }
+
+        sum[i] += values[i];
+        sumSq[i] += (uint64_t)(values[i] * values[i]);
+        count[i]++;
+    }
+    saturated |= sat;
+
+    if (++windowSamples < decimation) {
+        return 0;
+    }
+
+    // Window complete - convert the accumulators to mean and variance in mG.
+    float g = HMC5883L::gainValue(windowGain);
+    float mean[3], var[3];
+    for (uint8_t i = 0; i < 3; i++) {
+        mean[i] = 0.0;
+        var[i] = 0.0;
+        if (count[i] == 0) {
+            continue;
+        }
+
+        mean[i] = g * sum[i] / count[i];
+        if (count[i] > 1) {
+            // n * sum(x^2) - sum(x)^2 is exact in 64 bits for any window length.
+            int64_t n = count[i];
+            int64_t s2 = n * (int64_t)sumSq[i] - (int64_t)sum[i] * sum[i];
+            var[i] = g * g * ((float)s2 / (float)(n * (n - 1)));
+        }
+    }
+
+    out->mean = Vec3<float>(mean[0], mean[1], mean[2]);
+    out->variance = Vec3<float>(var[0], var[1], var[2]);
+    out->count = Vec3<uint16_t>(count[0], count[1], count[2]);
+    out->saturated = saturated;
+
+    reset();
+    *ready = true;
+    return 0;
+}
+
+void HMC5883LOversampler::reset() {
+    /** Discard the current window. */
+    for (uint8_t i = 0; i < 3; i++) {
+        sum[i] = 0;
+        sumSq[i] = 0;
+        count[i] = 0;
+    }
+
+    windowSamples = 0;
+    windowGain = 0;
+    saturated = 0;
+}
+
+float HMC5883LOversampler::getOutputRate() {
+    /** Returns the rate at which decimated outputs are produced, in Hz. */
+    return 1e6 / periodUs / decimation;
+}
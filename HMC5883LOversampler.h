@@ -0,0 +1,69 @@
+/** @file
+Header file for software oversampling of the HMC5883L beyond the 8-sample hardware average.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#ifndef HMC5883LOVERSAMPLER_H
+#define HMC5883LOVERSAMPLER_H
+
+#include <HMC5883L.h>
+#include <Vec3.h>
+
+/** @addtogroup ErrorCodes
+@{ */
+#define EC_INVALID_DECIMATION 14            /*!< Decimation factor must be at least 1. */
+/** @} */
+
+struct OversampledValue {
+    /** A single decimated output of `HMC5883LOversampler`. */
+    Vec3<float> mean;                  /*!< Mean field over the window, in mG. */
+    Vec3<float> variance;              /*!< Sample variance over the window, in mG^2. */
+    Vec3<uint16_t> count;              /*!< Number of unsaturated samples averaged per axis. */
+    uint8_t saturated;                 /*!< `WC_*_SATURATED` flags for axes where at least one
+                                            sample in the window was saturated and excluded. */
+};
+
+class HMC5883LOversampler {
+    /** Software oversampling engine for the HMC5883L.
+
+    Runs the device in continuous mode at the fastest output rate, and averages `decimation`
+    consecutive samples into each output. Raw counts are accumulated in 32-bit sums and 64-bit sums
+    of squares, so no samples are buffered and the per-window variance comes for free. Saturated
+    samples (-4096) are excluded per-axis.
+
+    RDY stays set between measurements, so a new sample is told apart from a repeat of the last one
+    by the output period: a sample is only taken once a full period has passed since the last. All
+    samples in a window share the gain they were measured at; a sample at another gain (e.g. after
+    `HMC5883L::setGain()`) discards the window so far and starts a new one.
+    */
+public:
+    HMC5883LOversampler(HMC5883L *device);
+
+    uint8_t begin(uint16_t decimation, uint8_t avg_rate=HMC_AVG8);
+    uint8_t update(OversampledValue *out, bool *ready);
+    void reset(void);
+
+    float getOutputRate(void);
+
+private:
+    HMC5883L *dev;                     /*!< The magnetometer being sampled. */
+    uint16_t decimation;               /*!< Number of device samples per output. */
+    uint16_t windowSamples;            /*!< Device samples seen in the current window. */
+    uint8_t windowGain;                /*!< Gain the samples of the current window were
+                                            measured at. */
+    uint32_t periodUs;                 /*!< Time between device samples, in microseconds. */
+    uint32_t lastSampleUs;             /*!< When the last sample was taken, in `hmc_micros()`
+                                            time. */
+
+    int32_t sum[3];                    /*!< Per-axis sums of raw counts. */
+    uint64_t sumSq[3];                 /*!< Per-axis sums of squared raw counts. */
+    uint16_t count[3];                 /*!< Per-axis number of unsaturated samples. */
+    uint8_t saturated;
+};
+
+#endif
@@ -0,0 +1,327 @@
+/** @file
+Class file for a single-threaded epoll event loop driving many HMC5883L magnetometers (Linux).
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#include <HMC5883LReactor.h>
+#include <HMC5883L.h>
+#include <Vec3.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REACTOR_TIMER_TAG 0xffffffffu   // epoll tag for the timerfd; sensors use their index.
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+HMC5883LReactor::HMC5883LReactor() {
+    /** Constructor for the reactor. Call `open()` before adding sensors. */
+    n_sensors = 0;
+    epoll_fd = timer_fd = -1;
+    running = false;
+    callback = NULL;
+    callback_ctx = NULL;
+    select = NULL;
+    select_ctx = NULL;
+}
+
+HMC5883LReactor::~HMC5883LReactor() {
+    /** Destructor - closes the epoll and timer file descriptors. */
+    close();
+}
+
+uint8_t HMC5883LReactor::open() {
+    /** Create the epoll instance and the deadline timer.
+
+    @return Returns `0` on no error, or `EC_REACTOR_SYSCALL` if either could not be created.
+    */
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd < 0 || timer_fd < 0) {
+        close();
+        return EC_REACTOR_SYSCALL;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = REACTOR_TIMER_TAG;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev)) {
+        close();
+        return EC_REACTOR_SYSCALL;
+    }
+
+    return 0;
+}
+
+void HMC5883LReactor::close() {
+    /** Close the epoll instance and the timer. DRDY file descriptors belong to the caller. */
+    if (epoll_fd >= 0) { ::close(epoll_fd); }
+    if (timer_fd >= 0) { ::close(timer_fd); }
+    epoll_fd = timer_fd = -1;
+}
+
+int16_t HMC5883LReactor::addSensor(HMC5883L *dev, uint8_t bus, uint32_t period_us, int drdy_fd) {
+    /** Add a sensor to the reactor.
+
+    The sensor should already be initialized and configured. Its current measurement mode is
+    restored after every sample, and its first measurement is triggered on the next call to
+    `runOnce()`.
+
+    @param[in] dev The sensor. The reactor does not take ownership.
+    @param[in] bus Bus ID - sensors sharing a bus should share an ID.
+    @param[in] period_us Time between measurements, in microseconds. Pass 0 (default) to trigger
+                         the next measurement as soon as the previous one has been read.
+    @param[in] drdy_fd A file descriptor which becomes readable (or signals `EPOLLPRI`) when the
+                       sensor's DRDY pin fires, or -1 (default) to rely on the conversion time.
+
+    @return Returns the index of the sensor, or `-EC_REACTOR_FULL` / `-EC_REACTOR_SYSCALL`.
+    */
+
+    if (n_sensors >= REACTOR_MAX_SENSORS) {
+        return -EC_REACTOR_FULL;
+    }
+
+    uint8_t i = n_sensors;
+    if (drdy_fd >= 0) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLPRI;
+        ev.data.u32 = i;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, drdy_fd, &ev)) {
+            return -EC_REACTOR_SYSCALL;
+        }
+    }
+
+    ReactorSensor *s = &sensors[i];
+    s->dev = dev;
+    s->bus = bus;
+    s->drdy_fd = drdy_fd;
+    s->state = REACTOR_IDLE;
+    s->restore_mode = dev->getMeasurementMode();
+    s->drdy = false;
+    s->period_ns = (uint64_t)period_us * 1000;
+    s->trigger_ns = s->deadline_ns = now_ns();
+    s->samples = s->errors = 0;
+
+    n_sensors++;
+    return i;
+}
+
+void HMC5883LReactor::setCallback(ReactorCallback cb, void *ctx) {
+    /** Set the function called with each acquired sample. */
+    callback = cb;
+    callback_ctx = ctx;
+}
+
+void HMC5883LReactor::setSelect(ReactorSelect sel, void *ctx) {
+    /** Set the function called to select a sensor before talking to it (e.g. a mux). */
+    select = sel;
+    select_ctx = ctx;
+}
+
+uint8_t HMC5883LReactor::runOnce(int timeout_ms) {
+    /** Wait for the next deadline or DRDY event and service every sensor that is due.
+
+    @param[in] timeout_ms Maximum time to wait, in milliseconds, or -1 (default) to wait for the
+                          next event.
+
+    @return Returns `0` on no error, or `EC_REACTOR_SYSCALL` if `epoll_wait()` or the timer failed.
+            Device errors are reported through the callback, not here.
+    */
+
+    uint8_t rv;
+    if (rv = arm()) {
+        return rv;
+    }
+
+    struct epoll_event events[REACTOR_MAX_SENSORS + 1];
+    int n = epoll_wait(epoll_fd, events, REACTOR_MAX_SENSORS + 1, timeout_ms);
+    if (n < 0) {
+        return EC_REACTOR_SYSCALL;
+    }
+
+    for (int e = 0; e < n; e++) {
+        uint32_t tag = events[e].data.u32;
+        uint8_t buf[64];
+        ssize_t len;
+        if (tag == REACTOR_TIMER_TAG) {
+            len = ::read(timer_fd, buf, sizeof(uint64_t));      // Clear the expiration count
+            (void)len;
+            continue;
+        }
+
+        // Drain the DRDY event so the descriptor isn't reported again.
+        ReactorSensor *s = &sensors[tag];
+        lseek(s->drdy_fd, 0, SEEK_SET);
+        len = ::read(s->drdy_fd, buf, sizeof(buf));
+        (void)len;
+        s->drdy = true;
+    }
+
+    service(now_ns());
+    return 0;
+}
+
+uint8_t HMC5883LReactor::run() {
+    /** Run the event loop until `stop()` is called (e.g. from the callback) or an error occurs. */
+    running = true;
+    while (running) {
+        uint8_t rv;
+        if (rv = runOnce()) {
+            running = false;
+            return rv;
+        }
+    }
+
+    return 0;
+}
+
+void HMC5883LReactor::stop() {
+    /** Make `run()` return after the current iteration. */
+    running = false;
+}
+
+const ReactorSensor *HMC5883LReactor::getSensor(uint8_t sensor) {
+    /** Retrieve the state and sample/error counts of a sensor, or `NULL` if out of range. */
+    return sensor < n_sensors ? &sensors[sensor] : NULL;
+}
+
+void HMC5883LReactor::service(uint64_t now) {
+    /** Service every due sensor, grouped by bus: all reads on a bus, then all triggers. */
+    bool done[REACTOR_MAX_SENSORS] = {false};
+
+    for (uint8_t first = 0; first < n_sensors; first++) {
+        if (done[first]) {
+            continue;
+        }
+
+        uint8_t bus = sensors[first].bus;
+        for (uint8_t i = first; i < n_sensors; i++) {
+            ReactorSensor *s = &sensors[i];
+            if (s->bus == bus && s->state == REACTOR_CONVERTING
+                    && (s->drdy || s->deadline_ns <= now)) {
+                read(i, now);
+            }
+        }
+
+        for (uint8_t i = first; i < n_sensors; i++) {
+            ReactorSensor *s = &sensors[i];
+            if (s->bus != bus) {
+                continue;
+            }
+
+            done[i] = true;
+            if (s->state == REACTOR_IDLE && s->deadline_ns <= now) {
+                trigger(i, now);
+            }
+        }
+    }
+}
+
+void HMC5883LReactor::trigger(uint8_t i, uint64_t now) {
+    /** Start a single measurement on sensor `i`. */
+    ReactorSensor *s = &sensors[i];
+    uint64_t conversion_ns = HMC5883L::conversionTimeUs(s->dev->getAveragingRate()) * 1000ull;
+    uint8_t rv = 0;
+    if (select != NULL) {
+        rv = select(i, select_ctx);
+    }
+
+    if (!rv) {
+        rv = s->dev->setMeasurementMode(HMC_MeasurementSingle);
+    }
+
+    s->trigger_ns = now;
+    if (rv) {
+        // Retry at the next period rather than spinning on a failing device.
+        s->errors++;
+        s->deadline_ns = now + (s->period_ns ? s->period_ns : conversion_ns);
+        if (callback != NULL) {
+            callback(i, Vec3<float>(0.0, 0.0, 0.0), 0, rv, callback_ctx);
+        }
+        return;
+    }
+
+    s->drdy = false;
+    s->state = REACTOR_CONVERTING;
+    s->deadline_ns = now + conversion_ns;
+}
+
+void HMC5883LReactor::read(uint8_t i, uint64_t now) {
+    /** Read the completed measurement from sensor `i`, restore its mode and schedule the next. */
+    ReactorSensor *s = &sensors[i];
+    uint8_t rv = 0, saturated = 0;
+    Vec3<float> value(0.0, 0.0, 0.0);
+
+    if (select != NULL) {
+        rv = select(i, select_ctx);
+    }
+
+    if (!rv) {
+        value = s->dev->readScaledValues(&saturated);
+        rv = s->dev->get_error_code();
+    }
+
+    // A single measurement leaves the device idle - only restore if it was doing something else.
+    if (!rv && s->restore_mode != HMC_MeasurementIdle
+            && s->restore_mode != HMC_MeasurementSingle) {
+        rv = s->dev->setMeasurementMode(s->restore_mode);
+    }
+
+    if (rv) {
+        s->errors++;
+    } else {
+        s->samples++;
+    }
+
+    // Schedule from the last trigger so the cadence doesn't drift; catch up if we've fallen behind.
+    s->state = REACTOR_IDLE;
+    s->drdy = false;
+    s->deadline_ns = s->trigger_ns + s->period_ns;
+    if (s->deadline_ns < now) {
+        s->deadline_ns = now;
+    }
+
+    if (callback != NULL) {
+        callback(i, value, saturated, rv, callback_ctx);
+    }
+}
+
+uint8_t HMC5883LReactor::arm() {
+    /** Set the timer for the earliest deadline of any sensor. */
+    if (n_sensors == 0) {
+        return 0;
+    }
+
+    uint64_t next = sensors[0].deadline_ns;
+    for (uint8_t i = 1; i < n_sensors; i++) {
+        if (sensors[i].deadline_ns < next) {
+            next = sensors[i].deadline_ns;
+        }
+    }
+
+    // An all-zero it_value disarms the timer, so make sure an overdue deadline still fires.
+    if (next == 0) {
+        next = 1;
+    }
+
+    struct itimerspec its;
+    its.it_interval.tv_sec = its.it_interval.tv_nsec = 0;
+    its.it_value.tv_sec = next / 1000000000ull;
+    its.it_value.tv_nsec = next % 1000000000ull;
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+        return EC_REACTOR_SYSCALL;
+    }
+
+    return 0;
+}
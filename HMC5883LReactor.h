@@ -0,0 +1,105 @@
+/** @file
+Header file for a single-threaded epoll event loop driving many HMC5883L magnetometers (Linux).
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#ifndef HMC5883LREACTOR_H
+#define HMC5883LREACTOR_H
+
+#include <HMC5883L.h>
+#include <Vec3.h>
+
+/** @addtogroup ErrorCodes
+@{ */
+#define EC_REACTOR_FULL 15                  /*!< No room for another sensor in the reactor. */
+#define EC_REACTOR_SYSCALL 16               /*!< An epoll or timerfd call failed, see `errno`. */
+/** @} */
+
+/** @defgroup ReactorConstants Reactor constants
+@{ */
+#define REACTOR_MAX_SENSORS 32      /*!< Maximum number of sensors driven by one reactor */
+
+#define REACTOR_IDLE 0              /*!< Waiting for the next trigger deadline */
+#define REACTOR_CONVERTING 1        /*!< Single measurement triggered, waiting for conversion */
+/** @} */
+
+/** Called with every sample acquired by the reactor. On error, `value` is (0, 0, 0) and `err` is
+    the error code from the device. */
+typedef void (*ReactorCallback)(uint8_t sensor, Vec3<float> value, uint8_t saturated, uint8_t err,
+                                void *ctx);
+
+/** Called before each transaction with a sensor, to select it on a shared bus (e.g. set an I2C
+    multiplexer channel). Returns `0` on success or an error code. */
+typedef uint8_t (*ReactorSelect)(uint8_t sensor, void *ctx);
+
+struct ReactorSensor {
+    /** State of one sensor driven by `HMC5883LReactor`. */
+    HMC5883L *dev;
+    uint8_t bus;                       /*!< Sensors with the same bus ID are serviced together. */
+    int drdy_fd;                       /*!< DRDY interrupt file descriptor, or -1 */
+    uint8_t state;                     /*!< `REACTOR_IDLE` or `REACTOR_CONVERTING` */
+    uint8_t restore_mode;              /*!< Measurement mode to restore after each sample */
+    bool drdy;                         /*!< DRDY has fired since the last trigger */
+    uint64_t period_ns;                /*!< Time between triggers, 0 for back-to-back. */
+    uint64_t trigger_ns;               /*!< Time of the last (or next) trigger */
+    uint64_t deadline_ns;              /*!< Next time this sensor needs servicing */
+    uint32_t samples;
+    uint32_t errors;
+};
+
+class HMC5883LReactor {
+    /** Drives the single-shot measurement cycle of many sensors from one thread.
+
+    Each sensor cycles through trigger single-shot -> wait for conversion -> read -> restore mode.
+    The waits are absolute `CLOCK_MONOTONIC` deadlines on a single `timerfd`, so no thread ever
+    sleeps in `usleep()`. If a DRDY interrupt file descriptor is supplied for a sensor (e.g. a
+    sysfs GPIO `value` file with edge detection enabled, or a GPIO line event fd), it is watched
+    with `epoll` and the sensor is read as soon as its conversion completes instead of at the
+    conservative deadline of `HMC5883L::conversionTimeUs()` at the sensor's averaging rate.
+
+    All sensors that are due at a wake-up are serviced bus by bus - first every pending read on a
+    bus, then every pending trigger - so the transactions for one bus go out back to back and the
+    conversions of all sensors on it overlap.
+    */
+public:
+    HMC5883LReactor();
+    ~HMC5883LReactor();
+
+    uint8_t open(void);
+    void close(void);
+
+    int16_t addSensor(HMC5883L *dev, uint8_t bus, uint32_t period_us=0, int drdy_fd=-1);
+    void setCallback(ReactorCallback callback, void *ctx);
+    void setSelect(ReactorSelect select, void *ctx);
+
+    uint8_t runOnce(int timeout_ms=-1);
+    uint8_t run(void);
+    void stop(void);
+
+    const ReactorSensor *getSensor(uint8_t sensor);
+
+private:
+    void service(uint64_t now);
+    void trigger(uint8_t i, uint64_t now);
+    void read(uint8_t i, uint64_t now);
+    uint8_t arm(void);
+
+    ReactorSensor sensors[REACTOR_MAX_SENSORS];
+    uint8_t n_sensors;
+
+    int epoll_fd;
+    int timer_fd;
+    bool running;
+
+    ReactorCallback callback;
+    void *callback_ctx;
+    ReactorSelect select;
+    void *select_ctx;
+};
+
+#endif
@@ -0,0 +1,197 @@
+/** @file
+Class file for a real-time acquisition runner with deterministic latency (Linux).
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#include <HMC5883LRealtime.h>
+#include <HMC5883L.h>
+#include <Vec3.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+static uint64_t to_ns(const struct timespec &ts) {
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct timespec to_timespec(uint64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ull;
+    ts.tv_nsec = ns % 1000000000ull;
+    return ts;
+}
+
+static uint64_t sleep_until(uint64_t deadline_ns) {
+    /** Sleep until an absolute `CLOCK_MONOTONIC` deadline, and return the actual wake-up time. */
+    struct timespec ts = to_timespec(deadline_ns);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) {}   // Retry on EINTR
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return to_ns(ts);
+}
+
+static void __attribute__((noinline)) prefault_stack() {
+    /** Touch `RT_STACK_PREFAULT` bytes of stack so later growth doesn't page fault. */
+    volatile uint8_t stack[RT_STACK_PREFAULT];
+    memset((void *)stack, 0, sizeof(stack));
+}
+
+HMC5883LRealtime::HMC5883LRealtime(HMC5883L *device) {
+    /** Constructor for the real-time runner.
+
+    @param[in] device An initialized `HMC5883L` object. The runner does not take ownership.
+    */
+    dev = device;
+    running = false;
+    callback = NULL;
+    callback_ctx = NULL;
+    memset(&report, 0, sizeof(report));
+    memset(histogram, 0, sizeof(histogram));
+}
+
+void HMC5883LRealtime::start(const RealtimeConfig &cfg) {
+    /** Prepare the calling thread for real-time acquisition.
+
+    Must be called from the thread that will call `run()`. Failures are not errors - check
+    `getReport()` to see which of memory locking, `SCHED_FIFO` and CPU pinning were granted.
+
+    @param[in] cfg The priority, CPU affinity and acquisition period.
+    */
+
+    config = cfg;
+    memset(&report, 0, sizeof(report));
+    memset(histogram, 0, sizeof(histogram));
+
+    report.memory_locked = !mlockall(MCL_CURRENT | MCL_FUTURE);
+    prefault_stack();
+
+    if (config.priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config.priority;
+        report.fifo_scheduled = !pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    }
+
+    if (config.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(config.cpu, &set);
+        report.cpu_pinned = !pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+}
+
+uint32_t HMC5883LRealtime::run(uint32_t n_samples) {
+    /** Run the acquisition loop on the calling thread.
+
+    Each period, the runner sleeps until the period's absolute deadline, then either reads the
+    device (continuous mode) or triggers a single measurement, sleeps for the conversion time
+    (`HMC5883L::conversionTimeUs()` at the device's averaging rate, as cached when the loop
+    starts) from when the trigger was written, and reads it. Samples are passed to the callback.
+    If a deadline has already passed by more than a full period, the missed periods are skipped
+    and counted as overruns rather than being run back to back.
+
+    @param[in] n_samples The number of periods to run, or 0 (default) to run until `stop()`.
+
+    @return Returns the number of samples acquired without error.
+    */
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t period = (uint64_t)config.period_us * 1000;
+    uint64_t deadline = to_ns(ts) + period;
+    uint64_t conversion = HMC5883L::conversionTimeUs(dev->getAveragingRate()) * 1000ull;
+
+    running = true;
+    for (uint32_t i = 0; running && (n_samples == 0 || i < n_samples); i++) {
+        uint64_t woke = sleep_until(deadline);
+        record(woke - deadline);
+
+        uint8_t err = 0, saturated = 0;
+        Vec3<float> value(0.0, 0.0, 0.0);
+        if (config.single_shot) {
+            err = dev->setMeasurementMode(HMC_MeasurementSingle);
+            if (!err) {
+                // The conversion starts when the trigger is written, which under load can be well
+                // after the deadline.
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                sleep_until(to_ns(ts) + conversion);
+            }
+        }
+
+        if (!err) {
+            value = dev->readScaledValues(&saturated);
+            err = dev->get_error_code();
+        }
+
+        if (err) {
+            report.errors++;
+        } else {
+            report.samples++;
+        }
+
+        if (callback != NULL) {
+            callback(value, saturated, err, deadline, callback_ctx);
+        }
+
+        deadline += period;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t now = to_ns(ts);
+        while (deadline + period < now) {
+            deadline += period;
+            report.overruns++;
+        }
+    }
+
+    running = false;
+    return report.samples;
+}
+
+void HMC5883LRealtime::stop() {
+    /** Make `run()` return after the current period. Safe to call from another thread. */
+    running = false;
+}
+
+void HMC5883LRealtime::setCallback(RealtimeCallback cb, void *ctx) {
+    /** Set the function called with each sample. It runs on the real-time thread. */
+    callback = cb;
+    callback_ctx = ctx;
+}
+
+RealtimeReport HMC5883LRealtime::getReport() {
+    /** Retrieve what `start()` set up, and the sample counts and latency statistics. */
+    uint64_t total = 0;
+    for (uint32_t i = 0; i <= RT_HISTOGRAM_US; i++) {
+        total += histogram[i];
+    }
+
+    // Smallest bin such that at least 99% of wake-ups were no later.
+    uint64_t target = (total * 99 + 99) / 100;
+    uint64_t seen = 0;
+    report.p99_latency_ns = 0;
+    for (uint32_t i = 0; i <= RT_HISTOGRAM_US && total > 0; i++) {
+        seen += histogram[i];
+        if (seen >= target) {
+            report.p99_latency_ns = (i + 1) * 1000;
+            break;
+        }
+    }
+
+    return report;
+}
+
+void HMC5883LRealtime::record(uint64_t latency_ns) {
+    /** Add a wake-up latency to the histogram and the maximum. */
+    if (latency_ns > report.max_latency_ns) {
+        report.max_latency_ns = latency_ns > 0xffffffffull ? 0xffffffffu : latency_ns;
+    }
+
+    uint64_t bin = latency_ns / 1000;
+    histogram[bin < RT_HISTOGRAM_US ? bin : RT_HISTOGRAM_US]++;
+}
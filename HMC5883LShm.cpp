@@ -0,0 +1,342 @@
+/** @file
+Class file for publishing HMC5883L samples to POSIX shared memory, and reading them back from any
+process (Linux).
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#include <HMC5883LShm.h>
+#include <HMC5883L.h>
+#include <HMCTime.h>
+#include <Vec3.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t segment_size(uint32_t capacity) {
+    return sizeof(ShmHeader) + (size_t)capacity * sizeof(ShmSlot);
+}
+
+static void write_slot(ShmSlot *slot, const ShmFrame *frame) {
+    /** Write a frame under the slot's sequence lock. Only ever called by the single writer. */
+    uint32_t lock = __atomic_load_n(&slot->lock, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->lock, lock + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(&slot->frame, frame, sizeof(ShmFrame));
+
+    __atomic_store_n(&slot->lock, lock + 2, __ATOMIC_RELEASE);
+}
+
+static uint32_t begin_read(const ShmSlot *slot) {
+    /** Wait for any write in progress on the slot to finish, and return the lock token. */
+    uint32_t lock;
+    while ((lock = __atomic_load_n(&slot->lock, __ATOMIC_ACQUIRE)) & 1) {}
+    return lock;
+}
+
+static bool end_read(const ShmSlot *slot, uint32_t token) {
+    /** Returns `true` if the slot was not written since `begin_read()` returned `token`. */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->lock, __ATOMIC_RELAXED) == token;
+}
+
+HMC5883LShmPublisher::HMC5883LShmPublisher() {
+    /** Constructor for the publisher. Call `open()` to create the segment. */
+    name[0] = '\0';
+    header = NULL;
+    ring = NULL;
+    size = 0;
+    seq = 0;
+}
+
+HMC5883LShmPublisher::~HMC5883LShmPublisher() {
+    /** Destructor - unmaps the segment, but leaves it in place for readers. */
+    close();
+}
+
+uint8_t HMC5883LShmPublisher::open(const char *shm_name, uint32_t history) {
+    /** Create (or take over) the shared memory segment and initialize it.
+
+    @param[in] shm_name The POSIX shared memory name, e.g. `"/hmc5883l"`.
+    @param[in] history The number of past frames kept for readers. Default is
+                       `SHM_DEFAULT_HISTORY`.
+
+    An existing segment is only taken over if it already has the size for `history`: readers
+    that still have it mapped would fault on any page cut off by resizing it. Remove a segment of
+    a different size (e.g. with `close(true)` from its publisher) before opening it with a new
+    `history`.
+
+    @return Returns `0` on no error, `EC_SHM_OPEN` if the segment could not be created, sized or
+            mapped, or `EC_SHM_LAYOUT` if an existing segment has a different size.
+    */
+
+    close();
+    if (history == 0) {
+        history = 1;
+    }
+
+    int fd = shm_open(shm_name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return EC_SHM_OPEN;
+    }
+
+    size = segment_size(history);
+    struct stat st;
+    if (fstat(fd, &st)) {
+        ::close(fd);
+        return EC_SHM_OPEN;
+    }
+
+    // Only size a segment that was just created (or never sized).
+    if (st.st_size != 0 && (size_t)st.st_size != size) {
+        ::close(fd);
+        return EC_SHM_LAYOUT;
+    }
+
+    if (st.st_size == 0 && ftruncate(fd, size)) {
+        ::close(fd);
+        return EC_SHM_OPEN;
+    }
+
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        return EC_SHM_OPEN;
+    }
+
+    strncpy(name, shm_name, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+
+    // Invalidate the segment while it is being laid out, then publish the magic number last.
+    header = (ShmHeader *)mem;
+    ring = (ShmSlot *)(header + 1);
+    __atomic_store_n(&header->magic, 0, __ATOMIC_RELEASE);
+    memset((uint8_t *)mem + sizeof(uint32_t), 0, size - sizeof(uint32_t));
+    header->version = SHM_VERSION;
+    header->capacity = history;
+    header->slot_size = sizeof(ShmSlot);
+    __atomic_store_n(&header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+    seq = 0;
+    return 0;
+}
+
+void HMC5883LShmPublisher::close(bool unlink) {
+    /** Unmap the segment. If `unlink` is `true`, also remove it so no new readers can open it. */
+    if (header != NULL) {
+        munmap(header, size);
+        header = NULL;
+        ring = NULL;
+    }
+
+    if (unlink && name[0] != '\0') {
+        shm_unlink(name);
+    }
+}
+
+uint8_t HMC5883LShmPublisher::publish(Vec3<int> raw, Vec3<float> scaled, uint8_t gain,
+                                      uint8_t saturated, uint64_t timestamp_ns) {
+    /** Publish a sample to the history ring and the latest slot.
+
+    @return Returns `0` on no error, or `EC_SHM_OPEN` if the segment is not open.
+    */
+
+    if (header == NULL) {
+        return EC_SHM_OPEN;
+    }
+
+    ShmFrame frame;
+    frame.seq = ++seq;
+    frame.gain = gain;
+    frame.saturated = saturated;
+    frame.raw[0] = raw.x;
+    frame.raw[1] = raw.y;
+    frame.raw[2] = raw.z;
+    frame.scaled[0] = scaled.x;
+    frame.scaled[1] = scaled.y;
+    frame.scaled[2] = scaled.z;
+    frame.timestamp_ns = timestamp_ns;
+
+    // History first, so any frame a reader learns about from `latest` or `head` is already there.
+    write_slot(&ring[frame.seq % header->capacity], &frame);
+    write_slot(&header->latest, &frame);
+    __atomic_store_n(&header->head, frame.seq, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+uint8_t HMC5883LShmPublisher::acquire(HMC5883L *dev) {
+    /** Read one sample from the device and publish it.
+
+    A single bus read is made with `HMC5883L::readRawValues()`; the calibrated value is derived
+    from it using the gain the sample was measured at and the device's calibration.
+
+    @return Returns `0` on no error, or the error from the device or `publish()`.
+    */
+
+    uint64_t now = hmc_nanos();
+    uint8_t saturated;
+    Vec3<int> raw = dev->readRawValues(&saturated);
+    uint8_t rv;
+    if (rv = dev->get_error_code()) {
+        return rv;
+    }
+
+    uint8_t gain = dev->getSampleGain();
+    Vec3<float> scaled = Vec3<float>(raw.x, raw.y, raw.z) * HMC5883L::gainValue(gain);
+    scaled = scaled * dev->getCalibration(false);
+
+    return publish(raw, scaled, gain, saturated, now);
+}
+
+HMC5883LShmReader::HMC5883LShmReader() {
+    /** Constructor for the reader. Call `open()` to attach to a segment. */
+    header = NULL;
+    ring = NULL;
+    size = 0;
+}
+
+HMC5883LShmReader::~HMC5883LShmReader() {
+    /** Destructor - unmaps the segment. */
+    close();
+}
+
+uint8_t HMC5883LShmReader::open(const char *shm_name) {
+    /** Map an existing segment read-only.
+
+    @return Returns `0` on no error, `EC_SHM_OPEN` if the segment doesn't exist or can't be
+            mapped, or `EC_SHM_LAYOUT` if it has not been initialized by a compatible publisher.
+    */
+
+    close();
+    int fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd < 0) {
+        return EC_SHM_OPEN;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(ShmHeader)) {
+        ::close(fd);
+        return EC_SHM_LAYOUT;
+    }
+
+    size = st.st_size;
+    void *mem = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        return EC_SHM_OPEN;
+    }
+
+    header = (const ShmHeader *)mem;
+    ring = (const ShmSlot *)(header + 1);
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC
+            || header->version != SHM_VERSION || header->slot_size != sizeof(ShmSlot)
+            || segment_size(header->capacity) > size) {
+        close();
+        return EC_SHM_LAYOUT;
+    }
+
+    return 0;
+}
+
+void HMC5883LShmReader::close() {
+    /** Unmap the segment. */
+    if (header != NULL) {
+        munmap((void *)header, size);
+        header = NULL;
+        ring = NULL;
+    }
+}
+
+uint32_t HMC5883LShmReader::getLatestSeq() {
+    /** Returns the sequence number of the latest published frame, or 0 if there is none yet (or
+    the reader is not open). */
+    if (header == NULL) {
+        return 0;
+    }
+
+    return __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+}
+
+uint8_t HMC5883LShmReader::readLatest(ShmFrame *out) {
+    /** Copy out the latest frame.
+
+    @return Returns `0` on no error, `EC_SHM_OPEN` if the reader is not open, or `EC_SHM_STALE` if
+            nothing has been published yet.
+    */
+
+    if (header == NULL) {
+        return EC_SHM_OPEN;
+    }
+
+    uint32_t token;
+    do {
+        token = begin_read(&header->latest);
+        memcpy(out, &header->latest.frame, sizeof(ShmFrame));
+    } while (!end_read(&header->latest, token));
+
+    return out->seq ? 0 : EC_SHM_STALE;
+}
+
+uint8_t HMC5883LShmReader::readFrame(uint32_t frame_seq, ShmFrame *out) {
+    /** Copy out the frame with sequence number `frame_seq` from the history window.
+
+    @return Returns `0` on no error, `EC_SHM_OPEN` if the reader is not open, or `EC_SHM_STALE` if
+            the frame has not been published yet or has already been overwritten.
+    */
+
+    if (header == NULL) {
+        return EC_SHM_OPEN;
+    }
+
+    const ShmSlot *s = slot(frame_seq);
+    uint32_t token;
+    do {
+        token = begin_read(s);
+        memcpy(out, &s->frame, sizeof(ShmFrame));
+    } while (!end_read(s, token));
+
+    return out->seq == frame_seq ? 0 : EC_SHM_STALE;
+}
+
+const ShmFrame *HMC5883LShmReader::peekLatest(uint32_t *token) {
+    /** Zero-copy access to the latest frame. Check `validate()` after reading the fields.
+    Returns `NULL` if the reader is not open. */
+    if (header == NULL) {
+        return NULL;
+    }
+
+    *token = begin_read(&header->latest);
+    return &header->latest.frame;
+}
+
+const ShmFrame *HMC5883LShmReader::peekFrame(uint32_t frame_seq, uint32_t *token) {
+    /** Zero-copy access to a frame in the history window. After reading the fields, check
+    `validate()`, and that the frame's `seq` is `frame_seq`. Returns `NULL` if the reader is not
+    open. */
+    if (header == NULL) {
+        return NULL;
+    }
+
+    const ShmSlot *s = slot(frame_seq);
+    *token = begin_read(s);
+    return &s->frame;
+}
+
+bool HMC5883LShmReader::validate(const ShmFrame *frame, uint32_t token) {
+    /** Returns `true` if `frame` was not overwritten while it was being read in place. */
+    const ShmSlot *s = (const ShmSlot *)((const uint8_t *)frame - offsetof(ShmSlot, frame));
+    return end_read(s, token);
+}
+
+const ShmSlot *HMC5883LShmReader::slot(uint32_t frame_seq) {
+    return &ring[frame_seq % header->capacity];
+}
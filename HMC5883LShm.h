@@ -0,0 +1,126 @@
+/** @file
+Header file for publishing HMC5883L samples to POSIX shared memory, and reading them back from any
+process (Linux).
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#ifndef HMC5883LSHM_H
+#define HMC5883LSHM_H
+
+#include <HMC5883L.h>
+#include <Vec3.h>
+
+/** @addtogroup ErrorCodes
+@{ */
+#define EC_SHM_OPEN 17                      /*!< Shared memory segment could not be opened. */
+#define EC_SHM_LAYOUT 18                    /*!< Segment is not a sample ring of this version. */
+#define EC_SHM_STALE 19                     /*!< Requested sample is no longer available. */
+/** @} */
+
+/** @defgroup ShmConstants Shared memory constants
+@{ */
+#define SHM_MAGIC 0x33434d48u       /*!< "HMC3", marks an initialized segment */
+#define SHM_VERSION 1               /*!< Layout version of the segment */
+#define SHM_DEFAULT_HISTORY 256     /*!< Default number of samples kept in the history window */
+/** @} */
+
+struct ShmFrame {
+    /** One published sample. Plain data, so it has the same layout in every process. */
+    uint32_t seq;                      /*!< Sample sequence number, starting at 1. */
+    uint8_t gain;                      /*!< Gain setting the sample was measured at. */
+    uint8_t saturated;                 /*!< `WC_*_SATURATED` flags. */
+    int16_t raw[3];                    /*!< Raw counts, x, y, z. */
+    float scaled[3];                   /*!< Calibrated field in mG, x, y, z. */
+    uint64_t timestamp_ns;             /*!< `hmc_nanos()` at acquisition. */
+
+    Vec3<int> rawValues(void) const { return Vec3<int>(raw[0], raw[1], raw[2]); }
+    Vec3<float> values(void) const { return Vec3<float>(scaled[0], scaled[1], scaled[2]); }
+};
+
+struct ShmSlot {
+    /** A frame protected by a sequence lock. `lock` is odd while the frame is being written. */
+    uint32_t lock;
+    uint32_t reserved;
+    ShmFrame frame;
+};
+
+struct ShmHeader {
+    /** Header at the start of the segment, followed by `capacity` history slots. */
+    uint32_t magic;                    /*!< `SHM_MAGIC` once the segment is initialized. */
+    uint32_t version;
+    uint32_t capacity;                 /*!< Number of slots in the history ring. */
+    uint32_t slot_size;                /*!< `sizeof(ShmSlot)`, to catch layout mismatches. */
+    uint32_t head;                     /*!< Sequence number of the latest published frame. */
+    uint32_t reserved[11];             /*!< Pad so `latest` starts on its own cache line. */
+    ShmSlot latest;                    /*!< The latest frame. */
+};
+
+class HMC5883LShmPublisher {
+    /** Single writer of a shared memory sample ring.
+
+    The segment holds a "latest" slot plus a ring of the last `capacity` frames. Every slot is
+    protected by its own sequence lock: the writer never waits for readers, and readers never
+    block the writer - a reader that overlaps a write simply retries. Only the process owning the
+    `HMC5883L` object should publish.
+    */
+public:
+    HMC5883LShmPublisher();
+    ~HMC5883LShmPublisher();
+
+    uint8_t open(const char *name, uint32_t history=SHM_DEFAULT_HISTORY);
+    void close(bool unlink=false);
+
+    uint8_t publish(Vec3<int> raw, Vec3<float> scaled, uint8_t gain, uint8_t saturated,
+                    uint64_t timestamp_ns);
+    uint8_t acquire(HMC5883L *dev);
+
+private:
+    char name[64];
+    ShmHeader *header;
+    ShmSlot *ring;
+    size_t size;
+    uint32_t seq;
+};
+
+class HMC5883LShmReader {
+    /** Reader of a shared memory sample ring written by `HMC5883LShmPublisher`.
+
+    Frames can be copied out (`readLatest()`, `readFrame()`), or read in place without copying:
+
+        uint32_t token;
+        const ShmFrame *f = reader.peekLatest(&token);
+        float x = f->scaled[0];
+        if (!reader.validate(f, token)) { ... retry ... }
+
+    Readers are lock-free rather than wait-free: a read retries if it overlaps a write, which with a
+    single writer at the sensor's output rate is rare and short.
+    */
+public:
+    HMC5883LShmReader();
+    ~HMC5883LShmReader();
+
+    uint8_t open(const char *name);
+    void close(void);
+
+    uint32_t getLatestSeq(void);
+    uint8_t readLatest(ShmFrame *out);
+    uint8_t readFrame(uint32_t seq, ShmFrame *out);
+
+    const ShmFrame *peekLatest(uint32_t *token);
+    const ShmFrame *peekFrame(uint32_t seq, uint32_t *token);
+    bool validate(const ShmFrame *frame, uint32_t token);
+
+private:
+    const ShmSlot *slot(uint32_t seq);
+
+    const ShmHeader *header;
+    const ShmSlot *ring;
+    size_t size;
+};
+
+#endif
@@ -0,0 +1,317 @@
+/** @file
+Compressed block codec for raw HMC5883L sample streams.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <HMCCodec.h>
+#include <string.h>
+
+static inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline void put_le(uint8_t *p, uint64_t v, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static inline uint64_t get_le(const uint8_t *p, uint8_t n) {
+    uint64_t v = 0;
+    for (uint8_t i = 0; i < n; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+static uint8_t delta_width(const int16_t *v, uint16_t n) {
+    /** Number of bits needed for the widest zigzag-encoded delta in `v`. */
+    uint32_t bits = 0;
+    for (uint16_t i = 1; i < n; i++) {
+        bits |= zigzag((int32_t)v[i] - v[i - 1]);
+    }
+
+    uint8_t width = 0;
+    while (bits) {
+        width++;
+        bits >>= 1;
+    }
+    return width;
+}
+
+size_t hmc_codec_encode(const int16_t *x, const int16_t *y, const int16_t *z, uint16_t n,
+                        uint8_t gain, uint64_t timestamp_base, uint32_t sample_period,
+                        uint8_t mode, uint8_t *out, size_t capacity, uint8_t *err) {
+    /** Encode a block of raw samples.
+
+    @param[in] x, y, z Raw counts for each axis, e.g. from `HMC5883L::readRawValues()` or
+                       `IIODev::read_scans()`. Each has `n` elements.
+    @param[in] n The number of samples in the block, at least 1.
+    @param[in] gain The gain setting the samples were measured at.
+    @param[in] timestamp_base The timestamp of the first sample, in any unit.
+    @param[in] sample_period The time between samples, in the same unit as `timestamp_base`.
+    @param[in] mode `CODEC_BITPACK` or `CODEC_VARINT`.
+    @param[out] out The output buffer. `CODEC_MAX_BLOCK_SIZE(n)` bytes is always enough.
+    @param[in] capacity The size of `out`, in bytes.
+    @param[out] err Set to `0` on success, `EC_CODEC_BUFFER` if `out` is too small or
+                    `EC_CODEC_CORRUPT` if `n` or `mode` is invalid. Pass `NULL` (default) if you
+                    don't want to read this out.
+
+    @return Returns the number of bytes written, or 0 on error.
+    */
+
+    const int16_t *axes[3] = {x, y, z};
+    uint8_t rv = 0;
+    size_t size = 0;
+    uint8_t *p = out + CODEC_HEADER_SIZE;
+    uint8_t *end = out + capacity;
+    uint8_t width[3] = {0, 0, 0};
+
+    if (n == 0 || mode > CODEC_VARINT) {
+        rv = EC_CODEC_CORRUPT;
+        goto done;
+    }
+
+    if (capacity < CODEC_HEADER_SIZE) {
+        rv = EC_CODEC_BUFFER;
+        goto done;
+    }
+
+    if (mode == CODEC_BITPACK) {
+        for (uint8_t a = 0; a < 3; a++) {
+            width[a] = delta_width(axes[a], n);
+            size += (size_t)width[a] * (n - 1);
+        }
+
+        size = (size + 7) / 8;
+        if (size > (size_t)(end - p)) {
+            rv = EC_CODEC_BUFFER;
+            goto done;
+        }
+
+        // One continuous bit stream, flushed to memory 32 bits at a time.
+        uint64_t acc = 0;
+        uint8_t n_bits = 0;
+        for (uint8_t a = 0; a < 3; a++) {
+            const int16_t *v = axes[a];
+            uint8_t w = width[a];
+            if (w == 0) {
+                continue;
+            }
+
+            for (uint16_t i = 1; i < n; i++) {
+                acc |= (uint64_t)zigzag((int32_t)v[i] - v[i - 1]) << n_bits;
+                n_bits += w;
+                if (n_bits >= 32) {
+                    put_le(p, acc, 4);
+                    p += 4;
+                    acc >>= 32;
+                    n_bits -= 32;
+                }
+            }
+        }
+
+        while (n_bits > 0) {
+            *p++ = (uint8_t)acc;
+            acc >>= 8;
+            n_bits = n_bits > 8 ? n_bits - 8 : 0;
+        }
+    } else {
+        for (uint8_t a = 0; a < 3; a++) {
+            const int16_t *v = axes[a];
+            for (uint16_t i = 1; i < n; i++) {
+                uint32_t d = zigzag((int32_t)v[i] - v[i - 1]);
+                uint8_t len = d < 0x80 ? 1 : (d < 0x4000 ? 2 : 3);  // 17 bits fit in 3 bytes
+                if (end - p < len) {
+                    rv = EC_CODEC_BUFFER;
+                    goto done;
+                }
+
+                while (d >= 0x80) {
+                    *p++ = (uint8_t)(d | 0x80);
+                    d >>= 7;
+                }
+                *p++ = (uint8_t)d;
+            }
+        }
+
+        size = p - (out + CODEC_HEADER_SIZE);
+    }
+
+    put_le(out, CODEC_MAGIC, 2);
+    out[2] = mode;
+    out[3] = gain;
+    put_le(out + 4, n, 2);
+    out[6] = width[0];
+    out[7] = width[1];
+    out[8] = width[2];
+    out[9] = 0;
+    put_le(out + 10, size, 4);
+    put_le(out + 14, timestamp_base, 8);
+    put_le(out + 22, sample_period, 4);
+    put_le(out + 26, (uint16_t)x[0], 2);
+    put_le(out + 28, (uint16_t)y[0], 2);
+    put_le(out + 30, (uint16_t)z[0], 2);
+
+done:
+    if (err != NULL) {
+        *err = rv;
+    }
+
+    return rv ? 0 : CODEC_HEADER_SIZE + size;
+}
+
+uint8_t hmc_codec_read_header(const uint8_t *in, size_t len, CodecBlockInfo *info) {
+    /** Decode a block header without touching the payload.
+
+    @return Returns `0` on no error, or `EC_CODEC_CORRUPT` if `in` does not start with a valid
+            header or is shorter than the block it describes.
+    */
+
+    if (len < CODEC_HEADER_SIZE || get_le(in, 2) != CODEC_MAGIC || in[2] > CODEC_VARINT) {
+        return EC_CODEC_CORRUPT;
+    }
+
+    info->mode = in[2];
+    info->gain = in[3];
+    info->n_samples = get_le(in + 4, 2);
+    info->width[0] = in[6];
+    info->width[1] = in[7];
+    info->width[2] = in[8];
+    info->payload_size = get_le(in + 10, 4);
+    info->timestamp_base = get_le(in + 14, 8);
+    info->sample_period = get_le(in + 22, 4);
+    info->first[0] = (int16_t)get_le(in + 26, 2);
+    info->first[1] = (int16_t)get_le(in + 28, 2);
+    info->first[2] = (int16_t)get_le(in + 30, 2);
+
+    if (info->n_samples == 0 || info->width[0] > 17 || info->width[1] > 17
+            || info->width[2] > 17 || info->blockSize() > len) {
+        return EC_CODEC_CORRUPT;
+    }
+
+    return 0;
+}
+
+uint8_t hmc_codec_decode(const uint8_t *in, size_t len, int16_t *x, int16_t *y, int16_t *z,
+                         uint16_t capacity, CodecBlockInfo *info) {
+    /** Decode a single block.
+
+    @param[in] in The start of the block.
+    @param[in] len The number of bytes available at `in`.
+    @param[out] x, y, z Arrays receiving the raw counts, each with room for `capacity` samples.
+    @param[in] capacity The size of the output arrays.
+    @param[out] info The block header, including the number of samples decoded.
+
+    @return Returns `0` on no error, `EC_CODEC_BUFFER` if the block has more than `capacity`
+            samples, or `EC_CODEC_CORRUPT` if the block is malformed.
+    */
+
+    uint8_t rv;
+    if (rv = hmc_codec_read_header(in, len, info)) {
+        return rv;
+    }
+
+    uint16_t n = info->n_samples;
+    if (n > capacity) {
+        return EC_CODEC_BUFFER;
+    }
+
+    int16_t *axes[3] = {x, y, z};
+    const uint8_t *p = in + CODEC_HEADER_SIZE;
+    const uint8_t *end = p + info->payload_size;
+
+    if (info->mode == CODEC_BITPACK) {
+        size_t bits = ((size_t)info->width[0] + info->width[1] + info->width[2]) * (n - 1);
+        if ((bits + 7) / 8 > info->payload_size) {
+            return EC_CODEC_CORRUPT;
+        }
+
+        uint64_t acc = 0;
+        uint8_t n_bits = 0;
+        for (uint8_t a = 0; a < 3; a++) {
+            int16_t *v = axes[a];
+            uint8_t w = info->width[a];
+            uint32_t mask = ((uint32_t)1 << w) - 1;
+            int32_t prev = info->first[a];
+            v[0] = prev;
+
+            for (uint16_t i = 1; i < n; i++) {
+                if (n_bits < w) {
+                    // Refill 32 bits at a time where possible, byte by byte at the tail.
+                    if (end - p >= 4) {
+                        acc |= get_le(p, 4) << n_bits;
+                        p += 4;
+                        n_bits += 32;
+                    } else {
+                        while (n_bits < w && p < end) {
+                            acc |= (uint64_t)*p++ << n_bits;
+                            n_bits += 8;
+                        }
+                    }
+                }
+
+                prev += unzigzag((uint32_t)acc & mask);
+                acc >>= w;
+                n_bits -= w;
+                v[i] = (int16_t)prev;
+            }
+        }
+    } else {
+        for (uint8_t a = 0; a < 3; a++) {
+            int16_t *v = axes[a];
+            int32_t prev = info->first[a];
+            v[0] = prev;
+
+            for (uint16_t i = 1; i < n; i++) {
+                uint32_t d = 0;
+                uint8_t shift = 0;
+                uint8_t byte;
+                do {
+                    if (p >= end || shift > 21) {
+                        return EC_CODEC_CORRUPT;
+                    }
+                    byte = *p++;
+                    d |= (uint32_t)(byte & 0x7f) << shift;
+                    shift += 7;
+                } while (byte & 0x80);
+
+                prev += unzigzag(d);
+                v[i] = (int16_t)prev;
+            }
+        }
+    }
+
+    return 0;
+}
+
+uint32_t hmc_codec_index(const uint8_t *in, size_t len, size_t *offsets, uint32_t max_blocks) {
+    /** Find the start of each block in a stream of concatenated blocks.
+
+    Only the headers are read, so this is cheap even for long streams. The resulting offsets can
+    be passed (as `in + offsets[i]`) to `hmc_codec_decode()` for random access to any block.
+
+    @param[in] in The stream.
+    @param[in] len The length of the stream, in bytes.
+    @param[out] offsets Receives the byte offset of each block, up to `max_blocks` of them.
+    @param[in] max_blocks The size of `offsets`.
+
+    @return Returns the number of blocks found. Indexing stops at the first invalid header.
+    */
+
+    uint32_t n = 0;
+    size_t pos = 0;
+    CodecBlockInfo info;
+    while (n < max_blocks && !hmc_codec_read_header(in + pos, len - pos, &info)) {
+        offsets[n++] = pos;
+        pos += info.blockSize();
+    }
+
+    return n;
+}
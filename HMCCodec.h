@@ -0,0 +1,79 @@
+/** @file
+Compressed block codec for raw HMC5883L sample streams.
+
+Raw samples are 12-bit values that change slowly, so each block stores the first sample of each
+axis verbatim and the rest as zigzag-encoded deltas, either bit-packed at the narrowest width that
+fits every delta of the axis (`CODEC_BITPACK`, the fastest) or as LEB128 varints (`CODEC_VARINT`,
+smaller when most deltas are tiny but a few are large). Every block starts with a header carrying
+the gain, the timestamp of the first sample and the sample period, and its own encoded length,
+so blocks are independently decodable and a stream of blocks can be indexed without decoding.
+
+Block layout (all multi-byte fields little-endian):
+
+| Offset | Size | Field                                            |
+| :----: | :--: | :----------------------------------------------- |
+|    0   |   2  | Magic, `CODEC_MAGIC`                             |
+|    2   |   1  | Mode, `CODEC_BITPACK` or `CODEC_VARINT`          |
+|    3   |   1  | Gain setting, see \ref GainSettings              |
+|    4   |   2  | Number of samples                                |
+|    6   |   3  | Bit width of the x, y and z deltas (bit-packing) |
+|    9   |   1  | Reserved                                         |
+|   10   |   4  | Payload size, in bytes                           |
+|   14   |   8  | Timestamp of the first sample                    |
+|   22   |   4  | Sample period, in the units of the timestamp     |
+|   26   |   6  | First x, y and z samples                         |
+|   32   |   -  | Payload: x deltas, then y deltas, then z deltas  |
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#ifndef HMCCODEC_H
+#define HMCCODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** @addtogroup ErrorCodes
+@{ */
+#define EC_CODEC_BUFFER 20                  /*!< Output buffer too small for the block. */
+#define EC_CODEC_CORRUPT 21                 /*!< Input is not a valid block. */
+/** @} */
+
+/** @defgroup CodecConstants Codec constants
+@{ */
+#define CODEC_MAGIC 0x4248          /*!< "HB", marks the start of a block */
+#define CODEC_HEADER_SIZE 32        /*!< Size of the block header, in bytes */
+#define CODEC_BITPACK 0             /*!< Deltas are bit-packed at a fixed width per axis */
+#define CODEC_VARINT 1              /*!< Deltas are stored as LEB128 varints */
+
+/** Largest possible encoded size of a block of `n` samples, in either mode. */
+#define CODEC_MAX_BLOCK_SIZE(n) (CODEC_HEADER_SIZE + 3 * 3 * (size_t)(n))
+/** @} */
+
+struct CodecBlockInfo {
+    /** Decoded block header. */
+    uint8_t mode;                      /*!< `CODEC_BITPACK` or `CODEC_VARINT` */
+    uint8_t gain;                      /*!< Gain setting the samples were measured at */
+    uint16_t n_samples;
+    uint8_t width[3];                  /*!< Bit width of the deltas per axis (bit-packing) */
+    uint32_t payload_size;
+    uint64_t timestamp_base;           /*!< Timestamp of the first sample */
+    uint32_t sample_period;            /*!< Time between samples */
+    int16_t first[3];                  /*!< First sample of each axis */
+
+    size_t blockSize(void) const { return CODEC_HEADER_SIZE + payload_size; }
+    uint64_t timestamp(uint16_t i) const { return timestamp_base + (uint64_t)i * sample_period; }
+};
+
+size_t hmc_codec_encode(const int16_t *x, const int16_t *y, const int16_t *z, uint16_t n,
+                        uint8_t gain, uint64_t timestamp_base, uint32_t sample_period,
+                        uint8_t mode, uint8_t *out, size_t capacity, uint8_t *err=NULL);
+
+uint8_t hmc_codec_read_header(const uint8_t *in, size_t len, CodecBlockInfo *info);
+uint8_t hmc_codec_decode(const uint8_t *in, size_t len, int16_t *x, int16_t *y, int16_t *z,
+                         uint16_t capacity, CodecBlockInfo *info);
+
+uint32_t hmc_codec_index(const uint8_t *in, size_t len, size_t *offsets, uint32_t max_blocks);
+
+#endif
@@ -0,0 +1,71 @@
+/** @file
+Implementation of the derived views of HMCSample and HMCSampleView.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <HMCSample.h>
+#include <HMC5883L.h>
+#include <Vec3.h>
+#include <math.h>
+
+#define VIEW_SCALED 1
+#define VIEW_CALIBRATED 2
+#define VIEW_HEADING 4
+
+Vec3<float> HMCSample::scaled() const {
+    /** The field in mG, scaled by the gain the sample was measured at. */
+    float s = HMC5883L::gainValue(gain);
+    return Vec3<float>(x() * s, y() * s, z() * s);
+}
+
+Vec3<float> HMCSample::calibrated() const {
+    /** The field in mG, scaled by the gain and the source device's calibration. */
+    if (calibration == NULL) {
+        return scaled();
+    }
+
+    return scaled() * hmc_calibration_float(*calibration);
+}
+
+float HMCSample::heading() const {
+    /** The heading in degrees clockwise from magnetic north, in [0, 360), from the calibrated
+    field, assuming the sensor is level with its X axis forward. */
+    Vec3<float> v = calibrated();
+    float h = atan2(v.y, v.x) * (float)(180.0 / M_PI);
+    return h < 0 ? h + 360 : h;
+}
+
+Vec3<float> HMCSampleView::scaled() {
+    /** Same as `HMCSample::scaled()`, computed on first use. */
+    if (!(cached & VIEW_SCALED)) {
+        scaled_value = sample.scaled();
+        cached |= VIEW_SCALED;
+    }
+
+    return scaled_value;
+}
+
+Vec3<float> HMCSampleView::calibrated() {
+    /** Same as `HMCSample::calibrated()`, computed on first use. */
+    if (!(cached & VIEW_CALIBRATED)) {
+        calibrated_value = sample.calibration != NULL
+                           ? scaled() * hmc_calibration_float(*sample.calibration) : scaled();
+        cached |= VIEW_CALIBRATED;
+    }
+
+    return calibrated_value;
+}
+
+float HMCSampleView::heading() {
+    /** Same as `HMCSample::heading()`, computed on first use. */
+    if (!(cached & VIEW_HEADING)) {
+        Vec3<float> v = calibrated();
+        float h = atan2(v.y, v.x) * (float)(180.0 / M_PI);
+        heading_value = h < 0 ? h + 360 : h;
+        cached |= VIEW_HEADING;
+    }
+
+    return heading_value;
+}
@@ -0,0 +1,84 @@
+/** @file
+Definition for HMCSample, a compact raw HMC5883L sample whose scaled, calibrated and heading
+values are derived on demand, and HMCSampleView, which memoizes them.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#ifndef HMCSAMPLE_H
+#define HMCSAMPLE_H
+
+#include <stdint.h>
+#include <Vec3.h>
+
+/* The device calibration, as stored by `HMC5883L`. The `HMC5883L_SMALL` footprint profile keeps it
+   as signed Q14 fixed point (range ±2) instead of `float`, see `HMC5883L.h`. */
+#if defined(HMC5883L_SMALL)
+#define HMC_CAL_Q 14
+typedef Vec3<int16_t> HMCCalibration;
+#else
+typedef Vec3<float> HMCCalibration;
+#endif
+
+inline Vec3<float> hmc_calibration_float(const HMCCalibration &c) {
+    /** Convert a stored calibration to per-axis `float` scale factors. */
+#if defined(HMC5883L_SMALL)
+    const float q = 1.0f / (1 << HMC_CAL_Q);
+    return Vec3<float>(c.x * q, c.y * q, c.z * q);
+#else
+    return c;
+#endif
+}
+
+struct HMCSample {
+    /** One sample, as read from the device by `HMC5883L::readSample()`.
+
+    Holds the 6 data register bytes exactly as read, the gain setting they were measured at and
+    the saturation flags, plus a pointer to the calibration of the device it came from - 16 bytes
+    or less on every target, and trivially copyable, so samples can be passed around and stored in
+    rings by value. Nothing is converted until a view is asked for, and every view comes from the
+    same bus read.
+
+    The calibration pointer refers to the device's live calibration, so `calibrated()` uses the
+    calibration current at the time it is called, and the `HMC5883L` object must outlive the
+    sample for `calibrated()` to be used.
+    */
+    uint8_t raw[6];                    /*!< Data registers as read: X, Z, Y, each MSB first */
+    uint8_t gain;                      /*!< Gain setting the sample was measured at */
+    uint8_t saturated;                 /*!< `WC_*_SATURATED` flags */
+    const HMCCalibration *calibration; /*!< Calibration of the source device, or `NULL` */
+
+    int16_t x(void) const { return (int16_t)(raw[0] << 8 | raw[1]); }
+    int16_t y(void) const { return (int16_t)(raw[4] << 8 | raw[5]); }
+    int16_t z(void) const { return (int16_t)(raw[2] << 8 | raw[3]); }
+
+    Vec3<int> rawValues(void) const { return Vec3<int>(x(), y(), z()); }
+    Vec3<float> scaled(void) const;
+    Vec3<float> calibrated(void) const;
+    float heading(void) const;
+};
+
+class HMCSampleView {
+    /** Wrapper around an `HMCSample` which computes each view at most once.
+
+    Useful when a sample is handed to several consumers which each want the scaled or calibrated
+    field or the heading. Not meant for storing samples in bulk - store the `HMCSample` itself.
+    */
+public:
+    HMCSampleView(const HMCSample &s) : sample(s), cached(0) {}
+
+    Vec3<float> scaled(void);
+    Vec3<float> calibrated(void);
+    float heading(void);
+
+    const HMCSample sample;
+
+private:
+    uint8_t cached;                    /*!< Which of the views below have been computed */
+    Vec3<float> scaled_value;
+    Vec3<float> calibrated_value;
+    float heading_value;
+};
+
+#endif
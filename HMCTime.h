@@ -0,0 +1,47 @@
+/** @file
+Portable monotonic time source, used for scheduling reads.
+
+On Arduino this is `micros()`; elsewhere it is `CLOCK_MONOTONIC`.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#ifndef HMCTIME_H
+#define HMCTIME_H
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#include <time.h>
+#endif
+
+inline uint32_t hmc_micros(void) {
+    /** Returns a monotonic time in microseconds.
+
+    The value wraps every ~71.6 minutes, so only differences between two times (computed with
+    unsigned arithmetic, e.g. `(uint32_t)(now - then)`) are meaningful.
+    */
+#ifdef ARDUINO
+    return micros();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+}
+
+inline uint64_t hmc_nanos(void) {
+    /** Returns a monotonic time in nanoseconds. On Arduino, the resolution is that of `micros()`
+    and the value wraps along with it. */
+#ifdef ARDUINO
+    return (uint64_t)micros() * 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#endif
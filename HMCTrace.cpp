@@ -0,0 +1,190 @@
+/** @file
+Trace recorder for the library's hot paths, with export to Chrome trace format.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <HMCTrace.h>
+#include <string.h>
+
+#if !defined(HMC5883L_SMALL)
+
+bool hmc_trace_on = false;
+HMC_TRACE_TLS TraceRing *hmc_trace_ring = NULL;
+
+static TraceRing rings[TRACE_MAX_THREADS];
+static uint8_t rings_claimed = 0;
+
+/* Readings of `hmc_trace_ticks()` and `hmc_nanos()` taken together, when recording first starts
+   and whenever it stops, to convert event ticks to nanoseconds. */
+static uint64_t start_ticks = 0, start_ns = 0;
+static uint64_t stop_ticks = 0, stop_ns = 0;
+
+void hmc_trace_enable(bool enabled) {
+    /** Start or stop recording, on all threads.
+
+    Scopes already open when recording starts aren't recorded, and those open when it stops are
+    still closed, so the trace only ever holds complete scopes (except where a ring has wrapped).
+    */
+    if (enabled && start_ns == 0) {
+        start_ticks = hmc_trace_ticks();
+        start_ns = hmc_nanos();
+    }
+
+    __atomic_store_n(&hmc_trace_on, enabled, __ATOMIC_RELAXED);
+
+    if (!enabled) {
+        stop_ticks = hmc_trace_ticks();
+        stop_ns = hmc_nanos();
+    }
+}
+
+bool hmc_trace_enabled() {
+    /** Whether recording is on. */
+    return __atomic_load_n(&hmc_trace_on, __ATOMIC_RELAXED);
+}
+
+void hmc_trace_clear() {
+    /** Discard all recorded events. Only call this while recording is stopped and no scope is
+    open on any thread. The rings stay assigned to their threads. */
+    uint8_t n = __atomic_load_n(&rings_claimed, __ATOMIC_ACQUIRE);
+    for (uint8_t i = 0; i < n; i++) {
+        rings[i].head = 0;
+    }
+
+    start_ticks = start_ns = 0;
+    stop_ticks = stop_ns = 0;
+}
+
+TraceRing *hmc_trace_claim() {
+    /** Assign the next free ring to the calling thread, on its first event.
+
+    The ring is zeroed here, so its memory is faulted in before the thread starts relying on
+    recording being cheap.
+
+    @return Returns the ring, or `NULL` if all `TRACE_MAX_THREADS` rings are taken.
+    */
+    uint8_t n = __atomic_load_n(&rings_claimed, __ATOMIC_ACQUIRE);
+    do {
+        if (n >= TRACE_MAX_THREADS) {
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&rings_claimed, &n, n + 1, false, __ATOMIC_ACQ_REL,
+                                          __ATOMIC_ACQUIRE));
+
+    memset(&rings[n], 0, sizeof(TraceRing));
+    hmc_trace_ring = &rings[n];
+    return hmc_trace_ring;
+}
+
+static uint64_t to_nanos(uint64_t ticks, double ns_per_tick) {
+    /** Convert an event's ticks to `hmc_nanos()` time. */
+#if defined(HMC_TRACE_TICKS_NS)
+    (void)ns_per_tick;
+    return ticks;
+#else
+    return start_ns + (int64_t)((double)(int64_t)(ticks - start_ticks) * ns_per_tick);
+#endif
+}
+
+static uint8_t format_uint(char *out, uint64_t value, uint8_t min_digits) {
+    /** Write `value` in decimal, zero-padded to at least `min_digits`. Returns the length. */
+    char digits[20];
+    uint8_t n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value || n < min_digits);
+
+    for (uint8_t i = 0; i < n; i++) {
+        out[i] = digits[n - 1 - i];
+    }
+
+    return n;
+}
+
+uint32_t hmc_trace_export(TraceWriter write, void *ctx) {
+    /** Write the recorded events as a Chrome trace JSON document.
+
+    Only call this while no other thread is recording. Each ring is written oldest event first, as
+    the thread `tid` numbered by the order in which the threads first recorded. Timestamps are in
+    microseconds of `hmc_nanos()` time, with nanosecond resolution, interpolated between the
+    readings taken when recording started and stopped - or, if it hasn't stopped since it started,
+    a reading taken now. An end event whose begin event has been overwritten is left out.
+
+    @param[in] write Called with each successive chunk of the document; the chunks are not
+                     null-terminated.
+    @param[in] ctx Passed through to `write`.
+
+    @return Returns the number of events written.
+    */
+    static const char head[] = "{\"traceEvents\":[";
+    static const char tail[] = "],\"displayTimeUnit\":\"ns\"}\n";
+
+    write(head, sizeof(head) - 1, ctx);
+
+    uint64_t end_ticks = stop_ticks, end_ns = stop_ns;
+    if (hmc_trace_enabled() || stop_ticks <= start_ticks) {
+        end_ticks = hmc_trace_ticks();
+        end_ns = hmc_nanos();
+    }
+
+    double ns_per_tick = 1;
+    if (end_ticks > start_ticks) {
+        ns_per_tick = (double)(end_ns - start_ns) / (double)(end_ticks - start_ticks);
+    }
+
+    uint32_t written = 0;
+    uint8_t n = __atomic_load_n(&rings_claimed, __ATOMIC_ACQUIRE);
+    for (uint8_t t = 0; t < n; t++) {
+        const TraceRing &ring = rings[t];
+        uint32_t first = ring.head > TRACE_RING_EVENTS ? ring.head - TRACE_RING_EVENTS : 0;
+        uint32_t depth = 0;
+
+        for (uint32_t i = first; i != ring.head; i++) {
+            const TraceEvent &ev = ring.events[i & (TRACE_RING_EVENTS - 1)];
+            if (ev.phase == TRACE_END) {
+                if (depth == 0) {
+                    continue;
+                }
+                depth--;
+            } else {
+                depth++;
+            }
+
+            char buf[80];
+            uint8_t len = 0;
+            if (written) {
+                buf[len++] = ',';
+            }
+            memcpy(buf + len, "{\"name\":\"", 9);
+            len += 9;
+            write(buf, len, ctx);
+            write(ev.name, strlen(ev.name), ctx);
+
+            len = 0;
+            memcpy(buf + len, "\",\"ph\":\"", 8);
+            len += 8;
+            buf[len++] = ev.phase;
+            memcpy(buf + len, "\",\"ts\":", 7);
+            len += 7;
+            uint64_t ns = to_nanos(ev.ticks, ns_per_tick);
+            len += format_uint(buf + len, ns / 1000, 1);
+            buf[len++] = '.';
+            len += format_uint(buf + len, ns % 1000, 3);
+            memcpy(buf + len, ",\"pid\":1,\"tid\":", 15);
+            len += 15;
+            len += format_uint(buf + len, t + 1, 1);
+            buf[len++] = '}';
+            write(buf, len, ctx);
+
+            written++;
+        }
+    }
+
+    write(tail, sizeof(tail) - 1, ctx);
+    return written;
+}
+
+#endif
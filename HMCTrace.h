@@ -0,0 +1,161 @@
+/** @file
+Low-overhead trace recorder for the library's hot paths, exportable to Chrome trace format.
+
+Every transport transaction and `HMC5883L` API call is bracketed by `HMC_TRACE_SCOPE()`, which
+records a begin and an end event into a ring preallocated for the calling thread. Events are
+stamped with the cheapest monotonic counter available (`hmc_trace_ticks()`), which the export
+converts to nanoseconds. Recording is off until `hmc_trace_enable(true)`; while it is off each
+scope costs a load and a branch. Once stopped, `hmc_trace_export()` writes the rings as
+Chrome trace JSON, which can be loaded into `chrome://tracing` or Perfetto to see e.g. which step
+of a read overran its deadline.
+
+Each ring keeps the most recent `TRACE_RING_EVENTS` events of its thread, overwriting the oldest.
+The first `TRACE_MAX_THREADS` threads to record get a ring; events from any further thread are
+dropped. The footprint profile (`HMC5883L_SMALL`) compiles the recorder out entirely.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#ifndef HMCTRACE_H
+#define HMCTRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <HMCTime.h>
+
+/** @defgroup TraceConstants Trace constants
+@{ */
+/* The rings are allocated statically: `TRACE_MAX_THREADS * TRACE_RING_EVENTS` events, 24 bytes
+   each on a 64-bit host, make 768 KiB of bss with the host defaults. Only the rings claimed by a
+   recording thread are ever touched, so the rest costs address space rather than memory; define
+   smaller values to shrink it. */
+#ifndef TRACE_RING_EVENTS
+#if defined(ARDUINO)
+#define TRACE_RING_EVENTS 32        /*!< Events kept per thread (must be a power of 2) */
+#else
+#define TRACE_RING_EVENTS 4096      /*!< Events kept per thread (must be a power of 2) */
+#endif
+#endif
+
+#ifndef TRACE_MAX_THREADS
+#if defined(ARDUINO)
+#define TRACE_MAX_THREADS 1         /*!< Number of threads that can record */
+#else
+#define TRACE_MAX_THREADS 8         /*!< Number of threads that can record */
+#endif
+#endif
+
+#define TRACE_BEGIN 'B'             /*!< Phase of an event opening a scope */
+#define TRACE_END 'E'               /*!< Phase of an event closing a scope */
+/** @} */
+
+/* Each thread caches a pointer to its ring; there are no threads to tell apart on Arduino. */
+#if defined(ARDUINO)
+#define HMC_TRACE_TLS
+#else
+#define HMC_TRACE_TLS __thread
+#endif
+
+/* Without a cycle counter to read, events are stamped with `hmc_nanos()` directly. */
+#if !defined(__x86_64__) && !defined(__i386__) && !defined(__aarch64__)
+#define HMC_TRACE_TICKS_NS
+#endif
+
+struct TraceEvent {
+    /** A single recorded event. */
+    uint64_t ticks;                    /*!< `hmc_trace_ticks()` when the event was recorded. */
+    const char *name;                  /*!< Name of the scope, a string literal (not copied). */
+    uint8_t phase;                     /*!< `TRACE_BEGIN` or `TRACE_END`. */
+};
+
+struct TraceRing {
+    /** The events of a single thread. */
+    uint32_t head;                     /*!< Number of events ever recorded; the next slot. */
+    TraceEvent events[TRACE_RING_EVENTS];
+};
+
+/** Called by `hmc_trace_export()` with each successive chunk of the JSON document. */
+typedef void (*TraceWriter)(const char *data, uint16_t length, void *ctx);
+
+extern bool hmc_trace_on;
+extern HMC_TRACE_TLS TraceRing *hmc_trace_ring;
+
+void hmc_trace_enable(bool enabled);
+bool hmc_trace_enabled(void);
+void hmc_trace_clear(void);
+uint32_t hmc_trace_export(TraceWriter write, void *ctx);
+TraceRing *hmc_trace_claim(void);
+
+inline uint64_t hmc_trace_ticks(void) {
+    /** The timestamp of an event: the time stamp counter on x86, the virtual counter on ARMv8,
+    and `hmc_nanos()` elsewhere. The counters cost a few nanoseconds to read rather than the tens
+    of a `clock_gettime()` call; `hmc_trace_export()` maps them onto `hmc_nanos()` time, from
+    readings of both taken when recording starts and stops. */
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t t;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    return hmc_nanos();
+#endif
+}
+
+inline void hmc_trace_record(const char *name, uint8_t phase) {
+    /** Record an event on the calling thread's ring, whether or not tracing is enabled.
+
+    @param[in] name The name of the scope. Must be a string literal (or otherwise outlive the
+                    trace) that needs no escaping in JSON.
+    @param[in] phase `TRACE_BEGIN` or `TRACE_END`.
+    */
+    TraceRing *ring = hmc_trace_ring;
+    if (ring == NULL && (ring = hmc_trace_claim()) == NULL) {
+        return;
+    }
+
+    TraceEvent &ev = ring->events[ring->head & (TRACE_RING_EVENTS - 1)];
+    ev.ticks = hmc_trace_ticks();
+    ev.name = name;
+    ev.phase = phase;
+    ring->head++;
+}
+
+class HMCTraceScope {
+    /** Records a begin event on construction and the matching end event on destruction.
+
+    Whether to record is decided once, on construction, so toggling tracing in the middle of a
+    scope never leaves an unmatched event.
+    */
+public:
+    HMCTraceScope(const char *scope_name) {
+        name = scope_name;
+        active = __atomic_load_n(&hmc_trace_on, __ATOMIC_RELAXED);
+        if (active) {
+            hmc_trace_record(name, TRACE_BEGIN);
+        }
+    }
+
+    ~HMCTraceScope() {
+        if (active) {
+            hmc_trace_record(name, TRACE_END);
+        }
+    }
+
+private:
+    const char *name;
+    bool active;
+};
+
+#define HMC_TRACE_CONCAT_(a, b) a##b
+#define HMC_TRACE_CONCAT(a, b) HMC_TRACE_CONCAT_(a, b)
+
+/** Trace the rest of the enclosing block as a scope called `name`, a string literal. */
+#if defined(HMC5883L_SMALL)
+#define HMC_TRACE_SCOPE(name)
+#else
+#define HMC_TRACE_SCOPE(name) HMCTraceScope HMC_TRACE_CONCAT(hmc_trace_scope_, __LINE__)(name)
+#endif
+
+#endif
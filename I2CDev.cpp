@@ -11,6 +11,7 @@ This code is released under a Creative Commons Attribution 4.0 International lic
 
 #include <Wire.h>
 #include <I2CDev.h>
+#include <HMCTrace.h>
 
 I2CDev::I2CDev(uint8_t address) {
     /** I2C device class constructor
@@ -42,6 +43,7 @@ uint8_t I2CDev::write_data(uint8_t register_addr, uint8_t data) {
             - \c `EC_NACK_DATA`: Received NACK on transmit of data.
             - \c `EC_I2C_OTHER`: Other I2C error.
     */
+    HMC_TRACE_SCOPE("I2CDev::write_data");
 
     Wire.beginTransmission(dev_addr);
     Wire.write(register_addr);
@@ -50,6 +52,30 @@ uint8_t I2CDev::write_data(uint8_t register_addr, uint8_t data) {
     return err_code;
 }
 
+uint8_t I2CDev::write_data(uint8_t register_addr, const uint8_t *data, uint8_t length) {
+    /** Writes `length` bytes to consecutive registers, starting at `register_addr`.
+
+    The bytes are sent in a single transaction, relying on the device incrementing its register
+    pointer after each byte.
+
+    @param register_addr The address of the first register to write.
+    @param data The data to write, `length` bytes.
+    @param length The number of bytes to write.
+
+    @return Returns 0 on no error, otherwise returns the same I2C errors as the single-byte
+            `write_data()`.
+    */
+    HMC_TRACE_SCOPE("I2CDev::write_data");
+
+    Wire.beginTransmission(dev_addr);
+    Wire.write(register_addr);
+    for (uint8_t i = 0; i < length; i++) {
+        Wire.write(data[i]);
+    }
+    err_code = Wire.endTransmission();
+    return err_code;
+}
+
 uint8_t *I2CDev::read_data(uint8_t register_addr, uint8_t length) {
     /** Reads data of length `length` from register  `register_addr`
     
@@ -65,13 +91,20 @@ uint8_t *I2CDev::read_data(uint8_t register_addr, uint8_t length) {
             error, this function returns a `NULL` pointer and sets `err_code` (query 
             `get_err_code()` to get the value of this variable) to one of the I2C errors:
             - \c `EC_NO_ERR`: No error.
-            - \c `EC_DATA_LONG`: Data too long to fit in transmit buffer
+            - \c `EC_DATA_LONG`: Data too long to fit in transmit buffer, or `length` is more
+                                 than `I2C_BUFFER_SIZE`.
             - \c `EC_NACK_ADDR`: Received NACK on transmit of address.
             - \c `EC_NACK_DATA`: Received NACK on transmit of data.
             - \c `EC_I2C_OTHER`: Other I2C error.
+
+            The returned array is owned by this object and is overwritten by the next read.
     */
+    HMC_TRACE_SCOPE("I2CDev::read_data");
 
-    uint8_t error = 0;
+    if (length > I2C_BUFFER_SIZE) {
+        err_code = EC_DATA_LONG;
+        return NULL;
+    }
 
     Wire.beginTransmission(dev_addr);
     Wire.write(register_addr);
@@ -88,10 +121,9 @@ uint8_t *I2CDev::read_data(uint8_t register_addr, uint8_t length) {
         return NULL;
     }
 
-    uint8_t buff[length];
     if(Wire.available() == length) {
         for(int i = 0; i < length; i++) {
-            buff[i] = Wire.read();
+            buffer[i] = Wire.read();
         }
     }
 
@@ -100,7 +132,7 @@ uint8_t *I2CDev::read_data(uint8_t register_addr, uint8_t length) {
         return NULL;
     }
 
-    return buff;
+    return buffer;
 }
 
 uint8_t I2CDev::read_data_byte(uint8_t register_addr) {
@@ -135,4 +167,56 @@ uint8_t I2CDev::get_err_code() {
     @return Returns the error code set in the current object. Non-zero value is an error.
     */
     return err_code;
-}
\ No newline at end of file
+}
+
+uint8_t I2CDev::unstick() {
+    /** Release a bus held by a slave which was reset or interrupted in the middle of a byte.
+
+    Such a slave holds SDA low until it has clocked out the rest of the byte, so the master can't
+    send a START. This takes the board's `SDA` and `SCL` pins from the Wire library, clocks SCL by
+    hand until SDA is released (at most `I2C_UNSTICK_CLOCKS` times), sends a STOP and restarts the
+    Wire library. Meant for `RetryDev`'s unstick hook (see `RetryDev::unstick_bus()`).
+
+    Only available on Arduino: elsewhere there's no access to the pins, and this always fails.
+
+    @return Returns `0` if SDA was released, otherwise `EC_I2C_OTHER`.
+    */
+    HMC_TRACE_SCOPE("I2CDev::unstick");
+
+#if defined(ARDUINO)
+    Wire.end();
+
+    // Both lines are open-drain: pull them low as outputs, release them as inputs.
+    pinMode(SDA, INPUT_PULLUP);
+    pinMode(SCL, INPUT_PULLUP);
+    delayMicroseconds(5);
+    for (uint8_t i = 0; i < I2C_UNSTICK_CLOCKS && digitalRead(SDA) == LOW; i++) {
+        pinMode(SCL, OUTPUT);
+        digitalWrite(SCL, LOW);
+        delayMicroseconds(5);
+        pinMode(SCL, INPUT_PULLUP);
+        delayMicroseconds(5);
+    }
+
+    bool released = digitalRead(SDA) == HIGH;
+
+    // STOP: SDA rises while SCL is high.
+    pinMode(SCL, OUTPUT);
+    digitalWrite(SCL, LOW);
+    pinMode(SDA, OUTPUT);
+    digitalWrite(SDA, LOW);
+    delayMicroseconds(5);
+    pinMode(SCL, INPUT_PULLUP);
+    delayMicroseconds(5);
+    pinMode(SDA, INPUT_PULLUP);
+    delayMicroseconds(5);
+
+    Wire.begin();
+
+    err_code = released ? EC_NO_ERR : EC_I2C_OTHER;
+#else
+    err_code = EC_I2C_OTHER;
+#endif
+
+    return err_code;
+}
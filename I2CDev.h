@@ -18,6 +18,19 @@ This code is released under a Creative Commons Attribution 4.0 International lic
 #define EC_I2C_OTHER 3
 #define EC_BAD_READ_SIZE 4
 
+/* Size of the buffer returned by `read_data()`, and so the longest possible read. The default
+   matches the Arduino Wire buffer; the `HMC5883L_SMALL` profile only needs the 6 data registers. */
+#ifndef I2C_BUFFER_SIZE
+#if defined(HMC5883L_SMALL)
+#define I2C_BUFFER_SIZE 6
+#else
+#define I2C_BUFFER_SIZE 32
+#endif
+#endif
+
+/* Most SCL clocks `unstick()` sends to make a slave release SDA: enough to finish any byte. */
+#define I2C_UNSTICK_CLOCKS 9
+
 class I2CDev {
 public:
     I2CDev() : err_code(0) {}
@@ -26,14 +39,18 @@ public:
     void start(void);
 
     uint8_t write_data(uint8_t register_addr, uint8_t data);
+    uint8_t write_data(uint8_t register_addr, const uint8_t *data, uint8_t length);
     uint8_t *read_data(uint8_t register_addr, uint8_t length);
     uint8_t read_data_byte(uint8_t register_addr);
 
     uint8_t get_err_code(void);
+
+    uint8_t unstick(void);
 private:
 
     uint8_t err_code;
     uint8_t dev_addr;
+    uint8_t buffer[I2C_BUFFER_SIZE];
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,591 @@
+/** @file
+Linux IIO backend, presenting the kernel hmc5843 driver as a register-level device.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#include <IIODev.h>
+#include <HMCTrace.h>
+#include <HMC5883L.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *channelNames[] = {"in_magn_x", "in_magn_y", "in_magn_z", "in_timestamp"};
+static const char *biasModes[] = {"normal", "positivebias", "negativebias"};
+
+IIODev::IIODev() : fd(-1), enabled(false), err_code(0) {
+    /** IIO device constructor, using the default sysfs directory and buffer device. */
+    strncpy(sysfs, IIODEV_SYSFS_DIR, IIODEV_PATH_MAX - 1);
+    strncpy(buffer_path, IIODEV_BUFFER_DEV, IIODEV_PATH_MAX - 1);
+    sysfs[IIODEV_PATH_MAX - 1] = buffer_path[IIODEV_PATH_MAX - 1] = '\0';
+}
+
+IIODev::IIODev(uint8_t address) : fd(-1), enabled(false), err_code(0) {
+    /** IIO device constructor, for compatibility with `I2CDev`.
+
+    The address is ignored - the device is identified by `IIODEV_SYSFS_DIR` and
+    `IIODEV_BUFFER_DEV`.
+    */
+    (void)address;
+    strncpy(sysfs, IIODEV_SYSFS_DIR, IIODEV_PATH_MAX - 1);
+    strncpy(buffer_path, IIODEV_BUFFER_DEV, IIODEV_PATH_MAX - 1);
+    sysfs[IIODEV_PATH_MAX - 1] = buffer_path[IIODEV_PATH_MAX - 1] = '\0';
+}
+
+IIODev::IIODev(const char *sysfs_dir, const char *buffer_dev)
+        : fd(-1), enabled(false), err_code(0) {
+    /** IIO device constructor.
+
+    @param[in] sysfs_dir The device's sysfs directory, e.g. `/sys/bus/iio/devices/iio:device0`,
+                         or `NULL` for `IIODEV_SYSFS_DIR`.
+    @param[in] buffer_dev The device's buffer character device, e.g. `/dev/iio:device0`, or
+                          `NULL` for `IIODEV_BUFFER_DEV`.
+    */
+    strncpy(sysfs, sysfs_dir != NULL ? sysfs_dir : IIODEV_SYSFS_DIR, IIODEV_PATH_MAX - 1);
+    strncpy(buffer_path, buffer_dev != NULL ? buffer_dev : IIODEV_BUFFER_DEV, IIODEV_PATH_MAX - 1);
+    sysfs[IIODEV_PATH_MAX - 1] = buffer_path[IIODEV_PATH_MAX - 1] = '\0';
+}
+
+IIODev::~IIODev() {
+    /** Close the buffer device and disable the kernel buffer, if `start()` enabled it. */
+    stop();
+    if (enabled) {
+        write_attr("buffer/enable", "0");
+    }
+}
+
+void IIODev::start() {
+    /** Enable the scan elements and the buffer, and open the buffer device.
+
+    Enables the x, y and z scan elements (and the timestamp, if the driver provides one), reads
+    their layout, enables the kernel buffer and opens the buffer device for non-blocking reads.
+    The emulated configuration registers are initialized from the current sysfs settings. On
+    failure, `err_code` is set to `EC_IIO_SYSFS` or `EC_IIO_BUFFER`.
+    */
+
+    err_code = EC_NO_ERR;
+    n_bytes = read_pos = 0;
+    timestamp = 0;
+    memset(registers, 0, sizeof(registers));
+    registers[10] = 'H';                // Identification registers A-C
+    registers[11] = '4';
+    registers[12] = '3';
+
+    // Changing the scan elements requires the buffer to be disabled.
+    stop();
+    write_attr("buffer/enable", "0");
+
+    for (uint8_t i = 0; i < 4; i++) {
+        if (setup_channel(channelNames[i], &channels[i]) && i < 3) {
+            err_code = EC_IIO_SYSFS;
+            return;
+        }
+    }
+
+    // Lay out the enabled elements in scan index order, each aligned to its own size.
+    scan_size = 0;
+    for (int8_t idx = 0; idx < 64; idx++) {
+        for (uint8_t i = 0; i < 4; i++) {
+            IIOChannel *ch = &channels[i];
+            if (!ch->enabled || ch->index != idx) {
+                continue;
+            }
+
+            scan_size = (scan_size + ch->storage - 1) / ch->storage * ch->storage;
+            ch->offset = scan_size;
+            scan_size += ch->storage;
+        }
+    }
+
+    // The whole scan is padded to the alignment of its largest element.
+    uint8_t largest = 1;
+    for (uint8_t i = 0; i < 4; i++) {
+        if (channels[i].enabled && channels[i].storage > largest) {
+            largest = channels[i].storage;
+        }
+    }
+    scan_size = (scan_size + largest - 1) / largest * largest;
+
+    if (scan_size == 0 || scan_size > IIODEV_MAX_SCAN_SIZE) {
+        err_code = EC_IIO_BUFFER;
+        return;
+    }
+
+    // Mirror the current driver settings into the emulated configuration registers.
+    int8_t rate = read_attr_choice("in_magn_sampling_frequency");
+    int8_t gain = read_attr_choice("in_magn_scale");
+    int8_t bias = -1;
+    char value[32];
+    if (!read_attr("in_magn_meas_conf", value, sizeof(value))) {
+        for (uint8_t i = 0; i < 3; i++) {
+            if (!strcmp(value, biasModes[i])) { bias = i; }
+        }
+    }
+
+    registers[ConfigRegisterA] = ((rate < 0 ? HMC_RATE1500 : rate) << 2) | (bias < 0 ? 0 : bias);
+    registers[ConfigRegisterB] = (gain < 0 ? HMC_GAIN130 : gain) << 5;
+    registers[ModeRegister] = HMC_MeasurementContinuous;
+
+    char length[8];
+    snprintf(length, sizeof(length), "%d", IIODEV_KERNEL_BUFFER);
+    write_attr("buffer/length", length);
+    if (write_attr("buffer/enable", "1")) {
+        err_code = EC_IIO_BUFFER;
+        return;
+    }
+    enabled = true;
+
+    fd = open(buffer_path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        err_code = EC_IIO_BUFFER;
+    }
+}
+
+void IIODev::stop() {
+    /** Close the buffer device. The kernel buffer is left enabled. */
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+uint8_t IIODev::write_data(uint8_t register_addr, uint8_t data) {
+    /** Write to an emulated register.
+
+    Changes to the gain, output rate and bias mode fields are written through to the driver's
+    sysfs attributes. Any write to either configuration register discards the buffered scans, so
+    the next data read is of a scan taken after the write. Writing `HMC_MeasurementSingle` to the
+    mode register makes the next data read return the mode to idle, as the device does.
+
+    @param register_addr The register address to write.
+    @param data The data to write to the specified address.
+
+    @return Returns 0 on no error, otherwise returns:
+            - \c `EC_NACK_ADDR`: The register is read-only or does not exist.
+            - \c `EC_IIO_SYSFS`: Writing a sysfs attribute failed.
+    */
+    HMC_TRACE_SCOPE("IIODev::write_data");
+
+    uint8_t old = registers[register_addr < IIODEV_N_REGISTERS ? register_addr : 0];
+
+    switch (register_addr) {
+        case ConfigRegisterA:
+            if ((data & 0x1c) != (old & 0x1c)) {
+                if (err_code = write_attr_choice("in_magn_sampling_frequency", (data >> 2) & 0x7)) {
+                    return err_code;
+                }
+            }
+
+            if ((data & 0x03) != (old & 0x03) && (data & 0x03) < 3) {
+                if (err_code = write_attr("in_magn_meas_conf", biasModes[data & 0x03])) {
+                    return err_code;
+                }
+            }
+            break;
+        case ConfigRegisterB:
+            if ((data & 0xe0) != (old & 0xe0)) {
+                if (err_code = write_attr_choice("in_magn_scale", data >> 5)) {
+                    return err_code;
+                }
+            }
+            break;
+        case ModeRegister:
+            break;
+        default:
+            err_code = EC_NACK_ADDR;
+            return err_code;
+    }
+
+    if (register_addr != ModeRegister) {
+        drain();
+    }
+
+    registers[register_addr] = data;
+    err_code = EC_NO_ERR;
+    return err_code;
+}
+
+uint8_t IIODev::write_data(uint8_t register_addr, const uint8_t *data, uint8_t length) {
+    /** Write `length` consecutive emulated registers, starting at `register_addr`. */
+    HMC_TRACE_SCOPE("IIODev::write_data");
+    for (uint8_t i = 0; i < length; i++) {
+        if (write_data(register_addr + i, data[i])) {
+            return err_code;
+        }
+    }
+
+    return err_code;
+}
+
+uint8_t *IIODev::read_data(uint8_t register_addr, uint8_t length) {
+    /** Reads `length` emulated registers starting at `register_addr`.
+
+    As on the device, the register pointer increments after each byte. Reading the status register
+    refreshes the RDY bit, and a read starting at the data registers first loads the newest scan
+    from the buffer, discarding any older ones.
+
+    @param[in] register_addr The address of the register to read from.
+    @param[in] length The number of registers to read.
+
+    @return On success, returns a pointer to an internal array of `length` bytes, valid until the
+            next call. On error, returns `NULL` and sets `err_code`:
+            - \c `EC_BAD_READ_SIZE`: The read runs past the end of the register map.
+            - \c `EC_IIO_BUFFER`: The buffer device could not be read.
+    */
+    HMC_TRACE_SCOPE("IIODev::read_data");
+
+    if (register_addr + length > IIODEV_N_REGISTERS) {
+        err_code = EC_BAD_READ_SIZE;
+        return NULL;
+    }
+
+    err_code = EC_NO_ERR;
+    if (register_addr == DataRegister || register_addr + length > StatusRegister) {
+        if (fd < 0) {
+            err_code = EC_IIO_BUFFER;
+            return NULL;
+        }
+
+        if (register_addr == DataRegister) {
+            skip_to_latest();
+        } else if (read_pos + scan_size > n_bytes) {
+            fill();
+        }
+
+        if (err_code) {
+            return NULL;
+        }
+
+        if (register_addr == DataRegister) {
+            pop_scan();
+        }
+
+        registers[StatusRegister] = (read_pos + scan_size <= n_bytes) ? 0x01 : 0x00;
+    }
+
+    memcpy(buffer, &registers[register_addr], length);
+    return buffer;
+}
+
+uint8_t IIODev::read_data_byte(uint8_t register_addr) {
+    /** Reads a single emulated register. Convenience wrapper for `read_data()`. */
+    uint8_t *rv = read_data(register_addr, 1);
+
+    if (rv == NULL) {
+        return 0;       // Err code set in read_data already.
+    }
+
+    return rv[0];
+}
+
+uint16_t IIODev::read_scans(int16_t *x, int16_t *y, int16_t *z, int64_t *timestamps,
+                            uint16_t max) {
+    /** Decode up to `max` buffered scans directly into structure-of-arrays output.
+
+    This bypasses the register emulation - the buffer device is read at most once per
+    `IIODEV_SCAN_BATCH` scans, and every available scan is decoded in a single pass. The last scan
+    decoded is also loaded into the data registers.
+
+    @param[out] x, y, z Arrays of at least `max` elements, receiving the raw counts.
+    @param[out] timestamps Array of at least `max` elements receiving the scan timestamps in ns,
+                           or `NULL`. Timestamps are 0 if the driver's timestamp is not enabled.
+    @param[in] max The maximum number of scans to decode.
+
+    @return Returns the number of scans decoded. On error, returns 0 and sets `err_code`.
+    */
+
+    err_code = EC_NO_ERR;
+    if (fd < 0) {
+        err_code = EC_IIO_BUFFER;
+        return 0;
+    }
+
+    uint16_t n = 0;
+    while (n < max) {
+        if (read_pos + scan_size > n_bytes && fill() == 0) {
+            break;
+        }
+
+        int16_t xyz[3];
+        int64_t ts;
+        decode_scan(&scans[read_pos], xyz, &ts);
+        read_pos += scan_size;
+
+        x[n] = xyz[0];
+        y[n] = xyz[1];
+        z[n] = xyz[2];
+        if (timestamps != NULL) {
+            timestamps[n] = ts;
+        }
+        n++;
+    }
+
+    if (n > 0) {
+        set_data(x[n - 1], y[n - 1], z[n - 1], timestamps != NULL ? timestamps[n - 1] : 0);
+    }
+
+    return err_code ? 0 : n;
+}
+
+int64_t IIODev::get_timestamp() {
+    /** Returns the kernel timestamp of the sample in the data registers, in ns (0 if unknown). */
+    return timestamp;
+}
+
+uint8_t IIODev::get_err_code() {
+    /** Retrieve the error code stored on the IIO device. See `I2CDev::get_err_code()`. */
+    return err_code;
+}
+
+uint8_t IIODev::write_attr(const char *name, const char *value) {
+    /** Write `value` to the sysfs attribute `name`. Returns `EC_IIO_SYSFS` on failure. */
+    char path[IIODEV_PATH_MAX * 2];
+    snprintf(path, sizeof(path), "%s/%s", sysfs, name);
+
+    int afd = open(path, O_WRONLY | O_TRUNC);
+    if (afd < 0) {
+        return EC_IIO_SYSFS;
+    }
+
+    size_t len = strlen(value);
+    ssize_t written = write(afd, value, len);
+    close(afd);
+
+    return (written == (ssize_t)len) ? EC_NO_ERR : EC_IIO_SYSFS;
+}
+
+uint8_t IIODev::read_attr(const char *name, char *value, uint16_t size) {
+    /** Read the sysfs attribute `name` into `value`, stripping the trailing newline. */
+    char path[IIODEV_PATH_MAX * 2];
+    snprintf(path, sizeof(path), "%s/%s", sysfs, name);
+
+    int afd = open(path, O_RDONLY);
+    if (afd < 0) {
+        return EC_IIO_SYSFS;
+    }
+
+    ssize_t n = read(afd, value, size - 1);
+    close(afd);
+    if (n < 0) {
+        return EC_IIO_SYSFS;
+    }
+
+    value[n] = '\0';
+    while (n > 0 && (value[n - 1] == '\n' || value[n - 1] == ' ')) {
+        value[--n] = '\0';
+    }
+
+    return EC_NO_ERR;
+}
+
+uint8_t IIODev::write_attr_choice(const char *name, uint8_t choice) {
+    /** Write the `choice`th entry of `<name>_available` to the attribute `name`.
+
+    The hmc5843 driver lists the available scales and sampling frequencies in register order, so
+    the register field value is the index into the list.
+    */
+    char available[IIODEV_PATH_MAX], attr[IIODEV_PATH_MAX];
+    snprintf(attr, sizeof(attr), "%s_available", name);
+    if (read_attr(attr, available, sizeof(available))) {
+        return EC_IIO_SYSFS;
+    }
+
+    char *save = NULL;
+    char *token = strtok_r(available, " ", &save);
+    for (uint8_t i = 0; token != NULL && i < choice; i++) {
+        token = strtok_r(NULL, " ", &save);
+    }
+
+    if (token == NULL) {
+        return EC_IIO_SYSFS;
+    }
+
+    return write_attr(name, token);
+}
+
+int8_t IIODev::read_attr_choice(const char *name) {
+    /** Return the index of the current value of `name` within `<name>_available`, or -1. */
+    char available[IIODEV_PATH_MAX], attr[IIODEV_PATH_MAX], value[32];
+    snprintf(attr, sizeof(attr), "%s_available", name);
+    if (read_attr(attr, available, sizeof(available)) || read_attr(name, value, sizeof(value))) {
+        return -1;
+    }
+
+    double current = atof(value);
+    char *save = NULL;
+    char *token = strtok_r(available, " ", &save);
+    for (int8_t i = 0; token != NULL; i++) {
+        double choice = atof(token);
+        if (choice - current < 1e-9 && current - choice < 1e-9) {
+            return i;
+        }
+        token = strtok_r(NULL, " ", &save);
+    }
+
+    return -1;
+}
+
+uint8_t IIODev::setup_channel(const char *name, IIOChannel *channel) {
+    /** Enable the scan element `name` and read its index and type.
+
+    The type has the form `[be|le]:[s|u]bits/storagebits>>shift`, see the kernel's
+    `sysfs-bus-iio` ABI documentation.
+    */
+    char attr[IIODEV_PATH_MAX], value[32];
+    channel->enabled = false;
+
+    snprintf(attr, sizeof(attr), "scan_elements/%s_en", name);
+    if (write_attr(attr, "1")) {
+        return EC_IIO_SYSFS;
+    }
+
+    snprintf(attr, sizeof(attr), "scan_elements/%s_index", name);
+    if (read_attr(attr, value, sizeof(value))) {
+        return EC_IIO_SYSFS;
+    }
+    channel->index = atoi(value);
+
+    snprintf(attr, sizeof(attr), "scan_elements/%s_type", name);
+    if (read_attr(attr, value, sizeof(value))) {
+        return EC_IIO_SYSFS;
+    }
+
+    char endian, sign;
+    unsigned bits, storage, shift = 0;
+    if (sscanf(value, "%ce:%c%u/%u>>%u", &endian, &sign, &bits, &storage, &shift) < 4) {
+        return EC_IIO_SYSFS;
+    }
+
+    if (storage != 16 && storage != 32 && storage != 64) {
+        return EC_IIO_SYSFS;
+    }
+
+    channel->big_endian = (endian == 'b');
+    channel->is_signed = (sign == 's');
+    channel->bits = bits;
+    channel->storage = storage / 8;
+    channel->shift = shift;
+    channel->enabled = true;
+
+    return EC_NO_ERR;
+}
+
+uint16_t IIODev::fill() {
+    /** Fetch as many scans as are available (up to `IIODEV_SCAN_BATCH`) with one `read()`.
+
+    Any partial scan left over from the previous read is kept at the front of the buffer.
+
+    @return Returns the number of complete scans now waiting to be decoded. Sets `err_code` to
+            `EC_IIO_BUFFER` if the read fails for any reason other than no data being available.
+    */
+    uint16_t leftover = n_bytes - read_pos;
+    memmove(scans, &scans[read_pos], leftover);
+    n_bytes = leftover;
+    read_pos = 0;
+
+    uint16_t capacity = IIODEV_SCAN_BATCH * scan_size;
+    ssize_t n = read(fd, &scans[n_bytes], capacity - n_bytes);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            err_code = EC_IIO_BUFFER;
+        }
+        return n_bytes / scan_size;
+    }
+
+    n_bytes += n;
+    return n_bytes / scan_size;
+}
+
+void IIODev::drain() {
+    /** Discard every scan buffered so far, both here and in the kernel. */
+    if (fd < 0) {
+        return;
+    }
+
+    n_bytes = read_pos = 0;
+    while (read(fd, scans, IIODEV_SCAN_BATCH * scan_size) > 0) {}
+}
+
+void IIODev::skip_to_latest() {
+    /** Fetch every scan the kernel has buffered, keeping only the newest complete one (and any
+    partial scan after it) waiting to be decoded. */
+    do {
+        uint16_t waiting = (n_bytes - read_pos) / scan_size;
+        if (waiting > 1) {
+            read_pos += (waiting - 1) * scan_size;
+        }
+    } while (fill() > 1 && !err_code);
+}
+
+void IIODev::decode_scan(const uint8_t *scan, int16_t *xyz, int64_t *ts) {
+    /** Decode the x, y and z counts and the timestamp from a single raw scan. */
+    for (uint8_t i = 0; i < 4; i++) {
+        const IIOChannel *ch = &channels[i];
+        if (!ch->enabled) {
+            if (i == 3) { *ts = 0; }
+            continue;
+        }
+
+        const uint8_t *p = &scan[ch->offset];
+        uint64_t v = 0;
+        for (uint8_t b = 0; b < ch->storage; b++) {
+            uint8_t byte = ch->big_endian ? p[b] : p[ch->storage - 1 - b];
+            v = (v << 8) | byte;
+        }
+
+        v >>= ch->shift;
+        if (ch->bits < 64) {
+            v &= ((uint64_t)1 << ch->bits) - 1;
+            if (ch->is_signed && (v & ((uint64_t)1 << (ch->bits - 1)))) {
+                v |= ~(((uint64_t)1 << ch->bits) - 1);         // Sign extend
+            }
+        }
+
+        if (i == 3) {
+            *ts = (int64_t)v;
+        } else {
+            xyz[i] = (int16_t)(int64_t)v;
+        }
+    }
+}
+
+void IIODev::pop_scan() {
+    /** Move the next decoded scan (if any) into the data registers. */
+    if (read_pos + scan_size > n_bytes) {
+        return;             // No new data - the data registers keep the last sample.
+    }
+
+    int16_t xyz[3];
+    int64_t ts;
+    decode_scan(&scans[read_pos], xyz, &ts);
+    read_pos += scan_size;
+
+    set_data(xyz[0], xyz[1], xyz[2], ts);
+}
+
+void IIODev::set_data(int16_t x, int16_t y, int16_t z, int64_t ts) {
+    /** Load a sample into the emulated data registers. */
+    timestamp = ts;
+
+    // Register order is X, Z, Y, each big-endian.
+    uint8_t *data = &registers[DataRegister];
+    data[0] = (uint16_t)x >> 8;
+    data[1] = x & 0xff;
+    data[2] = (uint16_t)z >> 8;
+    data[3] = z & 0xff;
+    data[4] = (uint16_t)y >> 8;
+    data[5] = y & 0xff;
+
+    // A single measurement returns the device to idle once it has been read.
+    if ((registers[ModeRegister] & 0x3) == HMC_MeasurementSingle) {
+        registers[ModeRegister] = (registers[ModeRegister] & ~0x3) | HMC_MeasurementIdle;
+    }
+}
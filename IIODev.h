@@ -0,0 +1,124 @@
+/** @file
+Linux IIO backend, presenting the kernel hmc5843 driver as a register-level device.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#ifndef IIODEV_H
+#define IIODEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <I2CDev.h>
+
+#define EC_IIO_SYSFS 5              /*!< Failed to read or write an IIO sysfs attribute. */
+#define EC_IIO_BUFFER 6             /*!< Failed to set up or read from the IIO buffer device. */
+
+/** @defgroup IIOConstants IIO backend constants
+@{ */
+#define IIODEV_SYSFS_DIR "/sys/bus/iio/devices/iio:device0"    /*!< Default sysfs directory */
+#define IIODEV_BUFFER_DEV "/dev/iio:device0"                   /*!< Default buffer device */
+#define IIODEV_PATH_MAX 128         /*!< Maximum length of the sysfs and device paths */
+#define IIODEV_KERNEL_BUFFER 128    /*!< Length of the kernel buffer, in scans */
+#define IIODEV_SCAN_BATCH 64        /*!< Maximum number of scans fetched per `read()` */
+#define IIODEV_MAX_SCAN_SIZE 32     /*!< Maximum size of a single scan, in bytes */
+#define IIODEV_N_REGISTERS 13       /*!< Number of emulated HMC5883L registers */
+/** @} */
+
+struct IIOChannel {
+    /** Layout of one scan element within an IIO buffer scan. */
+    bool enabled;
+    bool is_signed;
+    bool big_endian;
+    uint8_t bits;                      /*!< Number of valid bits. */
+    uint8_t storage;                   /*!< Storage size, in bytes. */
+    uint8_t shift;                     /*!< Right shift applied to the stored value. */
+    uint8_t offset;                    /*!< Byte offset of the element within the scan. */
+    int8_t index;                      /*!< Scan index reported by the kernel. */
+};
+
+class IIODev {
+    /** IIO buffer backend with the same interface as `I2CDev`.
+
+    When the kernel hmc5843 driver owns the HMC5883L, the registers can't be reached over I2C. This
+    class emulates the HMC5883L register map on top of the driver's IIO interface, so the
+    `HMC5883L` class works unchanged when built with `HMC5883L_USE_IIO` defined:
+
+      - Writes to the gain bits of Configuration Register B set `in_magn_scale`, writes to the
+        output rate and bias bits of Configuration Register A set `in_magn_sampling_frequency` and
+        `in_magn_meas_conf`. The other bits are kept in the emulated registers. Every write to
+        either register discards the scans buffered so far, which were taken at the old settings.
+      - Reads from the data registers return the newest scan from the buffer device, discarding
+        any older ones, since the device's data registers only ever hold the latest measurement.
+        Scans are read from the kernel in batches of up to `IIODEV_SCAN_BATCH` with a single
+        `read()`, so there is no per-sample system call. If no new scan is available, the last
+        sample is returned again, as the device would.
+      - The RDY bit of the status register is set while decoded scans are waiting to be read.
+
+    Bulk consumers can skip the register emulation entirely with `read_scans()`.
+
+    The sysfs directory and buffer device are configurable, so the backend can be run against a
+    fake sysfs tree and a FIFO standing in for the buffer device. A trigger must already be
+    assigned to the device (`trigger/current_trigger`) before `start()` is called. The buffer is
+    disabled again and the buffer device closed on destruction, so an `IIODev` can't be copied:
+    construct it in place, e.g. with `HMC5883L(sysfs_dir, buffer_dev)`.
+    */
+public:
+    IIODev();
+    IIODev(uint8_t address);
+    IIODev(const char *sysfs_dir, const char *buffer_dev);
+    ~IIODev();
+
+    void start(void);
+    void stop(void);
+
+    uint8_t write_data(uint8_t register_addr, uint8_t data);
+    uint8_t write_data(uint8_t register_addr, const uint8_t *data, uint8_t length);
+    uint8_t *read_data(uint8_t register_addr, uint8_t length);
+    uint8_t read_data_byte(uint8_t register_addr);
+
+    uint16_t read_scans(int16_t *x, int16_t *y, int16_t *z, int64_t *timestamps, uint16_t max);
+    int64_t get_timestamp(void);
+
+    uint8_t get_err_code(void);
+private:
+    IIODev(const IIODev &);            // Not copyable: declared, never defined.
+    IIODev &operator=(const IIODev &);
+
+    uint8_t write_attr(const char *name, const char *value);
+    uint8_t read_attr(const char *name, char *value, uint16_t size);
+    uint8_t write_attr_choice(const char *name, uint8_t choice);
+    int8_t read_attr_choice(const char *name);
+    uint8_t setup_channel(const char *name, IIOChannel *channel);
+
+    uint16_t fill(void);
+    void drain(void);
+    void skip_to_latest(void);
+    void decode_scan(const uint8_t *scan, int16_t *xyz, int64_t *timestamp);
+    void pop_scan(void);
+    void set_data(int16_t x, int16_t y, int16_t z, int64_t ts);
+
+    char sysfs[IIODEV_PATH_MAX];       /*!< The device's sysfs directory */
+    char buffer_path[IIODEV_PATH_MAX]; /*!< The buffer character device */
+    int fd;                            /*!< File descriptor of the buffer device, or -1 */
+    bool enabled;                      /*!< Whether `start()` enabled the kernel buffer */
+
+    IIOChannel channels[4];            /*!< x, y, z and timestamp scan elements */
+    uint8_t scan_size;
+
+    uint8_t scans[IIODEV_SCAN_BATCH * IIODEV_MAX_SCAN_SIZE];   /*!< Raw scans from the kernel */
+    uint16_t n_bytes;                  /*!< Bytes of valid data in `scans` */
+    uint16_t read_pos;                 /*!< Byte offset of the next scan to decode */
+
+    uint8_t registers[IIODEV_N_REGISTERS];  /*!< The emulated register map */
+    uint8_t buffer[IIODEV_N_REGISTERS];     /*!< Returned by `read_data()` */
+    int64_t timestamp;                 /*!< Timestamp of the sample in the data registers */
+
+    uint8_t err_code;
+};
+
+#endif
@@ -0,0 +1,227 @@
+/** @file
+Streaming resampler that aligns timestamped magnetometer samples to a fixed-rate or externally
+supplied output timeline.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <Resampler.h>
+#include <Vec3.h>
+#include <Vec3Block.h>
+
+Resampler::Resampler(uint8_t interp_method) {
+    /** Constructor for the resampler.
+
+    @param[in] interp_method `RESAMPLE_LINEAR` (default) or `RESAMPLE_CUBIC`.
+    */
+    method = interp_method;
+    period = 0;
+    next_out = 0;
+    reset();
+}
+
+void Resampler::reset() {
+    /** Discard all retained input. The output rate, if set, is kept. */
+    count = 0;
+}
+
+void Resampler::setOutputRate(uint32_t period_us, uint32_t start_us) {
+    /** Set up a fixed-rate output timeline for `pull()` and `processBlock()`.
+
+    @param[in] period_us The time between output samples, in microseconds, e.g. 5000 for 200 Hz.
+    @param[in] start_us The time of the first output sample. Outputs which fall before the first
+                        input sample are skipped, so any time in the past is fine.
+    */
+    period = period_us;
+    next_out = start_us;
+}
+
+void Resampler::push(uint32_t t_us, Vec3<float> value) {
+    /** Add an input sample.
+
+    Samples must be pushed in timestamp order - a sample which is not newer than the last one is
+    dropped.
+    */
+    const uint8_t last = RESAMPLE_HISTORY - 1;
+    if (count > 0 && (int32_t)(t_us - t[last]) <= 0) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < last; i++) {
+        t[i] = t[i + 1];
+        x[i] = x[i + 1];
+        y[i] = y[i + 1];
+        z[i] = z[i + 1];
+    }
+
+    t[last] = t_us;
+    x[last] = value.x;
+    y[last] = value.y;
+    z[last] = value.z;
+
+    if (count < RESAMPLE_HISTORY) {
+        count++;
+    }
+}
+
+uint8_t Resampler::sample(uint32_t t_us, Vec3<float> *out) {
+    /** Interpolate the input at an arbitrary time.
+
+    @param[in] t_us The time to interpolate at, in microseconds.
+    @param[out] out The interpolated value, only written on `RESAMPLE_READY`.
+
+    @return Returns `RESAMPLE_READY` if `out` was written, `RESAMPLE_WAIT` if more input is needed
+            first, or `RESAMPLE_LATE` if `t_us` is older than the retained input.
+    */
+
+    if (count < 2) {
+        return RESAMPLE_WAIT;
+    }
+
+    uint8_t first = RESAMPLE_HISTORY - count;
+    if ((int32_t)(t_us - t[first]) < 0) {
+        return RESAMPLE_LATE;
+    }
+
+    // The cubic spline over [t[i], t[i + 1]] also needs t[i + 2] for its second tangent.
+    int8_t last = RESAMPLE_HISTORY - (method == RESAMPLE_CUBIC ? 3 : 2);
+    uint8_t i = first;
+    while ((int8_t)i <= last && (int32_t)(t_us - t[i + 1]) > 0) {
+        i++;
+    }
+
+    if ((int8_t)i > last) {
+        return RESAMPLE_WAIT;
+    }
+
+    out->x = interpolate(x, i, t_us);
+    out->y = interpolate(y, i, t_us);
+    out->z = interpolate(z, i, t_us);
+
+    return RESAMPLE_READY;
+}
+
+bool Resampler::pull(uint32_t *t_us, Vec3<float> *out) {
+    /** Produce the next sample on the fixed-rate output timeline, if it is available yet.
+
+    @param[out] t_us The time of the output sample.
+    @param[out] out The output value.
+
+    @return Returns `true` if a sample was produced, `false` if more input is needed (or no output
+            rate has been set).
+    */
+
+    if (period == 0) {
+        return false;
+    }
+
+    uint8_t rv = sample(next_out, out);
+    if (rv == RESAMPLE_LATE) {
+        // Skip ahead to the first output time covered by the retained input.
+        uint32_t behind = t[RESAMPLE_HISTORY - count] - next_out;
+        next_out += ((behind + period - 1) / period) * period;
+        rv = sample(next_out, out);
+    }
+
+    if (rv != RESAMPLE_READY) {
+        return false;
+    }
+
+    *t_us = next_out;
+    next_out += period;
+    return true;
+}
+
+uint16_t Resampler::processBlock(const uint32_t *t_in, Vec3Block<float> in, uint32_t *t_out,
+                                 Vec3Block<float> *out, uint16_t max_out) {
+    /** Resample a block of input onto the fixed-rate output timeline.
+
+    Every output sample which becomes available while pushing the block is written out.
+
+    @param[in] t_in The timestamps of the input samples, `in.length` of them.
+    @param[in] in The input block.
+    @param[out] t_out Receives the times of the output samples.
+    @param[out] out The output block. Its `length` is set to the number of output samples.
+    @param[in] max_out The room in `t_out` and `out`. This should be at least
+                       `in.length * output_rate / input_rate + 2` - once it is full the rest of
+                       the block is still pushed, but the outputs it covers are skipped.
+
+    @return Returns the number of output samples.
+    */
+
+    uint16_t n = 0;
+    Vec3<float> v;
+    for (uint16_t i = 0; i < in.length; i++) {
+        push(t_in[i], in.get(i));
+        while (n < max_out && pull(&t_out[n], &v)) {
+            out->set(n++, v);
+        }
+    }
+
+    out->length = n;
+    return n;
+}
+
+uint16_t Resampler::sampleBlock(const uint32_t *t_in, Vec3Block<float> in, const uint32_t *t_out,
+                                Vec3Block<float> *out, uint16_t n_out) {
+    /** Resample a block of input at externally supplied times.
+
+    @param[in] t_in The timestamps of the input samples, `in.length` of them.
+    @param[in] in The input block.
+    @param[in] t_out The times to produce output at, in increasing order, `n_out` of them.
+    @param[out] out The output block, with room for `n_out` samples. Its `length` is set to the
+                    number of output samples.
+    @param[in] n_out The number of requested output times.
+
+    @return Returns the number of output samples written, which are for `t_out[0]` onwards. Times
+            not yet covered by the input should be requested again with the next block. A time
+            older than the retained input is given the oldest retained value.
+    */
+
+    uint16_t n = 0;
+    Vec3<float> v;
+    for (uint16_t i = 0; i <= in.length && n < n_out; i++) {
+        // Drain whatever the input so far covers before pushing the next sample.
+        uint8_t rv;
+        while (n < n_out && (rv = sample(t_out[n], &v)) != RESAMPLE_WAIT) {
+            if (rv == RESAMPLE_LATE) {
+                uint8_t first = RESAMPLE_HISTORY - count;
+                v = Vec3<float>(x[first], y[first], z[first]);
+            }
+            out->set(n++, v);
+        }
+
+        if (i < in.length) {
+            push(t_in[i], in.get(i));
+        }
+    }
+
+    out->length = n;
+    return n;
+}
+
+float Resampler::interpolate(const float *v, uint8_t i, uint32_t t_us) {
+    /** Interpolate one axis over the interval between samples `i` and `i + 1`. */
+    float dt = (float)(t[i + 1] - t[i]);
+    float u = (float)(t_us - t[i]) / dt;
+
+    if (method != RESAMPLE_CUBIC) {
+        return v[i] + u * (v[i + 1] - v[i]);
+    }
+
+    // Tangents are central differences over the neighbouring samples, scaled to the interval so
+    // uneven spacing doesn't distort the curve. The first interval uses a one-sided difference.
+    float m0;
+    if (i > RESAMPLE_HISTORY - count) {
+        m0 = (v[i + 1] - v[i - 1]) * dt / (float)(t[i + 1] - t[i - 1]);
+    } else {
+        m0 = v[i + 1] - v[i];
+    }
+    float m1 = (v[i + 2] - v[i]) * dt / (float)(t[i + 2] - t[i]);
+
+    float u2 = u * u;
+    float u3 = u2 * u;
+    return (2 * u3 - 3 * u2 + 1) * v[i] + (u3 - 2 * u2 + u) * m0
+         + (3 * u2 - 2 * u3) * v[i + 1] + (u3 - u2) * m1;
+}
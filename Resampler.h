@@ -0,0 +1,78 @@
+/** @file
+Streaming resampler that aligns timestamped magnetometer samples to a fixed-rate or externally
+supplied output timeline.
+
+Input samples arrive with their own (possibly jittering, possibly irregular) timestamps, and
+output values are interpolated at the requested times - either linearly, or with a cubic Hermite
+spline whose tangents are taken from the neighbouring samples (Catmull-Rom, generalized to uneven
+sample spacing). Only the last `RESAMPLE_HISTORY` input samples are kept, so memory use is
+constant, and the lookahead is bounded: a linear output at time `t` is available as soon as the
+first input sample at or after `t` has arrived, a cubic one needs one input sample beyond that.
+
+Timestamps are `uint32_t` microseconds (e.g. `hmc_micros()`), and are compared by signed
+difference, so they may wrap around.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <Vec3.h>
+#include <Vec3Block.h>
+
+/** @defgroup ResamplerConstants Resampler constants
+@{ */
+#define RESAMPLE_LINEAR 0           /*!< Linear interpolation between the bracketing samples */
+#define RESAMPLE_CUBIC 1            /*!< Cubic Hermite (Catmull-Rom) interpolation */
+
+#define RESAMPLE_HISTORY 4          /*!< Input samples kept for interpolation */
+
+#define RESAMPLE_READY 0            /*!< The output value was written */
+#define RESAMPLE_WAIT 1             /*!< More input is needed before this time can be produced */
+#define RESAMPLE_LATE 2             /*!< The time is older than the retained input history */
+/** @} */
+
+class Resampler {
+    /** Resamples a stream of timestamped 3-vectors.
+
+    Push input samples with `push()`, in timestamp order. Outputs can then be taken either on a
+    fixed-rate timeline set up with `setOutputRate()` (`pull()`), or at arbitrary times supplied
+    by the caller, e.g. the timestamps of another sensor (`sample()`). Both have batch equivalents
+    over structure-of-arrays `Vec3Block`s, which interleave pushing and producing so that blocks
+    of any length can be processed with the fixed-size history.
+
+    Producing outputs never consumes input, so one resampler can serve several consumers on the
+    same timeline, as long as they don't fall behind the retained history.
+    */
+public:
+    Resampler(uint8_t method=RESAMPLE_LINEAR);
+
+    void reset(void);
+    void setOutputRate(uint32_t period_us, uint32_t start_us);
+
+    void push(uint32_t t_us, Vec3<float> value);
+    uint8_t sample(uint32_t t_us, Vec3<float> *out);
+    bool pull(uint32_t *t_us, Vec3<float> *out);
+
+    uint16_t processBlock(const uint32_t *t_in, Vec3Block<float> in, uint32_t *t_out,
+                          Vec3Block<float> *out, uint16_t max_out);
+    uint16_t sampleBlock(const uint32_t *t_in, Vec3Block<float> in, const uint32_t *t_out,
+                         Vec3Block<float> *out, uint16_t n_out);
+
+    uint8_t method;                    /*!< `RESAMPLE_LINEAR` or `RESAMPLE_CUBIC` */
+
+private:
+    float interpolate(const float *v, uint8_t i, uint32_t t_us);
+
+    // Retained input, oldest first; the newest sample is always at index RESAMPLE_HISTORY - 1.
+    uint32_t t[RESAMPLE_HISTORY];
+    float x[RESAMPLE_HISTORY], y[RESAMPLE_HISTORY], z[RESAMPLE_HISTORY];
+    uint8_t count;
+
+    uint32_t period;                   /*!< Fixed-rate output period, or 0 if not set. */
+    uint32_t next_out;                 /*!< Time of the next fixed-rate output. */
+};
+
+#endif
@@ -0,0 +1,202 @@
+/** @file
+Retrying wrapper around a register-level transport, with backoff, bus unsticking and a policy per
+error class.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#ifndef RETRYDEV_H
+#define RETRYDEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <I2CDev.h>
+#include <unistd.h>
+
+/** @defgroup RetryConstants Retry constants
+@{ */
+#define RETRY_N_CLASSES 8           /*!< Error codes 1 to 7 can each have their own policy */
+#define RETRY_DEFAULT_COUNT 3       /*!< Default number of retries */
+#define RETRY_DEFAULT_BACKOFF_US 100    /*!< Default delay before the first retry, in µs */
+/** @} */
+
+struct RetryPolicy {
+    /** How to handle one class of transport error. */
+    uint8_t retries;                   /*!< Number of retries after the first failure. */
+    uint16_t backoff_us;               /*!< Delay before the first retry, doubled for each retry. */
+    bool unstick;                      /*!< Call the unstick hook before retrying. */
+};
+
+template<typename Bus> class RetryDev {
+    /** Transport with the same interface as `Bus` (e.g. `I2CDev`), which retries failed
+    transactions.
+
+    Every transaction is retried up to the policy's number of times for its error code, with
+    exponential backoff. By default NACKs, short reads and other bus errors are retried
+    `RETRY_DEFAULT_COUNT` times, other bus errors also calling the unstick hook first; errors which
+    can't go away by themselves (e.g. `EC_DATA_LONG`) are not retried.
+
+    Retrying a whole transaction is safe for the HMC5883L, though its reads do have side effects.
+    Each transaction sets the register pointer itself, so it doesn't matter where a failed one left
+    it. Register writes are idempotent (rewriting single measurement mode only restarts the
+    measurement). A read which stops partway through the data registers sets LOCK, freezing them,
+    but the library always reads them as one 6-byte read from `DataRegister`: the retry reads all
+    six frozen registers, so it returns a single measurement rather than parts of two, and clears
+    LOCK again.
+
+    The unstick hook is how a transport that is able to recover a hung bus does so - e.g. by
+    switching SCL to a GPIO and clocking it until the slave releases SDA. It is passed the wrapped
+    transport. `I2CDev::unstick()` does this on Arduino and `SimI2CDev::unstick()` in simulation,
+    and `unstick_bus()` adapts either to a hook. `IIODev` has none: the kernel owns the bus.
+
+    Build with `HMC5883L_USE_RETRY` defined to wrap the `HMC5883L` class's transport.
+    */
+public:
+    typedef uint8_t (*UnstickHook)(Bus &bus, void *ctx);
+
+    RetryDev() { init(); }
+    RetryDev(uint8_t address) : bus(address) { init(); }
+    RetryDev(const Bus &device) : bus(device) { init(); }
+    template<typename A, typename B> RetryDev(A a, B b) : bus(a, b) {
+        /** Construct the wrapped transport in place, from two arguments (e.g. an `IIODev`'s
+        paths). */
+        init();
+    }
+
+    void start(void) {
+        /** Start communication with the device. */
+        bus.start();
+    }
+
+    uint8_t write_data(uint8_t register_addr, uint8_t data) {
+        /** Write a single register, retrying on failure. See `I2CDev::write_data()`. */
+        for (uint8_t attempt = 0; ; attempt++) {
+            if (!should_retry(bus.write_data(register_addr, data), attempt)) {
+                return err_code;
+            }
+        }
+    }
+
+    uint8_t write_data(uint8_t register_addr, const uint8_t *data, uint8_t length) {
+        /** Write consecutive registers, retrying on failure. See `I2CDev::write_data()`. */
+        for (uint8_t attempt = 0; ; attempt++) {
+            if (!should_retry(bus.write_data(register_addr, data, length), attempt)) {
+                return err_code;
+            }
+        }
+    }
+
+    uint8_t *read_data(uint8_t register_addr, uint8_t length) {
+        /** Read consecutive registers, retrying on failure. See `I2CDev::read_data()`. */
+        for (uint8_t attempt = 0; ; attempt++) {
+            uint8_t *data = bus.read_data(register_addr, length);
+            if (!should_retry(bus.get_err_code(), attempt)) {
+                return err_code ? NULL : data;
+            }
+        }
+    }
+
+    uint8_t read_data_byte(uint8_t register_addr) {
+        /** Read a single register, retrying on failure. Returns 0 on error. */
+        uint8_t *data = read_data(register_addr, 1);
+        return data != NULL ? data[0] : 0;
+    }
+
+    uint8_t get_err_code(void) {
+        /** Returns the error code of the last transaction, after any retries. */
+        return err_code;
+    }
+
+    void set_policy(uint8_t error, uint8_t retries, uint16_t backoff_us, bool unstick) {
+        /** Set the policy for one error code (1 to `RETRY_N_CLASSES - 1`). */
+        if (error > 0 && error < RETRY_N_CLASSES) {
+            policies[error].retries = retries;
+            policies[error].backoff_us = backoff_us;
+            policies[error].unstick = unstick;
+        }
+    }
+
+    void set_unstick(UnstickHook hook, void *ctx) {
+        /** Set the function called to recover a hung bus, for policies with `unstick` set. */
+        unstick_hook = hook;
+        unstick_ctx = ctx;
+    }
+
+    static uint8_t unstick_bus(Bus &bus, void *ctx) {
+        /** Unstick hook calling the transport's own `unstick()`, for transports which have one:
+        `set_unstick(RetryDev<I2CDev>::unstick_bus, NULL)`. */
+        return bus.unstick();
+    }
+
+    Bus &get_bus(void) {
+        /** Returns the wrapped transport. */
+        return bus;
+    }
+
+    uint32_t get_retries(void) {
+        /** Returns the total number of retries made. */
+        return retries;
+    }
+
+    uint32_t get_failures(void) {
+        /** Returns the number of transactions which failed even after retrying. */
+        return failures;
+    }
+
+private:
+    void init(void) {
+        err_code = 0;
+        retries = failures = 0;
+        unstick_hook = NULL;
+        unstick_ctx = NULL;
+        for (uint8_t i = 0; i < RETRY_N_CLASSES; i++) {
+            policies[i].retries = 0;
+            policies[i].backoff_us = 0;
+            policies[i].unstick = false;
+        }
+
+        set_policy(EC_NACK_ADDR, RETRY_DEFAULT_COUNT, RETRY_DEFAULT_BACKOFF_US, false);
+        set_policy(EC_I2C_OTHER, RETRY_DEFAULT_COUNT, RETRY_DEFAULT_BACKOFF_US, true);
+        set_policy(EC_BAD_READ_SIZE, RETRY_DEFAULT_COUNT, RETRY_DEFAULT_BACKOFF_US, false);
+    }
+
+    bool should_retry(uint8_t error, uint8_t attempt) {
+        /** Record the result of an attempt, and back off if it should be retried. */
+        err_code = error;
+        if (!error) {
+            return false;
+        }
+
+        RetryPolicy *p = error < RETRY_N_CLASSES ? &policies[error] : NULL;
+        if (p == NULL || attempt >= p->retries) {
+            failures++;
+            return false;
+        }
+
+        if (p->unstick && unstick_hook != NULL) {
+            unstick_hook(bus, unstick_ctx);
+        }
+
+        if (p->backoff_us) {
+            usleep((uint32_t)p->backoff_us << attempt);
+        }
+
+        retries++;
+        return true;
+    }
+
+    Bus bus;
+    RetryPolicy policies[RETRY_N_CLASSES];
+    UnstickHook unstick_hook;
+    void *unstick_ctx;
+
+    uint8_t err_code;
+    uint32_t retries;
+    uint32_t failures;
+};
+
+#endif
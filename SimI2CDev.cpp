@@ -0,0 +1,331 @@
+/** @file
+Simulated HMC5883L on a simulated I2C bus, with fault injection.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#include <SimI2CDev.h>
+#include <HMCTrace.h>
+#include <HMCTime.h>
+#include <HMC5883L.h>
+#include <Vec3.h>
+#include <string.h>
+
+SimI2CDev::SimI2CDev() : dev_addr(HMC5883L_ADDR) {
+    /** Simulated device constructor. The field starts at a plausible Earth field. */
+    field = Vec3<float>(200.0, -100.0, 400.0);
+    bus_hz = SIM_BUS_HZ;
+    rng = 1;
+    stuck = false;
+    stuck_left = 0;
+    transactions = n_faults = 0;
+    bus_time_ns = 0;
+    err_code = 0;
+    reset_device();
+}
+
+SimI2CDev::SimI2CDev(uint8_t address) : dev_addr(address) {
+    /** Simulated device constructor, for compatibility with `I2CDev`. */
+    field = Vec3<float>(200.0, -100.0, 400.0);
+    bus_hz = SIM_BUS_HZ;
+    rng = 1;
+    stuck = false;
+    stuck_left = 0;
+    transactions = n_faults = 0;
+    bus_time_ns = 0;
+    err_code = 0;
+    reset_device();
+}
+
+void SimI2CDev::start() {
+    /** Start communication with the device. Nothing to do for the simulator. */
+}
+
+uint8_t SimI2CDev::write_data(uint8_t register_addr, uint8_t data) {
+    /** Write a single register. See `I2CDev::write_data()`. */
+    return write_data(register_addr, &data, 1);
+}
+
+uint8_t SimI2CDev::write_data(uint8_t register_addr, const uint8_t *data, uint8_t length) {
+    /** Write consecutive registers in a single transaction. See `I2CDev::write_data()`.
+
+    Only the configuration and mode registers are writable - writes to the others are ignored, as
+    on the device. Writing single or continuous measurement mode to the mode register starts a
+    measurement, written one conversion time later. Writing the mode or configuration A register
+    clears LOCK.
+    */
+    HMC_TRACE_SCOPE("SimI2CDev::write_data");
+
+    if (err_code = begin((2 + length) * 9 + 2, false)) {
+        return err_code;
+    }
+
+    advance();
+
+    uint8_t reg = register_addr;
+    for (uint8_t i = 0; i < length && reg < SIM_N_REGISTERS; i++) {
+        if (reg <= ModeRegister) {
+            registers[reg] = data[i];
+            if (reg == ModeRegister || reg == ConfigRegisterA) {
+                unlock();
+            }
+
+            if (reg == ModeRegister && (data[i] & 0x3) != HMC_MeasurementIdle) {
+                uint8_t avg_rate = (registers[ConfigRegisterA] >> 5) & 0x3;
+                next_ns = hmc_nanos() + HMC5883L::conversionTimeUs(avg_rate) * 1000ull;
+            }
+        }
+
+        reg = next_register(reg);
+    }
+
+    return 0;
+}
+
+uint8_t *SimI2CDev::read_data(uint8_t register_addr, uint8_t length) {
+    /** Read consecutive registers. See `I2CDev::read_data()`.
+
+    Reading some but not all of the data registers, or reading the mode register, sets LOCK, and
+    reading the rest of the data registers clears it.
+
+    @return Returns a pointer to an internal buffer holding `length` bytes, valid until the next
+            read, or `NULL` on error.
+    */
+    HMC_TRACE_SCOPE("SimI2CDev::read_data");
+
+    if (length > SIM_N_REGISTERS) {
+        err_code = EC_DATA_LONG;
+        return NULL;
+    }
+
+    // Pointer write, then a repeated start and the read itself.
+    if (err_code = begin(2 * 9 + 2 + (1 + length) * 9 + 2, true)) {
+        return NULL;
+    }
+
+    advance();
+
+    bool mode_read = false;
+    uint8_t reg = register_addr;
+    for (uint8_t i = 0; i < length; i++) {
+        buffer[i] = reg < SIM_N_REGISTERS ? registers[reg] : 0;
+        if (reg >= DataRegister && reg < StatusRegister) {
+            data_read |= 1 << (reg - DataRegister);
+        }
+
+        mode_read |= reg == ModeRegister;
+        reg = next_register(reg);
+    }
+
+    if (data_read == 0x3f) {
+        unlock();
+    }
+
+    if (data_read || mode_read) {
+        registers[StatusRegister] |= 0x2;         // Set LOCK
+    }
+
+    return buffer;
+}
+
+uint8_t SimI2CDev::read_data_byte(uint8_t register_addr) {
+    /** Read a single register. Returns 0 on error. */
+    uint8_t *data = read_data(register_addr, 1);
+    return data != NULL ? data[0] : 0;
+}
+
+uint8_t SimI2CDev::get_err_code() {
+    /** Returns the error code of the last transaction. */
+    return err_code;
+}
+
+void SimI2CDev::set_field(Vec3<float> new_field) {
+    /** Set the simulated field, in mG. */
+    field = new_field;
+}
+
+void SimI2CDev::set_faults(const SimFaults &new_faults, uint32_t seed) {
+    /** Set the fault injection probabilities, and reseed the fault generator.
+
+    @param[in] new_faults The probability of each fault, per transaction.
+    @param[in] seed Seed for the fault generator, non-zero. Default is 1.
+    */
+    faults = new_faults;
+    rng = seed ? seed : 1;
+}
+
+void SimI2CDev::set_bus_clock(uint32_t hz) {
+    /** Set the simulated I2C clock used for the bus time, in Hz. Default is `SIM_BUS_HZ`. */
+    bus_hz = hz;
+}
+
+void SimI2CDev::reset_device() {
+    /** Reset the simulated device to its power-on register values. */
+    memset(registers, 0, sizeof(registers));
+    registers[ConfigRegisterA] = 0x10;       // 1 average, 15 Hz, no bias
+    registers[ConfigRegisterB] = 0x20;       // Gain 1.3 Ga
+    registers[ModeRegister] = HMC_MeasurementSingle;
+    memcpy(&registers[IdentRegister], HMC_IDENT, 3);
+    data_read = 0;
+
+    // The device makes a single measurement on power-up.
+    active_gain = registers[ConfigRegisterB] >> 5;
+    next_ns = hmc_nanos() + HMC5883L::conversionTimeUs(HMC_AVG1) * 1000ull;
+}
+
+uint8_t SimI2CDev::unstick() {
+    /** Release a stuck bus, as clocking SCL until SDA is released would. Returns 0. */
+    stuck = false;
+    stuck_left = 0;
+    return 0;
+}
+
+uint32_t SimI2CDev::get_transactions() {
+    /** Returns the number of transactions attempted. */
+    return transactions;
+}
+
+uint32_t SimI2CDev::get_faults() {
+    /** Returns the number of transactions failed by injected faults. */
+    return n_faults;
+}
+
+uint64_t SimI2CDev::get_bus_time_ns() {
+    /** Returns the total simulated bus time of all transactions, in nanoseconds. */
+    return bus_time_ns;
+}
+
+uint8_t SimI2CDev::begin(uint16_t n_clocks, bool is_read) {
+    /** Account for a transaction of `n_clocks` SCL clocks and decide whether it fails. */
+    transactions++;
+    bus_time_ns += (uint64_t)n_clocks * 1000000000 / bus_hz;
+
+    uint8_t rv = 0;
+    if (stuck) {
+        rv = EC_I2C_OTHER;
+        if (stuck_left && !--stuck_left) {
+            stuck = false;
+        }
+    } else {
+        if (faults.reset > 0 && random() < faults.reset) {
+            reset_device();
+        }
+
+        if (faults.stuck > 0 && random() < faults.stuck) {
+            stuck = true;
+            stuck_left = faults.stuck_transactions;
+            rv = EC_I2C_OTHER;
+        } else if (faults.nack > 0 && random() < faults.nack) {
+            rv = EC_NACK_ADDR;
+        } else if (is_read && faults.short_read > 0 && random() < faults.short_read) {
+            rv = EC_BAD_READ_SIZE;
+        }
+    }
+
+    if (rv) {
+        n_faults++;
+    }
+
+    return rv;
+}
+
+void SimI2CDev::advance() {
+    /** Write every measurement due by now to the data registers, and update RDY. */
+    uint64_t now = hmc_nanos();
+    uint8_t mode = registers[ModeRegister] & 0x3;
+
+    if (mode == HMC_MeasurementSingle && now >= next_ns) {
+        measure();
+        mode = HMC_MeasurementIdle;
+        registers[ModeRegister] = (registers[ModeRegister] & 0x80) | mode;
+    } else if (mode == HMC_MeasurementContinuous && now >= next_ns) {
+        // Of the measurements since the last access, only the last two can show: the last one in
+        // the data registers, the one before in the gain it was made at.
+        uint64_t period = period_ns();
+        uint64_t n = (now - next_ns) / period + 1;
+        for (uint64_t i = 0; i < n && i < 2; i++) {
+            measure();
+        }
+        next_ns += n * period;
+    }
+
+    // RDY is cleared when the device starts writing a measurement, and set once it's written.
+    if (mode != HMC_MeasurementIdle && next_ns - now < SIM_RDY_LOW_US * 1000ull) {
+        registers[StatusRegister] &= ~0x1;
+    }
+}
+
+uint64_t SimI2CDev::period_ns() {
+    /** The time between measurements in continuous mode: the output period at the configured
+    rate, or the conversion time if that's longer. */
+    uint8_t rate = (registers[ConfigRegisterA] >> 2) & 0x7;
+    uint8_t avg_rate = (registers[ConfigRegisterA] >> 5) & 0x3;
+    uint64_t period = 1e9 / HMC5883L::outputRateHz(rate < HMC_RATE7500 ? rate : HMC_RATE7500);
+    uint64_t conversion = HMC5883L::conversionTimeUs(avg_rate) * 1000ull;
+    return period > conversion ? period : conversion;
+}
+
+void SimI2CDev::measure() {
+    /** Write a measurement to the data registers and set RDY, unless LOCK is set.
+
+    The measurement is of the simulated field, or with the self-test bias enabled of the bias field
+    alone. It is made at the gain that was configured when the previous measurement completed, and
+    the gain configured now is kept for the next one.
+    */
+    float scale = HMC5883L::gainValue(active_gain);
+    active_gain = registers[ConfigRegisterB] >> 5;
+
+    Vec3<float> v = field;
+    uint8_t bias = registers[ConfigRegisterA] & 0x3;
+    if (bias == HMC_BIAS_POSITIVE) {
+        v = Vec3<float>(HMC_BIAS_XY, HMC_BIAS_XY, HMC_BIAS_Z);
+    } else if (bias == HMC_BIAS_NEGATIVE) {
+        v = Vec3<float>(-HMC_BIAS_XY, -HMC_BIAS_XY, -HMC_BIAS_Z);
+    }
+
+    if (registers[StatusRegister] & 0x2) {
+        return;
+    }
+
+    // Data registers are in X, Z, Y order.
+    float axes[3] = {v.x, v.z, v.y};
+    for (uint8_t i = 0; i < 3; i++) {
+        float c = axes[i] / scale;
+        int16_t counts = (int16_t)(c < 0 ? c - 0.5 : c + 0.5);
+        if (c < -2048 || c > 2047) {
+            counts = -4096;
+        }
+
+        registers[DataRegister + 2 * i] = (uint16_t)counts >> 8;
+        registers[DataRegister + 2 * i + 1] = counts & 0xff;
+    }
+
+    registers[StatusRegister] |= 0x1;             // Set RDY
+}
+
+void SimI2CDev::unlock() {
+    /** Clear LOCK, and start counting data register reads afresh. */
+    data_read = 0;
+    registers[StatusRegister] &= ~0x2;
+}
+
+uint8_t SimI2CDev::next_register(uint8_t reg) {
+    /** The register pointer after accessing `reg`, following the device's roll-over rules. */
+    if (reg == StatusRegister - 1) {
+        return DataRegister;
+    }
+
+    return reg + 1 < SIM_N_REGISTERS ? reg + 1 : 0;
+}
+
+float SimI2CDev::random() {
+    /** Uniform random number in [0, 1), from a xorshift generator. */
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return (rng >> 8) * (1.0f / 16777216);
+}
@@ -0,0 +1,124 @@
+/** @file
+Simulated HMC5883L on a simulated I2C bus, with fault injection.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+
+@author Paul J. Ganssle
+@version 0.1
+*/
+
+#ifndef SIMI2CDEV_H
+#define SIMI2CDEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <I2CDev.h>
+#include <Vec3.h>
+
+/** @defgroup SimConstants Simulator constants
+@{ */
+#define SIM_N_REGISTERS 13          /*!< Number of simulated HMC5883L registers */
+#define SIM_BUS_HZ 100000           /*!< Default simulated I2C clock, in Hz */
+#define SIM_RDY_LOW_US 250          /*!< Time RDY is low while a measurement is written, in µs */
+#define SIM_STUCK_TRANSACTIONS 8    /*!< Default number of transactions a stuck bus fails */
+/** @} */
+
+struct SimFaults {
+    /** Fault injection probabilities, per transaction, each from 0 to 1. */
+    float nack;                        /*!< Device doesn't acknowledge its address. */
+    float short_read;                  /*!< A read returns fewer bytes than requested. */
+    float stuck;                       /*!< SDA is stuck low for `stuck_transactions`. */
+    float reset;                       /*!< Device resets to its power-on register values. */
+    uint32_t stuck_transactions;       /*!< Number of further transactions a stuck bus fails
+                                            before SDA is released, or 0 to stay stuck until
+                                            `SimI2CDev::unstick()`. */
+
+    SimFaults() : nack(0), short_read(0), stuck(0), reset(0),
+                  stuck_transactions(SIM_STUCK_TRANSACTIONS) {}
+};
+
+class SimI2CDev {
+    /** Software model of an HMC5883L behind a faulty bus, with the same interface as `I2CDev`.
+
+    Build with `HMC5883L_USE_SIM` defined to run the `HMC5883L` class (and everything built on
+    it) against the model instead of real hardware. The model covers:
+
+      - The register map, with power-on values, the register pointer's auto-increment (rolling
+        back from the last data register to the first, and from the last identification register
+        to the first configuration register) and read-only registers.
+      - Measurements of a configurable field in real time (`hmc_nanos()`), saturating at -4096.
+        A single measurement completes `HMC5883L::conversionTimeUs()` after it is triggered and
+        returns the device to idle; in continuous mode one completes every output period. RDY
+        is cleared `SIM_RDY_LOW_US` before each measurement is written and set once it has been,
+        and reading the data registers leaves it alone. As on the device, a new gain applies
+        from the second measurement after it is written. With the self-test bias enabled, the
+        measurement is the bias field alone.
+      - The LOCK bit: reading some but not all of the data registers, or reading the mode
+        register, sets it, and measurements are then dropped instead of written to the data
+        registers until all six have been read, the mode or configuration A register is written,
+        or the device resets.
+      - A bus timing model: the SCL clocks of every transaction are counted at `SIM_BUS_HZ`, for
+        estimating bus-active time.
+      - Faults injected at random with fixed probabilities per transaction (see `SimFaults`),
+        from a seeded generator so runs are reproducible. A NACK makes the transaction fail with
+        `EC_NACK_ADDR`, a short read with `EC_BAD_READ_SIZE`, and a stuck bus fails transactions
+        with `EC_I2C_OTHER` until it releases itself (see `SimFaults::stuck_transactions`) or
+        `unstick()` is called.
+    */
+public:
+    SimI2CDev();
+    SimI2CDev(uint8_t address);
+
+    void start(void);
+
+    uint8_t write_data(uint8_t register_addr, uint8_t data);
+    uint8_t write_data(uint8_t register_addr, const uint8_t *data, uint8_t length);
+    uint8_t *read_data(uint8_t register_addr, uint8_t length);
+    uint8_t read_data_byte(uint8_t register_addr);
+
+    uint8_t get_err_code(void);
+
+    void set_field(Vec3<float> field);
+    void set_faults(const SimFaults &faults, uint32_t seed=1);
+    void set_bus_clock(uint32_t hz);
+    void reset_device(void);
+    uint8_t unstick(void);
+
+    uint32_t get_transactions(void);
+    uint32_t get_faults(void);
+    uint64_t get_bus_time_ns(void);
+
+private:
+    uint8_t begin(uint16_t n_clocks, bool is_read);
+    void advance(void);
+    void measure(void);
+    void unlock(void);
+    uint64_t period_ns(void);
+    uint8_t next_register(uint8_t reg);
+    float random(void);
+
+    uint8_t registers[SIM_N_REGISTERS];
+    uint8_t buffer[SIM_N_REGISTERS];   /*!< Holds the result of the last read. */
+    Vec3<float> field;                 /*!< Simulated field, in mG. */
+    uint8_t active_gain;               /*!< Gain the next measurement is made at. */
+    uint8_t data_read;                 /*!< Data registers read since all six last were, one bit
+                                            each. */
+    uint64_t next_ns;                  /*!< When the next measurement is written, in
+                                            `hmc_nanos()` time. */
+
+    SimFaults faults;
+    uint32_t rng;
+    bool stuck;
+    uint32_t stuck_left;
+    uint32_t bus_hz;
+
+    uint32_t transactions;
+    uint32_t n_faults;
+    uint64_t bus_time_ns;
+
+    uint8_t err_code;
+    uint8_t dev_addr;
+};
+
+#endif
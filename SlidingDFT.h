@@ -0,0 +1,262 @@
+/** @file
+Sliding DFT for tracking a set of frequencies in magnetometer sample streams.
+
+Tracks the amplitude and phase of `K` arbitrary frequencies (e.g. a motor's rotation rate and the
+mains frequency and its harmonics) over a sliding window of the last `W` samples, with an O(1)
+update per sample and frequency instead of recomputing an FFT of the window. All state is held in
+fixed-size member arrays sized by the template parameters, so no memory is allocated at run time.
+
+The interface follows the filters in `Filter.h`:
+
+  - `void process(float x)` pushes a single sample.
+  - `void processBlock(const float *in, uint16_t n)` pushes a block of `n` samples.
+  - `void reset()` clears the window.
+
+and `Vec3SlidingDFT` applies the same analysis to all three axes of a `Vec3Block`.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#ifndef SLIDINGDFT_H
+#define SLIDINGDFT_H
+
+#include <Vec3.h>
+#include <Vec3Block.h>
+#include <math.h>
+
+/** @defgroup SlidingDFTConstants Sliding DFT constants
+@{ */
+#define SDFT_DAMPING 0.99999f       /*!< Default per-sample damping, see `SlidingDFT` */
+/** @} */
+
+template<uint8_t K, uint16_t W> class SlidingDFT {
+    /** Sliding DFT of a window of `W` samples at `K` frequencies.
+
+    For each frequency ω (in radians per sample) the sum
+
+        S[n] = sum over m = n-W+1 .. n of  r^(n-m) x[m] exp(-jωm)
+
+    is updated with
+
+        S[n] = r S[n-1] + x[n] exp(-jωn) - r^W x[n-W] exp(-jω(n-W))
+
+    Unlike the textbook sliding DFT, the phase is referenced to the absolute sample index rather
+    than to the start of the window, so the frequencies need not be multiples of the bin spacing
+    `1 / W` cycles per sample. The damping factor `r` (slightly below 1) makes the rounding
+    errors of the recursion decay instead of accumulating without bound; it weights the oldest
+    sample of the window by `r^W`, which is 0.99 for the default `SDFT_DAMPING` and `W = 1000`.
+
+    The window is rectangular, so a frequency that isn't a whole number of cycles per window sees
+    some leakage from the others and from its own negative-frequency image - choose `W` to span a
+    whole number of periods of the frequencies of interest where possible.
+
+    The state of every frequency is stored in its own set of arrays, so the per-sample loop over
+    the frequencies vectorizes.
+    */
+public:
+    SlidingDFT(const float *frequencies, float sample_rate, float damping=SDFT_DAMPING) {
+        /** Constructor.
+
+        @param[in] frequencies The `K` frequencies to track, in Hz. Copied.
+        @param[in] sample_rate The rate of the sample stream, in Hz.
+        @param[in] damping The per-sample damping factor `r`, in (0, 1]. Default is
+                           `SDFT_DAMPING`.
+        */
+        rate = sample_rate;
+        r = damping;
+        reset();
+
+        for (uint8_t k = 0; k < K; k++) {
+            setFrequency(k, frequencies[k]);
+        }
+    }
+
+    void reset(void) {
+        /** Clear the window. The frequencies are kept. */
+        for (uint16_t i = 0; i < W; i++) {
+            history[i] = 0;
+        }
+
+        for (uint8_t k = 0; k < K; k++) {
+            s_re[k] = s_im[k] = 0;
+            p_re[k] = 1;
+            p_im[k] = 0;
+        }
+
+        head = 0;
+        count = 0;
+    }
+
+    void setFrequency(uint8_t k, float frequency) {
+        /** Change the `k`th tracked frequency, in Hz.
+
+        The sum for the new frequency is recomputed from the samples in the window, so the result
+        is valid immediately. This costs O(W), unlike `process()`.
+        */
+        float w = 2 * (float)M_PI * frequency / rate;
+        step_re[k] = cosf(w);
+        step_im[k] = -sinf(w);
+
+        // Use the angle of the rounded step, so the removal phase matches the rotation exactly.
+        double angle = -atan2((double)step_im[k], (double)step_re[k]);
+        double rw = pow((double)r, (double)W);
+        old_re[k] = (float)(rw * cos(angle * W));
+        old_im[k] = (float)(rw * sin(angle * W));
+
+        // Recompute the sum from the window, oldest sample first, then the current phasor.
+        double sr = 0, si = 0, pr = 1, pi = 0;
+        uint16_t j = (head + W - count) % W;
+        for (uint16_t i = 0; i < count; i++) {
+            sr = sr * r + history[j] * pr;
+            si = si * r + history[j] * pi;
+
+            double t = pr * step_re[k] - pi * step_im[k];
+            pi = pr * step_im[k] + pi * step_re[k];
+            pr = t;
+            j = (j + 1 == W) ? 0 : j + 1;
+        }
+
+        s_re[k] = (float)sr;
+        s_im[k] = (float)si;
+        p_re[k] = (float)pr;
+        p_im[k] = (float)pi;
+    }
+
+    void process(float x) {
+        /** Push a single sample. */
+        float old = history[head];
+        history[head] = x;
+        head = (head + 1 == W) ? 0 : head + 1;
+        if (count < W) {
+            count++;
+        }
+
+        for (uint8_t k = 0; k < K; k++) {
+            // Input minus the sample leaving the window, rotated back to its own phase.
+            float u = x - old * old_re[k];
+            float v = -old * old_im[k];
+
+            float sr = r * s_re[k] + u * p_re[k] - v * p_im[k];
+            float si = r * s_im[k] + u * p_im[k] + v * p_re[k];
+            s_re[k] = sr;
+            s_im[k] = si;
+
+            // Advance the phasor and pull its magnitude back towards 1.
+            float pr = p_re[k] * step_re[k] - p_im[k] * step_im[k];
+            float pi = p_re[k] * step_im[k] + p_im[k] * step_re[k];
+            float g = 1.5f - 0.5f * (pr * pr + pi * pi);
+            p_re[k] = pr * g;
+            p_im[k] = pi * g;
+        }
+    }
+
+    void processBlock(const float *in, uint16_t n) {
+        /** Push a block of `n` samples. */
+        for (uint16_t i = 0; i < n; i++) {
+            process(in[i]);
+        }
+    }
+
+    float amplitude(uint8_t k) {
+        /** The amplitude of the `k`th frequency over the window, in the units of the samples.
+
+        A sinusoid `A cos(ωn + φ)` at the tracked frequency reads as `A`. Until `W` samples have
+        been pushed, the result is for the samples pushed so far.
+        */
+        float g = gain();
+        return g > 0 ? 2 * sqrtf(s_re[k] * s_re[k] + s_im[k] * s_im[k]) / g : 0;
+    }
+
+    float phase(uint8_t k) {
+        /** The phase of the `k`th frequency at the latest sample, in radians in [-π, π].
+
+        A sinusoid `A cos(ωn + φ)` reads as `ωn + φ` for the latest sample `n`.
+        */
+
+        // The phasor has already been advanced to the next sample, so step it back by one.
+        float pr = p_re[k] * step_re[k] + p_im[k] * step_im[k];
+        float pi = p_im[k] * step_re[k] - p_re[k] * step_im[k];
+        return atan2f(s_im[k] * pr - s_re[k] * pi, s_re[k] * pr + s_im[k] * pi);
+    }
+
+    float getFrequency(uint8_t k) {
+        /** The `k`th tracked frequency, in Hz. */
+        return -atan2f(step_im[k], step_re[k]) * rate / (2 * (float)M_PI);
+    }
+
+    bool isFull(void) {
+        /** `true` once `W` samples have been pushed, so the window is complete. */
+        return count == W;
+    }
+
+private:
+    float gain(void) {
+        /** Sum of the window weights `r^i` over the samples in the window. */
+        if (r >= 1) {
+            return count;
+        }
+        return (1 - powf(r, count)) / (1 - r);
+    }
+
+    float rate;
+    float r;                           /*!< Damping factor. */
+    float history[W];                  /*!< The window, as a ring buffer. */
+    uint16_t head;                     /*!< Index of the oldest sample, overwritten next. */
+    uint16_t count;                    /*!< Number of samples in the window. */
+
+    float step_re[K], step_im[K];      /*!< exp(-jω), the phasor rotation per sample. */
+    float old_re[K], old_im[K];        /*!< r^W exp(jωW), the rotation of the leaving sample. */
+    float p_re[K], p_im[K];            /*!< exp(-jωn) for the next sample `n`. */
+    float s_re[K], s_im[K];            /*!< The damped sums. */
+};
+
+template<uint8_t K, uint16_t W> class Vec3SlidingDFT {
+    /** Applies an independent `SlidingDFT` to each axis of a 3-vector stream. */
+public:
+    Vec3SlidingDFT(const float *frequencies, float sample_rate, float damping=SDFT_DAMPING)
+        : x(frequencies, sample_rate, damping), y(frequencies, sample_rate, damping),
+          z(frequencies, sample_rate, damping) {}
+
+    void reset(void) {
+        /** Clear the window on all three axes. */
+        x.reset();
+        y.reset();
+        z.reset();
+    }
+
+    void setFrequency(uint8_t k, float frequency) {
+        /** Change the `k`th tracked frequency on all three axes. */
+        x.setFrequency(k, frequency);
+        y.setFrequency(k, frequency);
+        z.setFrequency(k, frequency);
+    }
+
+    void process(Vec3<float> v) {
+        /** Push a single 3-vector. */
+        x.process(v.x);
+        y.process(v.y);
+        z.process(v.z);
+    }
+
+    void processBlock(Vec3Block<float> in) {
+        /** Push a whole block, one axis at a time. */
+        x.processBlock(in.x, in.length);
+        y.processBlock(in.y, in.length);
+        z.processBlock(in.z, in.length);
+    }
+
+    Vec3<float> amplitude(uint8_t k) {
+        /** The amplitude of the `k`th frequency on each axis, see `SlidingDFT::amplitude()`. */
+        return Vec3<float>(x.amplitude(k), y.amplitude(k), z.amplitude(k));
+    }
+
+    Vec3<float> phase(uint8_t k) {
+        /** The phase of the `k`th frequency on each axis, see `SlidingDFT::phase()`. */
+        return Vec3<float>(x.phase(k), y.phase(k), z.phase(k));
+    }
+
+    SlidingDFT<K, W> x, y, z;
+};
+
+#endif
@@ -0,0 +1,47 @@
+/** @file
+Definition for template class Vec3Block, a structure-of-arrays block of 3D Cartesian vectors.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#ifndef VEC3BLOCK_H
+#define VEC3BLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <Vec3.h>
+
+template<typename T> struct Vec3Block {
+    /** Class for holding blocks of Cartesian 3-vectors in structure-of-arrays form.
+
+    A `Vec3Block` does not own its storage - the caller preallocates one array per axis (each with
+    room for at least `length` elements) and the block simply points into them. This keeps the
+    per-axis data contiguous, so batch operations (filters, calibration, etc.) can run a tight loop
+    over a single array at a time.
+    */
+    T *x, *y, *z;
+    uint16_t length;                   /*!< Number of valid samples in each of the arrays. */
+
+    Vec3Block() : x(NULL), y(NULL), z(NULL), length(0) {}
+    Vec3Block(T *X, T *Y, T *Z, uint16_t Length) {
+        x = X;
+        y = Y;
+        z = Z;
+        length = Length;
+    }
+
+    Vec3<T> get(uint16_t i) {
+        /** Retrieve the `i`th element of the block as a `Vec3`. */
+        return Vec3<T>(x[i], y[i], z[i]);
+    }
+
+    void set(uint16_t i, Vec3<T> v) {
+        /** Store the `Vec3` `v` as the `i`th element of the block. */
+        x[i] = v.x;
+        y[i] = v.y;
+        z[i] = v.z;
+    }
+};
+
+#endif
@@ -0,0 +1,306 @@
+/** @file
+Implementation of the World Magnetic Model evaluator.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <WMM.h>
+#include <Vec3.h>
+#include <math.h>
+#include <string.h>
+#ifndef ARDUINO
+#include <stdio.h>
+#endif
+
+#define WMM_A 6378.137              // WGS 84 semi-major axis, km
+#define WMM_F (1 / 298.257223563)   // WGS 84 flattening
+#define WMM_RE 6371.2               // Geomagnetic reference radius, km
+#define WMM_DEG (M_PI / 180.0)
+
+static inline uint8_t coeff_index(uint8_t n, uint8_t m) {
+    return n * (n + 1) / 2 + m;
+}
+
+WorldMagneticModel::WorldMagneticModel() {
+    /** Constructor. All coefficients start at zero - load them with `load()` or
+    `setCoefficient()` before evaluating. */
+    memset(g, 0, sizeof(g));
+    memset(h, 0, sizeof(h));
+    memset(g_dot, 0, sizeof(g_dot));
+    memset(h_dot, 0, sizeof(h_dot));
+    epoch = 0;
+
+    k_diag[0] = 0;
+    k_diag[1] = 1;
+    for (uint8_t n = 2; n <= WMM_MAX_DEGREE; n++) {
+        k_diag[n] = sqrt((2.0 * n - 1) / (2.0 * n));
+    }
+
+    for (uint8_t n = 1; n <= WMM_MAX_DEGREE; n++) {
+        for (uint8_t m = 0; m < n; m++) {
+            uint8_t i = coeff_index(n, m);
+            float norm = sqrt((float)(n * n - m * m));
+            k_sin[i] = (2 * n - 1) / norm;
+            k_prev[i] = sqrt((float)((n - 1) * (n - 1) - m * m)) / norm;
+        }
+    }
+
+    setCacheGrid(0.1, 1.0, 0.1);
+}
+
+#ifndef ARDUINO
+uint8_t WorldMagneticModel::load(const char *path) {
+    /** Load the coefficients from a `WMM.COF` file.
+
+    The first line holds the epoch (e.g. `2025.0`), each following line holds `n m g h g_dot
+    h_dot`, and the file ends at a line of 9s or at the end of the file.
+
+    @param[in] path The path to the file.
+
+    @return Returns `0` on no error, `EC_WMM_FILE` if the file can't be opened, or
+            `EC_WMM_FORMAT` if it is malformed. On error the coefficients are left zeroed.
+    */
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return EC_WMM_FILE;
+    }
+
+    memset(g, 0, sizeof(g));
+    memset(h, 0, sizeof(h));
+    memset(g_dot, 0, sizeof(g_dot));
+    memset(h_dot, 0, sizeof(h_dot));
+
+    char line[128];
+    float new_epoch;
+    uint8_t rv = EC_WMM_FORMAT;
+    uint16_t n_read = 0;
+    if (fgets(line, sizeof(line), fp) != NULL && sscanf(line, "%f", &new_epoch) == 1) {
+        rv = 0;
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (strncmp(line, "9999", 4) == 0) {
+                break;
+            }
+
+            int n, m;
+            float cg, ch, cg_dot, ch_dot;
+            int fields = sscanf(line, "%d %d %f %f %f %f", &n, &m, &cg, &ch, &cg_dot, &ch_dot);
+            if (fields <= 0) {
+                continue;               // Blank line
+            }
+
+            if (fields != 6 || n < 1 || n > WMM_MAX_DEGREE || m < 0 || m > n) {
+                rv = EC_WMM_FORMAT;
+                break;
+            }
+
+            setCoefficient(n, m, cg, ch, cg_dot, ch_dot);
+            n_read++;
+        }
+    }
+
+    fclose(fp);
+
+    if (rv || n_read == 0) {
+        memset(g, 0, sizeof(g));
+        memset(h, 0, sizeof(h));
+        memset(g_dot, 0, sizeof(g_dot));
+        memset(h_dot, 0, sizeof(h_dot));
+        return EC_WMM_FORMAT;
+    }
+
+    setEpoch(new_epoch);
+    return 0;
+}
+#endif
+
+void WorldMagneticModel::setEpoch(float model_epoch) {
+    /** Set the epoch of the coefficients, as a decimal year. */
+    epoch = model_epoch;
+    clearCache();
+}
+
+void WorldMagneticModel::setCoefficient(uint8_t n, uint8_t m, float cg, float ch, float cg_dot,
+                                        float ch_dot) {
+    /** Set the Gauss coefficients of degree `n` and order `m`, in nT, and their secular
+    variation, in nT/year. Out of range degrees and orders are ignored. */
+    if (n < 1 || n > WMM_MAX_DEGREE || m > n) {
+        return;
+    }
+
+    uint8_t i = coeff_index(n, m);
+    g[i] = cg;
+    h[i] = ch;
+    g_dot[i] = cg_dot;
+    h_dot[i] = ch_dot;
+    clearCache();
+}
+
+void WorldMagneticModel::evaluate(float lat, float lon, float alt_km, float year,
+                                  WMMResult *out) {
+    /** Evaluate the model at a position and date, without the cache.
+
+    @param[in] lat Geodetic latitude, in degrees.
+    @param[in] lon Longitude, in degrees.
+    @param[in] alt_km Height above the WGS 84 ellipsoid, in km.
+    @param[in] year Decimal year, e.g. 2026.5. The model is valid for 5 years after its epoch.
+    @param[out] out The expected field.
+    */
+
+    // Geodetic to geocentric spherical coordinates.
+    const float e2 = WMM_F * (2 - WMM_F);
+    float phi = lat * WMM_DEG;
+    float sin_phi = sin(phi), cos_phi = cos(phi);
+    float rc = WMM_A / sqrt(1 - e2 * sin_phi * sin_phi);
+    float p = (rc + alt_km) * cos_phi;
+    float z = (rc * (1 - e2) + alt_km) * sin_phi;
+    float r = sqrt(p * p + z * z);
+    float s = z / r;                    // sin and cos of the geocentric latitude
+    float c = p / r;
+
+    // Schmidt semi-normalized associated Legendre functions of sin(latitude), and their
+    // derivatives with respect to latitude.
+    float P[WMM_N_COEFFS], dP[WMM_N_COEFFS];
+    P[0] = 1;
+    dP[0] = 0;
+    for (uint8_t n = 1; n <= WMM_MAX_DEGREE; n++) {
+        for (uint8_t m = 0; m < n; m++) {
+            uint8_t i = coeff_index(n, m);
+            uint8_t j = coeff_index(n - 1, m);
+            P[i] = k_sin[i] * s * P[j];
+            dP[i] = k_sin[i] * (s * dP[j] + c * P[j]);
+            if (m + 2 <= n) {
+                uint8_t k = coeff_index(n - 2, m);
+                P[i] -= k_prev[i] * P[k];
+                dP[i] -= k_prev[i] * dP[k];
+            }
+        }
+
+        uint8_t i = coeff_index(n, n);
+        uint8_t j = coeff_index(n - 1, n - 1);
+        P[i] = k_diag[n] * c * P[j];
+        dP[i] = k_diag[n] * (c * dP[j] - s * P[j]);
+    }
+
+    // cos(m * lon) and sin(m * lon) by the angle addition recurrence.
+    float cos_ml[WMM_MAX_DEGREE + 1], sin_ml[WMM_MAX_DEGREE + 1];
+    float lambda = lon * WMM_DEG;
+    cos_ml[0] = 1;
+    sin_ml[0] = 0;
+    cos_ml[1] = cos(lambda);
+    sin_ml[1] = sin(lambda);
+    for (uint8_t m = 2; m <= WMM_MAX_DEGREE; m++) {
+        cos_ml[m] = cos_ml[m - 1] * cos_ml[1] - sin_ml[m - 1] * sin_ml[1];
+        sin_ml[m] = sin_ml[m - 1] * cos_ml[1] + cos_ml[m - 1] * sin_ml[1];
+    }
+
+    // Sum the field in spherical coordinates.
+    float dt = year - epoch;
+    float ratio = WMM_RE / r;
+    float ar = ratio * ratio;
+    float xs = 0, ys = 0, zs = 0;
+    for (uint8_t n = 1; n <= WMM_MAX_DEGREE; n++) {
+        ar *= ratio;                    // (a / r)^(n + 2)
+        for (uint8_t m = 0; m <= n; m++) {
+            uint8_t i = coeff_index(n, m);
+            float gt = g[i] + dt * g_dot[i];
+            float ht = h[i] + dt * h_dot[i];
+            float t = gt * cos_ml[m] + ht * sin_ml[m];
+
+            xs -= ar * t * dP[i];
+            ys += ar * m * (gt * sin_ml[m] - ht * cos_ml[m]) * P[i];
+            zs -= ar * (n + 1) * t * P[i];
+        }
+    }
+
+    ys /= (c > 1e-6 ? c : 1e-6);        // The east component is singular at the poles.
+
+    // Rotate from geocentric to geodetic north/down.
+    float psi = asin(s) - phi;
+    float sin_psi = sin(psi), cos_psi = cos(psi);
+    Vec3<float> f = Vec3<float>(xs * cos_psi - zs * sin_psi, ys, xs * sin_psi + zs * cos_psi);
+
+    out->field = f;
+    out->horizontal = sqrt(f.x * f.x + f.y * f.y);
+    out->intensity = sqrt(out->horizontal * out->horizontal + f.z * f.z);
+    out->declination = atan2(f.y, f.x) / WMM_DEG;
+    out->inclination = atan2(f.z, out->horizontal) / WMM_DEG;
+}
+
+void WorldMagneticModel::lookup(float lat, float lon, float alt_km, float year, WMMResult *out,
+                                bool *hit) {
+    /** Evaluate the model through the position cache.
+
+    The position and date are snapped to the center of their grid cell (see `setCacheGrid()`),
+    and the model is only evaluated if that cell isn't in the cache.
+
+    @param[in] lat, lon, alt_km, year As for `evaluate()`.
+    @param[out] out The expected field at the center of the grid cell.
+    @param[out] hit Set to `true` if the result came from the cache. Pass `NULL` (default) if you
+                    don't want to read this out.
+    */
+
+    int32_t key[4] = {(int32_t)floor(lat / grid_deg), (int32_t)floor(lon / grid_deg),
+                      (int32_t)floor(alt_km / grid_km), (int32_t)floor(year / grid_years)};
+
+    uint32_t hash = (uint32_t)key[0] * 73856093u ^ (uint32_t)key[1] * 19349663u
+                  ^ (uint32_t)key[2] * 83492791u ^ (uint32_t)key[3] * 2654435761u;
+    CacheEntry *e = &cache[hash % WMM_CACHE_SIZE];
+
+    bool found = e->valid && memcmp(e->key, key, sizeof(key)) == 0;
+    if (!found) {
+        evaluate((key[0] + 0.5) * grid_deg, (key[1] + 0.5) * grid_deg, (key[2] + 0.5) * grid_km,
+                 (key[3] + 0.5) * grid_years, &e->result);
+        memcpy(e->key, key, sizeof(key));
+        e->valid = true;
+    }
+
+    *out = e->result;
+    if (hit != NULL) {
+        *hit = found;
+    }
+}
+
+void WorldMagneticModel::setCacheGrid(float degrees, float km, float years) {
+    /** Set the size of the cache's grid cells, and clear the cache.
+
+    @param[in] degrees Cell size in latitude and longitude. Default is 0.1 degree.
+    @param[in] km Cell size in height. Default is 1 km.
+    @param[in] years Cell size in time. Default is 0.1 year.
+    */
+    grid_deg = degrees;
+    grid_km = km;
+    grid_years = years;
+    clearCache();
+}
+
+void WorldMagneticModel::clearCache() {
+    /** Discard all cached results. */
+    for (uint8_t i = 0; i < WMM_CACHE_SIZE; i++) {
+        cache[i].valid = false;
+    }
+}
+
+float WorldMagneticModel::trueHeading(float magnetic_heading, const WMMResult &expected) {
+    /** Convert a magnetic heading (e.g. `HMCSample::heading()`) to a true heading, in degrees in
+    [0, 360). */
+    float heading = fmod(magnetic_heading + expected.declination, 360.0);
+    return heading < 0 ? heading + 360 : heading;
+}
+
+float WorldMagneticModel::fieldError(Vec3<float> measured, const WMMResult &expected) {
+    /** Relative error of a measured field strength against the model, as a calibration quality
+    metric.
+
+    @param[in] measured A calibrated field vector in mG, e.g. from
+                        `HMC5883L::readCalibratedValues()`.
+    @param[in] expected The model result at the sensor's position.
+
+    @return Returns `|measured| / intensity - 1`, e.g. 0.02 if the sensor reads 2% high. A well
+            calibrated sensor away from local disturbances stays within a few percent.
+    */
+    float magnitude = sqrt(measured.x * measured.x + measured.y * measured.y
+                           + measured.z * measured.z) * WMM_NT_PER_MG;
+    return expected.intensity > 0 ? magnitude / expected.intensity - 1 : 0;
+}
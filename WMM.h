@@ -0,0 +1,95 @@
+/** @file
+Header file for an evaluator of the World Magnetic Model (WMM), for turning magnetic headings into
+true headings and checking measured field strength against the expected value.
+
+The model is a degree-12 spherical harmonic expansion of the main geomagnetic field, with
+coefficients published every 5 years by NOAA/NCEI and the British Geological Survey in a
+`WMM.COF` file. Evaluation follows the WMM technical report: the geodetic position is converted to
+geocentric spherical coordinates, the Schmidt semi-normalized associated Legendre functions are
+computed by recursion, the field is summed in spherical coordinates and rotated back to geodetic
+north/east/down.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#ifndef WMM_H
+#define WMM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <Vec3.h>
+
+/** @addtogroup ErrorCodes
+@{ */
+#define EC_WMM_FILE 26                      /*!< Coefficient file could not be opened. */
+#define EC_WMM_FORMAT 27                    /*!< Coefficient file is malformed. */
+/** @} */
+
+/** @defgroup WMMConstants World Magnetic Model constants
+@{ */
+#define WMM_MAX_DEGREE 12           /*!< Degree of the model */
+#define WMM_N_COEFFS ((WMM_MAX_DEGREE + 1) * (WMM_MAX_DEGREE + 2) / 2)  /*!< (n, m) pairs */
+#define WMM_CACHE_SIZE 8            /*!< Entries in the position cache */
+#define WMM_NT_PER_MG 100.0         /*!< nT per mG */
+/** @} */
+
+struct WMMResult {
+    /** Expected field at a position and date. */
+    float declination;                 /*!< Angle from true to magnetic north, in degrees, east
+                                            positive. */
+    float inclination;                 /*!< Angle of the field below horizontal, in degrees. */
+    float intensity;                   /*!< Total field strength, in nT. */
+    float horizontal;                  /*!< Horizontal field strength, in nT. */
+    Vec3<float> field;                 /*!< Field as (north, east, down), in nT. */
+};
+
+class WorldMagneticModel {
+    /** World Magnetic Model with a position cache.
+
+    `evaluate()` always runs the full spherical harmonic synthesis. The recursion factors of the
+    Legendre functions depend only on the degree and order, so they are computed once in the
+    constructor, leaving a few multiply-adds per term.
+
+    `lookup()` quantizes the position and date onto a grid (by default 0.1 degree, 1 km and 0.1
+    year) and keeps the results for recently seen grid cells. The field is evaluated at the
+    center of each cell, so results are reused until the vehicle moves into another cell, with an
+    error bounded by the variation of the field over half a cell.
+    */
+public:
+    WorldMagneticModel();
+
+#ifndef ARDUINO
+    uint8_t load(const char *path);
+#endif
+    void setEpoch(float epoch);
+    void setCoefficient(uint8_t n, uint8_t m, float g, float h, float g_dot, float h_dot);
+
+    void evaluate(float lat, float lon, float alt_km, float year, WMMResult *out);
+    void lookup(float lat, float lon, float alt_km, float year, WMMResult *out, bool *hit=NULL);
+    void setCacheGrid(float degrees, float km, float years);
+    void clearCache(void);
+
+    static float trueHeading(float magnetic_heading, const WMMResult &expected);
+    static float fieldError(Vec3<float> measured, const WMMResult &expected);
+
+private:
+    // Coefficients, indexed by n * (n + 1) / 2 + m.
+    float g[WMM_N_COEFFS], h[WMM_N_COEFFS];
+    float g_dot[WMM_N_COEFFS], h_dot[WMM_N_COEFFS];
+    float epoch;
+
+    // Legendre recursion factors, same indexing.
+    float k_sin[WMM_N_COEFFS];         /*!< Factor of sin * P(n-1, m) */
+    float k_prev[WMM_N_COEFFS];        /*!< Factor of P(n-2, m) */
+    float k_diag[WMM_MAX_DEGREE + 1];  /*!< Factor of cos * P(n-1, n-1) for P(n, n) */
+
+    float grid_deg, grid_km, grid_years;
+    struct CacheEntry {
+        bool valid;
+        int32_t key[4];
+        WMMResult result;
+    } cache[WMM_CACHE_SIZE];
+};
+
+#endif
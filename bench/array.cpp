@@ -0,0 +1,121 @@
+/** @file
+Benchmark of batched multi-sensor calibration, scaling from 1 to 256 sensors.
+
+For each sensor count, times `HMC5883LArray::apply()`, `magnitude()`, `heading()` and
+`gradient()` (between neighbouring sensors) over a frame, and for comparison the same
+calibration done one sensor at a time over an array of per-sensor structures. Costs are per
+sensor per frame; each case processes about the same number of sensor readings in total.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <bench.h>
+#include <HMC5883LArray.h>
+
+#define MAX_SENSORS 256
+#define READINGS (1UL << 22)
+
+struct SensorCalibration {
+    /** One sensor's calibration, as it would be stored without the array. */
+    Vec3<float> offset;
+    float m[9];
+};
+
+static HMC5883LArray<MAX_SENSORS> array;
+static SensorCalibration per_sensor[MAX_SENSORS];
+
+static int16_t raw_x[MAX_SENSORS], raw_y[MAX_SENSORS], raw_z[MAX_SENSORS];
+static float fx[MAX_SENSORS], fy[MAX_SENSORS], fz[MAX_SENSORS], scalar[MAX_SENSORS];
+static float gx[MAX_SENSORS], gy[MAX_SENSORS], gz[MAX_SENSORS];
+static uint16_t from[MAX_SENSORS], to[MAX_SENSORS];
+
+static void setup(void) {
+    /** Give every sensor a distinct calibration and reading. */
+    for (uint16_t i = 0; i < MAX_SENSORS; i++) {
+        float m[9] = {0.92f + 0.001f * i, 0.01f, 0, 0.01f, 0.92f, 0.02f, 0, 0.02f, 0.93f};
+        Vec3<float> offset(i % 7 - 3.0f, i % 5 - 2.0f, i % 3 - 1.0f);
+        array.setCalibration(i, offset, m);
+        per_sensor[i].offset = offset;
+        for (uint8_t k = 0; k < 9; k++) {
+            per_sensor[i].m[k] = m[k];
+        }
+
+        raw_x[i] = 200 + i;
+        raw_y[i] = -300 + 2 * i;
+        raw_z[i] = 400 - i;
+        from[i] = i;
+        to[i] = i + 1;
+    }
+}
+
+static void apply_per_sensor(uint16_t n) {
+    /** The calibration of `HMC5883LArray::apply()`, one sensor at a time. */
+    for (uint16_t i = 0; i < n; i++) {
+        const SensorCalibration &c = per_sensor[i];
+        Vec3<float> r = Vec3<float>(raw_x[i], raw_y[i], raw_z[i]) - c.offset;
+        Vec3<float> f(c.m[0] * r.x + c.m[1] * r.y + c.m[2] * r.z,
+                      c.m[3] * r.x + c.m[4] * r.y + c.m[5] * r.z,
+                      c.m[6] * r.x + c.m[7] * r.y + c.m[8] * r.z);
+        fx[i] = f.x;
+        fy[i] = f.y;
+        fz[i] = f.z;
+    }
+}
+
+int main() {
+    setup();
+
+    for (uint16_t n = 1; n <= MAX_SENSORS; n *= 2) {
+        uint32_t frames = READINGS / n;
+        Vec3Block<int16_t> raw(raw_x, raw_y, raw_z, n);
+        Vec3Block<float> field(fx, fy, fz, n);
+        Vec3Block<float> grad(gx, gy, gz, 0);
+        char title[32];
+
+        array.setSensorCount(n);
+        snprintf(title, sizeof(title), "%u sensor%s", n, n == 1 ? "" : "s");
+        bench_header(title);
+
+        uint64_t start = hmc_nanos();
+        for (uint32_t f = 0; f < frames; f++) {
+            apply_per_sensor(n);
+            bench_keep(fx);
+        }
+        bench_report("calibration, one sensor at a time", hmc_nanos() - start, READINGS,
+                     "sensor");
+
+        start = hmc_nanos();
+        for (uint32_t f = 0; f < frames; f++) {
+            array.apply(raw, &field);
+            bench_keep(fx);
+        }
+        bench_report("apply()", hmc_nanos() - start, READINGS, "sensor");
+
+        start = hmc_nanos();
+        for (uint32_t f = 0; f < frames; f++) {
+            array.magnitude(field, scalar);
+            bench_keep(scalar);
+        }
+        bench_report("magnitude()", hmc_nanos() - start, READINGS, "sensor");
+
+        start = hmc_nanos();
+        for (uint32_t f = 0; f < frames; f++) {
+            array.heading(field, scalar);
+            bench_keep(scalar);
+        }
+        bench_report("heading()", hmc_nanos() - start, READINGS, "sensor");
+
+        if (n > 1) {
+            start = hmc_nanos();
+            for (uint32_t f = 0; f < frames; f++) {
+                array.gradient(field, from, to, NULL, n - 1, &grad);
+                bench_keep(gx);
+            }
+            bench_report("gradient(), neighbouring pairs", hmc_nanos() - start, READINGS,
+                         "sensor");
+        }
+    }
+
+    return 0;
+}
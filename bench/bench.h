@@ -0,0 +1,41 @@
+/** @file
+Timing helpers shared by the host benchmarks in this directory.
+
+Each benchmark runs a loop a fixed number of times, timed with `hmc_nanos()`, and prints one line
+per case with the cost per operation and the resulting rate. Results are passed to `bench_keep()`
+so the compiler cannot optimize the work away.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <HMCTime.h>
+
+template<typename T> inline void bench_keep(const T &value) {
+    /** Make `value` look used to the optimizer, without emitting any code. */
+    __asm__ __volatile__("" : : "g"(&value) : "memory");
+}
+
+inline void bench_header(const char *title) {
+    /** Print the title of a group of results. */
+    printf("\n%s\n", title);
+}
+
+inline void bench_report(const char *name, uint64_t elapsed_ns, uint64_t count, const char *unit) {
+    /** Print the cost of one case.
+
+    @param[in] name The name of the case.
+    @param[in] elapsed_ns The total time taken, from `hmc_nanos()`.
+    @param[in] count The number of operations performed in that time.
+    @param[in] unit What an operation is, e.g. "sample".
+    */
+    double per_op = (double)elapsed_ns / (double)count;
+    printf("  %-44s %12.1f ns/%-8s %14.0f %s/s\n", name, per_op, unit, 1e9 / per_op, unit);
+}
+
+#endif
@@ -0,0 +1,88 @@
+/** @file
+Benchmark of encoding and decoding raw sample blocks with `HMCCodec.h`, in both modes.
+
+The signal is a slow random walk around an Earth field with a few counts of noise, as the device
+reads at rest. Each case is reported per sample (an x, y and z value) and per value, and with the
+resulting size per sample, against the 6 bytes of the data registers.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <bench.h>
+#include <HMCCodec.h>
+
+#define BLOCK_LENGTH 1024
+#define BLOCK_REPEATS 20000
+
+static int16_t x[BLOCK_LENGTH], y[BLOCK_LENGTH], z[BLOCK_LENGTH];
+static int16_t dx[BLOCK_LENGTH], dy[BLOCK_LENGTH], dz[BLOCK_LENGTH];
+static uint8_t block[CODEC_MAX_BLOCK_SIZE(BLOCK_LENGTH)];
+
+static void fill_signal() {
+    /** A walk around (200, -100, 400) counts, with up to ±3 counts of noise per sample. */
+    uint32_t state = 12345;
+    int16_t *axes[3] = {x, y, z};
+    int16_t walk[3] = {200, -100, 400};
+    for (uint16_t i = 0; i < BLOCK_LENGTH; i++) {
+        for (uint8_t a = 0; a < 3; a++) {
+            state = state * 1664525 + 1013904223;
+            if ((state >> 28) == 0) {
+                walk[a] += (state >> 27) & 1 ? 1 : -1;
+            }
+            axes[a][i] = walk[a] + (int16_t)((state >> 24) % 7) - 3;
+        }
+    }
+}
+
+static void run(const char *name, uint8_t mode) {
+    /** Time encoding and decoding the block `BLOCK_REPEATS` times in `mode`, and report both. */
+    char label[64];
+    uint64_t samples = (uint64_t)BLOCK_REPEATS * BLOCK_LENGTH;
+    size_t size = 0;
+
+    uint64_t start = hmc_nanos();
+    for (uint32_t r = 0; r < BLOCK_REPEATS; r++) {
+        size = hmc_codec_encode(x, y, z, BLOCK_LENGTH, 1, r, 1, mode, block, sizeof(block));
+        bench_keep(block);
+    }
+    uint64_t elapsed = hmc_nanos() - start;
+
+    snprintf(label, sizeof(label), "%s encode", name);
+    bench_report(label, elapsed, samples, "sample");
+    bench_report(label, elapsed, 3 * samples, "value");
+
+    CodecBlockInfo info;
+    uint8_t err = 0;
+    start = hmc_nanos();
+    for (uint32_t r = 0; r < BLOCK_REPEATS; r++) {
+        err |= hmc_codec_decode(block, size, dx, dy, dz, BLOCK_LENGTH, &info);
+        bench_keep(dx);
+        bench_keep(dy);
+        bench_keep(dz);
+    }
+    elapsed = hmc_nanos() - start;
+
+    snprintf(label, sizeof(label), "%s decode", name);
+    bench_report(label, elapsed, samples, "sample");
+    bench_report(label, elapsed, 3 * samples, "value");
+
+    bool match = !err;
+    for (uint16_t i = 0; match && i < BLOCK_LENGTH; i++) {
+        match = dx[i] == x[i] && dy[i] == y[i] && dz[i] == z[i];
+    }
+    printf("  %-44s %12.2f bytes/sample%s\n", "", (double)size / BLOCK_LENGTH,
+           match ? "" : "  (decoded block doesn't match)");
+}
+
+int main() {
+    fill_signal();
+
+    char title[64];
+    snprintf(title, sizeof(title), "Blocks of %u samples", BLOCK_LENGTH);
+    bench_header(title);
+    run("bit-packed", CODEC_BITPACK);
+    run("varint", CODEC_VARINT);
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+/** @file
+Benchmark of continuous reads through `RetryDev` from a simulated device injecting faults.
+
+Polls the simulated device in continuous mode every `READ_INTERVAL_US`, faster than its output
+rate, with faults injected at a fixed rate per transaction, with the default retry policies and
+without retries. Reports the cost of a read, retries and backoff included, and how many reads
+were good: returned without error and at the right scale. After a device reset the reads are
+wrong until `HMC5883L::recover()` restores the configuration, which `readSample()` does every
+`HMC_VERIFY_INTERVAL` reads and after a failed one, and the device has made a new measurement.
+The fault rates are far above those of a healthy bus, so that a run sees every fault many times.
+Built with `HMC5883L_USE_RETRY`.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <bench.h>
+#include <HMC5883L.h>
+#include <unistd.h>
+
+#define READS 2000
+#define READ_INTERVAL_US 1000       /* Time between reads, in µs */
+#define FIELD_X 200.0               /* Simulated field along X, in mG */
+#define FIELD_TOLERANCE 10.0        /* Largest error in X of a read at the right scale, in mG */
+
+typedef RetryDev<SimI2CDev> Bus;
+
+static void run(const char *name, const SimFaults &faults, bool retry) {
+    /** Time `READS` reads with `faults` injected, with or without retries, and report them. */
+    HMC5883L mag;
+    Bus *bus = mag.getBus();
+    SimI2CDev &sim = bus->get_bus();
+    sim.set_field(Vec3<float>(FIELD_X, -100, 400));
+
+    if (mag.initialize() || mag.setGain(HMC_GAIN810) || mag.setOutputRate(HMC_RATE7500)
+            || mag.setMeasurementMode(HMC_MeasurementContinuous)) {
+        printf("  %-44s failed to configure the simulated device: %d\n", name,
+               mag.get_error_code());
+        return;
+    }
+
+    bus->set_unstick(Bus::unstick_bus, NULL);
+    if (!retry) {
+        bus->set_policy(EC_NACK_ADDR, 0, 0, false);
+        bus->set_policy(EC_I2C_OTHER, 0, 0, false);
+        bus->set_policy(EC_BAD_READ_SIZE, 0, 0, false);
+    }
+
+    // The second measurement in continuous mode is the first at the new gain.
+    usleep(3 * 1e6 / HMC5883L::outputRateHz(HMC_RATE7500));
+
+    sim.set_faults(faults, 7);
+    uint32_t transactions = sim.get_transactions();
+
+    uint32_t failed = 0;
+    uint32_t wrong = 0;
+    uint64_t elapsed = 0;
+    for (uint32_t i = 0; i < READS; i++) {
+        usleep(READ_INTERVAL_US);
+
+        uint64_t start = hmc_nanos();
+        Vec3<float> v = mag.readScaledValues();
+        elapsed += hmc_nanos() - start;
+
+        if (mag.get_error_code()) {
+            failed++;
+        } else if (v.x < FIELD_X - FIELD_TOLERANCE || v.x > FIELD_X + FIELD_TOLERANCE) {
+            wrong++;
+        }
+    }
+
+    bench_report(name, elapsed, READS, "read");
+    printf("  %-44s %u good, %u failed, %u wrong scale; %u retries, %u transactions\n", "",
+           READS - failed - wrong, failed, wrong, bus->get_retries(),
+           sim.get_transactions() - transactions);
+}
+
+int main() {
+    SimFaults none;
+    SimFaults faults;
+    faults.nack = 0.05;
+    faults.short_read = 0.05;
+    faults.stuck = 0.01;
+    faults.reset = 0.002;
+
+    char title[128];
+    snprintf(title, sizeof(title), "%u reads, %u us apart, without faults", READS,
+             READ_INTERVAL_US);
+    bench_header(title);
+    run("no faults", none, true);
+
+    snprintf(title, sizeof(title), "%u reads, %u us apart, faults per transaction: %.0f%% NACK, "
+             "%.0f%% short, %.0f%% stuck, %.1f%% reset", READS, READ_INTERVAL_US,
+             faults.nack * 100, faults.short_read * 100, faults.stuck * 100, faults.reset * 100);
+    bench_header(title);
+    run("default retry policies", faults, true);
+    run("no retries", faults, false);
+
+    return 0;
+}
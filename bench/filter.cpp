@@ -0,0 +1,89 @@
+/** @file
+Benchmark of the per-sample cost of each filter type in `Filter.h`, float and fixed point.
+
+Each filter is run over the same pseudo-random signal, both a sample at a time through
+`process()` and a block at a time through `processBlock()`.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <bench.h>
+#include <Filter.h>
+
+#define BLOCK_LENGTH 1024
+#define BLOCK_REPEATS 2000
+
+template<typename T> static void fill_signal(T *signal) {
+    /** A device-range (-2048 to 2047) signal from a linear congruential generator. */
+    uint32_t state = 12345;
+    for (uint16_t i = 0; i < BLOCK_LENGTH; i++) {
+        state = state * 1664525 + 1013904223;
+        signal[i] = (T)((int16_t)(state >> 20) - 2048);
+    }
+}
+
+template<typename F> static void run(const char *name, F filter) {
+    /** Time `filter` sample by sample and block by block. */
+    typedef typename F::sample_type T;
+    static T in[BLOCK_LENGTH], out[BLOCK_LENGTH];
+    char label[64];
+    fill_signal(in);
+
+    filter.reset();
+    uint64_t start = hmc_nanos();
+    for (uint32_t r = 0; r < BLOCK_REPEATS; r++) {
+        for (uint16_t i = 0; i < BLOCK_LENGTH; i++) {
+            filter.process(in[i], &out[i]);
+        }
+        bench_keep(out);
+    }
+    snprintf(label, sizeof(label), "%s process()", name);
+    bench_report(label, hmc_nanos() - start, (uint64_t)BLOCK_REPEATS * BLOCK_LENGTH, "sample");
+
+    filter.reset();
+    start = hmc_nanos();
+    for (uint32_t r = 0; r < BLOCK_REPEATS; r++) {
+        bench_keep(filter.processBlock(in, out, BLOCK_LENGTH));
+        bench_keep(out);
+    }
+    snprintf(label, sizeof(label), "%s processBlock()", name);
+    bench_report(label, hmc_nanos() - start, (uint64_t)BLOCK_REPEATS * BLOCK_LENGTH, "sample");
+}
+
+template<uint8_t N> static void fir_coefficients(float *fc, int16_t *qc) {
+    /** An N-tap moving average, in float and Q14. */
+    for (uint8_t i = 0; i < N; i++) {
+        fc[i] = 1.0f / N;
+        qc[i] = FILTER_Q14(1.0 / N);
+    }
+}
+
+int main() {
+    float fir8_f[8], fir32_f[32];
+    int16_t fir8_q[8], fir32_q[32];
+    fir_coefficients<8>(fir8_f, fir8_q);
+    fir_coefficients<32>(fir32_f, fir32_q);
+
+    /* 2nd-order Butterworth low-pass at 1/10 of the sample rate. */
+    const double b0 = 0.0674553, b1 = 0.1349105, b2 = 0.0674553, a1 = -1.1429805, a2 = 0.4128016;
+
+    bench_header("float");
+    run("biquad", BiquadFilter<float>(b0, b1, b2, a1, a2));
+    run("FIR, 8 taps", FIRFilter<float, 8>(fir8_f));
+    run("FIR, 32 taps", FIRFilter<float, 32>(fir32_f));
+    run("median of 5", MedianFilter<float, 5>());
+    run("median of 9", MedianFilter<float, 9>());
+    run("decimate by 4", Decimator<float, 4>());
+
+    bench_header("int16_t, Q14 coefficients");
+    run("biquad", BiquadFilter<int16_t>(FILTER_Q14(b0), FILTER_Q14(b1), FILTER_Q14(b2),
+                                        FILTER_Q14(a1), FILTER_Q14(a2)));
+    run("FIR, 8 taps", FIRFilter<int16_t, 8>(fir8_q));
+    run("FIR, 32 taps", FIRFilter<int16_t, 32>(fir32_q));
+    run("median of 5", MedianFilter<int16_t, 5>());
+    run("median of 9", MedianFilter<int16_t, 9>());
+    run("decimate by 4", Decimator<int16_t, 4>());
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+/** @file
+Benchmark of orientation fusion updates per second on a single core, float and fixed point.
+
+The input is a device turning about the vertical at 0.5 rad/s, sampled at 200 Hz, in a field
+inclined 60 degrees from horizontal. Both variants are timed a sample at a time (`update()`)
+and over a captured block (`replay()`), with the magnetometer alone, with a gyroscope, and with
+a gyroscope and an accelerometer.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <bench.h>
+#include <Fusion.h>
+#include <math.h>
+
+#define SAMPLES 1024
+#define PASSES 500
+#define RATE_HZ 200
+#define TURN_RATE 0.5f
+
+static float mag_x[SAMPLES], mag_y[SAMPLES], mag_z[SAMPLES];
+static float gyro_x[SAMPLES], gyro_y[SAMPLES], gyro_z[SAMPLES];
+static float accel_x[SAMPLES], accel_y[SAMPLES], accel_z[SAMPLES];
+static int32_t mag_xq[SAMPLES], mag_yq[SAMPLES], mag_zq[SAMPLES];
+static int32_t gyro_xq[SAMPLES], gyro_yq[SAMPLES], gyro_zq[SAMPLES];
+static int32_t accel_xq[SAMPLES], accel_yq[SAMPLES], accel_zq[SAMPLES];
+
+static void make_input(void) {
+    for (uint16_t i = 0; i < SAMPLES; i++) {
+        // The earth-frame field (250, 0, -433) mG, seen from a device yawed by `yaw`.
+        float yaw = TURN_RATE * i / RATE_HZ;
+        mag_x[i] = 250.0f * cosf(yaw);
+        mag_y[i] = -250.0f * sinf(yaw);
+        mag_z[i] = -433.0f;
+        gyro_x[i] = gyro_y[i] = 0.0f;
+        gyro_z[i] = TURN_RATE;
+        accel_x[i] = accel_y[i] = 0.0f;
+        accel_z[i] = 9.81f;
+
+        mag_xq[i] = FUSION_Q16(mag_x[i]);
+        mag_yq[i] = FUSION_Q16(mag_y[i]);
+        mag_zq[i] = FUSION_Q16(mag_z[i]);
+        gyro_xq[i] = gyro_yq[i] = 0;
+        gyro_zq[i] = FUSION_Q16(TURN_RATE);
+        accel_xq[i] = accel_yq[i] = 0;
+        accel_zq[i] = FUSION_Q16(9.81f);
+    }
+}
+
+static void run_float(const char *name, bool use_gyro, bool use_accel) {
+    MahonyFusion fusion;
+    Vec3Block<float> mag(mag_x, mag_y, mag_z, SAMPLES);
+    Vec3Block<float> gyro(gyro_x, gyro_y, gyro_z, SAMPLES);
+    Vec3Block<float> accel(accel_x, accel_y, accel_z, SAMPLES);
+    const float dt = 1.0f / RATE_HZ;
+    char label[64];
+
+    uint64_t start = hmc_nanos();
+    for (uint32_t p = 0; p < PASSES; p++) {
+        for (uint16_t i = 0; i < SAMPLES; i++) {
+            Vec3<float> g = gyro.get(i), a = accel.get(i);
+            fusion.update(mag.get(i), dt, use_gyro ? &g : NULL, use_accel ? &a : NULL);
+        }
+        bench_keep(fusion.getQuaternion());
+    }
+    snprintf(label, sizeof(label), "float update(), %s", name);
+    bench_report(label, hmc_nanos() - start, (uint64_t)PASSES * SAMPLES, "update");
+
+    fusion.reset();
+    start = hmc_nanos();
+    for (uint32_t p = 0; p < PASSES; p++) {
+        fusion.replay(mag, dt, use_gyro ? &gyro : NULL, use_accel ? &accel : NULL);
+        bench_keep(fusion.getQuaternion());
+    }
+    snprintf(label, sizeof(label), "float replay(), %s", name);
+    bench_report(label, hmc_nanos() - start, (uint64_t)PASSES * SAMPLES, "update");
+}
+
+static void run_fixed(const char *name, bool use_gyro, bool use_accel) {
+    MahonyFusionQ16 fusion;
+    Vec3Block<int32_t> mag(mag_xq, mag_yq, mag_zq, SAMPLES);
+    Vec3Block<int32_t> gyro(gyro_xq, gyro_yq, gyro_zq, SAMPLES);
+    Vec3Block<int32_t> accel(accel_xq, accel_yq, accel_zq, SAMPLES);
+    const uint32_t dt_us = 1000000 / RATE_HZ;
+    char label[64];
+
+    uint64_t start = hmc_nanos();
+    for (uint32_t p = 0; p < PASSES; p++) {
+        for (uint16_t i = 0; i < SAMPLES; i++) {
+            Vec3<int32_t> g = gyro.get(i), a = accel.get(i);
+            fusion.update(mag.get(i), dt_us, use_gyro ? &g : NULL, use_accel ? &a : NULL);
+        }
+        bench_keep(fusion.getQuaternion());
+    }
+    snprintf(label, sizeof(label), "Q16 update(), %s", name);
+    bench_report(label, hmc_nanos() - start, (uint64_t)PASSES * SAMPLES, "update");
+
+    fusion.reset();
+    start = hmc_nanos();
+    for (uint32_t p = 0; p < PASSES; p++) {
+        fusion.replay(mag, dt_us, use_gyro ? &gyro : NULL, use_accel ? &accel : NULL);
+        bench_keep(fusion.getQuaternion());
+    }
+    snprintf(label, sizeof(label), "Q16 replay(), %s", name);
+    bench_report(label, hmc_nanos() - start, (uint64_t)PASSES * SAMPLES, "update");
+}
+
+int main() {
+    make_input();
+
+    bench_header("float");
+    run_float("mag", false, false);
+    run_float("mag + gyro", true, false);
+    run_float("mag + gyro + accel", true, true);
+
+    bench_header("Q16 fixed point");
+    run_fixed("mag", false, false);
+    run_fixed("mag + gyro", true, false);
+    run_fixed("mag + gyro + accel", true, true);
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+/** @file
+Benchmark of single-shot reads of a group of simulated sensors, scaling from 1 to 16 sensors.
+
+For each group size, compares reading every sensor in turn with
+`HMC5883L::readScaledValuesSingle()` against `HMC5883LGroup::readSingle()`. Each sensor has its
+own simulated device, which measures in real time but doesn't stall for the time its transactions
+would spend on the bus, so that is reported separately. On a real shared bus the two add up,
+except where one sensor's transactions overlap another's conversion.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <bench.h>
+#include <HMC5883LGroup.h>
+
+#define ROUNDS 20
+
+static HMC5883L sensors[GROUP_MAX_SENSORS];
+
+static uint64_t bus_time_ns(uint8_t n) {
+    /** The simulated bus time of the first `n` sensors so far. */
+    uint64_t total = 0;
+    for (uint8_t i = 0; i < n; i++) {
+        total += sensors[i].getBus()->get_bus_time_ns();
+    }
+
+    return total;
+}
+
+static void report(const char *name, uint64_t elapsed_ns, uint64_t bus_ns) {
+    /** Print the time per round, in ms, with and without the simulated bus time. */
+    printf("  %-44s %8.2f ms/round  (+ %.2f ms on the bus)\n", name,
+           elapsed_ns / 1e6 / ROUNDS, bus_ns / 1e6 / ROUNDS);
+}
+
+int main() {
+    Vec3<float> values[GROUP_MAX_SENSORS];
+    uint8_t errors[GROUP_MAX_SENSORS];
+
+    for (uint8_t i = 0; i < GROUP_MAX_SENSORS; i++) {
+        if (sensors[i].initialize()) {
+            printf("Failed to initialize simulated sensor %u\n", i);
+            return 1;
+        }
+    }
+
+    printf("One conversion takes %u us\n", (unsigned)HMC5883L::conversionTimeUs(HMC_AVG1));
+
+    for (uint8_t n = 1; n <= GROUP_MAX_SENSORS; n *= 2) {
+        HMC5883LGroup group;
+        char title[32];
+        for (uint8_t i = 0; i < n; i++) {
+            group.addSensor(&sensors[i]);
+        }
+
+        snprintf(title, sizeof(title), "%u sensor%s", n, n == 1 ? "" : "s");
+        bench_header(title);
+
+        uint8_t failures = 0;
+        uint64_t bus_start = bus_time_ns(n);
+        uint64_t start = hmc_nanos();
+        for (uint8_t r = 0; r < ROUNDS; r++) {
+            for (uint8_t i = 0; i < n; i++) {
+                values[i] = sensors[i].readScaledValuesSingle();
+                failures += sensors[i].get_error_code() != 0;
+            }
+        }
+        report("readScaledValuesSingle() on each", hmc_nanos() - start, bus_time_ns(n) - bus_start);
+
+        bus_start = bus_time_ns(n);
+        start = hmc_nanos();
+        for (uint8_t r = 0; r < ROUNDS; r++) {
+            failures += group.readSingle(values, NULL, errors) != 0;
+        }
+        report("HMC5883LGroup::readSingle()", hmc_nanos() - start, bus_time_ns(n) - bus_start);
+
+        if (failures) {
+            printf("  %u reads failed\n", failures);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+/** @file
+Benchmark of the resampler, aligning 75 Hz sensor output to a 200 Hz timeline.
+
+The input is ten minutes of a slowly rotating field, sampled at 75 Hz with ±1 ms of timestamp
+jitter. It is resampled onto a fixed 200 Hz timeline one sample at a time (`push()`/`pull()`)
+and a second of input at a time (`processBlock()`), and onto a jittered external 200 Hz timeline
+(`sampleBlock()`), with each interpolation method. Costs are per output sample.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <bench.h>
+#include <Resampler.h>
+#include <math.h>
+
+#define INPUT_PERIOD_US 13333
+#define OUTPUT_PERIOD_US 5000
+#define N_IN (75 * 600)
+#define N_OUT (200 * 600)
+#define BLOCK_IN 75
+#define BLOCK_OUT 256
+#define START_US 1000000
+
+static uint32_t t_in[N_IN], t_ext[N_OUT];
+static float x_in[N_IN], y_in[N_IN], z_in[N_IN];
+
+static uint32_t jitter(uint32_t *state) {
+    /** A pseudo-random offset in [-1000, 1000) µs. */
+    *state = *state * 1664525 + 1013904223;
+    return (*state >> 8) % 2000 - 1000;
+}
+
+static void make_input(void) {
+    uint32_t state = 1;
+    for (uint32_t i = 0; i < N_IN; i++) {
+        t_in[i] = START_US + i * INPUT_PERIOD_US + jitter(&state);
+        float angle = 2.0f * (float)M_PI * 0.1f * (float)(t_in[i] - START_US) * 1e-6f;
+        x_in[i] = 200.0f * cosf(angle);
+        y_in[i] = 200.0f * sinf(angle);
+        z_in[i] = 400.0f;
+    }
+
+    // The external timeline starts after the first input, so no output is older than the input.
+    for (uint32_t i = 0; i < N_OUT; i++) {
+        t_ext[i] = START_US + 2 * INPUT_PERIOD_US + i * OUTPUT_PERIOD_US + jitter(&state);
+    }
+}
+
+static void report(const char *name, const char *method, uint64_t elapsed, uint32_t n_out) {
+    char label[64];
+    snprintf(label, sizeof(label), "%s, %s", name, method);
+    bench_report(label, elapsed, n_out, "output");
+}
+
+static void run(uint8_t method, const char *method_name) {
+    Resampler resampler(method);
+    static uint32_t t_out[BLOCK_OUT];
+    static float x_out[BLOCK_OUT], y_out[BLOCK_OUT], z_out[BLOCK_OUT];
+    Vec3Block<float> out(x_out, y_out, z_out, 0);
+
+    resampler.setOutputRate(OUTPUT_PERIOD_US, START_US);
+    uint32_t n_out = 0;
+    uint64_t start = hmc_nanos();
+    for (uint32_t i = 0; i < N_IN; i++) {
+        uint32_t t;
+        Vec3<float> v;
+        resampler.push(t_in[i], Vec3<float>(x_in[i], y_in[i], z_in[i]));
+        while (resampler.pull(&t, &v)) {
+            bench_keep(v);
+            n_out++;
+        }
+    }
+    report("push() + pull()", method_name, hmc_nanos() - start, n_out);
+
+    resampler.reset();
+    resampler.setOutputRate(OUTPUT_PERIOD_US, START_US);
+    n_out = 0;
+    start = hmc_nanos();
+    for (uint32_t i = 0; i < N_IN; i += BLOCK_IN) {
+        Vec3Block<float> in(x_in + i, y_in + i, z_in + i, BLOCK_IN);
+        n_out += resampler.processBlock(t_in + i, in, t_out, &out, BLOCK_OUT);
+        bench_keep(x_out);
+    }
+    report("processBlock()", method_name, hmc_nanos() - start, n_out);
+
+    resampler.reset();
+    n_out = 0;
+    start = hmc_nanos();
+    for (uint32_t i = 0; i < N_IN; i += BLOCK_IN) {
+        Vec3Block<float> in(x_in + i, y_in + i, z_in + i, BLOCK_IN);
+        uint32_t remaining = N_OUT - n_out;
+        n_out += resampler.sampleBlock(t_in + i, in, t_ext + n_out, &out,
+                                       remaining < BLOCK_OUT ? remaining : BLOCK_OUT);
+        bench_keep(x_out);
+    }
+    report("sampleBlock()", method_name, hmc_nanos() - start, n_out);
+}
+
+int main() {
+    make_input();
+
+    bench_header("75 Hz input resampled to 200 Hz");
+    run(RESAMPLE_LINEAR, "linear");
+    run(RESAMPLE_CUBIC, "cubic");
+
+    return 0;
+}
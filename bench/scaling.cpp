@@ -0,0 +1,56 @@
+/** @file
+Benchmark of the fixed-point scaling path against the float path.
+
+Times each of the `HMC5883L` read methods against the simulated device in continuous mode, then
+subtracts the cost of `readRawValues()` to leave the cost of scaling alone. The host has an FPU,
+so this understates the gap on FPU-less targets, where every float operation is a library call.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <bench.h>
+#include <HMC5883L.h>
+
+#define READS 200000
+
+template<typename V> static uint64_t time_read(HMC5883L &mag, V (HMC5883L::*read)(uint8_t *),
+                                              const char *name, uint64_t raw_ns) {
+    /** Time `READS` calls of `read`, and report the cost over that of `readRawValues()` (which
+    took `raw_ns`) if that is known. Returns the total time taken. */
+    uint64_t start = hmc_nanos();
+    for (uint32_t i = 0; i < READS; i++) {
+        bench_keep((mag.*read)(NULL));
+    }
+    uint64_t elapsed = hmc_nanos() - start;
+
+    bench_report(name, elapsed, READS, "read");
+    if (raw_ns) {
+        bench_report("  of which scaling", elapsed > raw_ns ? elapsed - raw_ns : 0, READS, "read");
+    }
+
+    return elapsed;
+}
+
+int main() {
+    HMC5883L mag;
+    if (mag.initialize()) {
+        printf("Failed to initialize the simulated device: %d\n", mag.get_error_code());
+        return 1;
+    }
+
+    mag.getBus()->set_field(Vec3<float>(300, -500, 700));
+    mag.getCalibration(true);
+    mag.setGain(HMC_GAIN130);
+    mag.setMeasurementMode(HMC_MeasurementContinuous);
+    mag.readCalibratedValues();     // The first sample at the new gain.
+
+    bench_header("Reads from the simulated device, continuous mode");
+    uint64_t raw_ns = time_read(mag, &HMC5883L::readRawValues, "readRawValues()", 0);
+    time_read(mag, &HMC5883L::readScaledValues, "readScaledValues() (float)", raw_ns);
+    time_read(mag, &HMC5883L::readScaledValuesMicroGauss, "readScaledValuesMicroGauss()", raw_ns);
+    time_read(mag, &HMC5883L::readCalibratedValues, "readCalibratedValues() (float)", raw_ns);
+    time_read(mag, &HMC5883L::readCalibratedValuesQ16, "readCalibratedValuesQ16()", raw_ns);
+
+    return 0;
+}
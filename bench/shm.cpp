@@ -0,0 +1,143 @@
+/** @file
+Benchmark of the shared memory sample publisher: the cost of each call, and the latency from
+`publish()` in one process to a reader in another seeing the frame.
+
+For the latency, a forked reader process spins on `getLatestSeq()` and, for each new frame,
+compares `hmc_nanos()` with the frame's `timestamp_ns`, which the publisher stamps immediately
+before publishing. The publisher sleeps `LATENCY_PERIOD_US` between frames, so the reader is
+normally never more than one frame behind. With a single core the result is the cost of waking
+the publisher and switching back to the reader, rather than of the shared memory itself.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <bench.h>
+#include <HMC5883LShm.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SHM_NAME "/hmc5883l_bench"
+#define CALLS 1000000
+#define LATENCY_FRAMES 20000
+#define LATENCY_PERIOD_US 100
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int run_reader(void) {
+    /** The reader process: record the latency of every frame it sees, then print the
+    distribution. Exits after `LATENCY_FRAMES` frames, or if none arrive for a second. */
+    static uint32_t latencies[LATENCY_FRAMES];
+    HMC5883LShmReader reader;
+    uint32_t n = 0, last = 0;
+    uint64_t idle_since = hmc_nanos();
+    ShmFrame frame;
+
+    if (reader.open(SHM_NAME)) {
+        printf("Reader failed to open the segment\n");
+        return 1;
+    }
+
+    while (last < LATENCY_FRAMES && hmc_nanos() - idle_since < 1000000000) {
+        if (reader.getLatestSeq() == last) {
+            continue;
+        }
+
+        uint64_t now = hmc_nanos();
+        if (reader.readLatest(&frame)) {
+            continue;
+        }
+
+        idle_since = now;
+        last = frame.seq;
+        latencies[n++] = (uint32_t)(now - frame.timestamp_ns);
+    }
+
+    if (n == 0) {
+        printf("  No frames seen\n");
+        return 1;
+    }
+
+    qsort(latencies, n, sizeof(uint32_t), compare_u32);
+    printf("  %u of %u frames seen; latency min %u ns, median %u ns, 99%% %u ns, max %u ns\n",
+           n, LATENCY_FRAMES, latencies[0], latencies[n / 2], latencies[n * 99 / 100],
+           latencies[n - 1]);
+    return 0;
+}
+
+int main() {
+    HMC5883LShmPublisher publisher;
+    HMC5883LShmReader reader;
+    ShmFrame frame;
+    Vec3<int> raw(100, -200, 300);
+    Vec3<float> scaled(92.0f, -184.0f, 276.0f);
+
+    if (publisher.open(SHM_NAME) || reader.open(SHM_NAME)) {
+        printf("Failed to open the shared memory segment %s\n", SHM_NAME);
+        return 1;
+    }
+
+    bench_header("Shared memory calls, uncontended");
+    uint64_t start = hmc_nanos();
+    for (uint32_t i = 0; i < CALLS; i++) {
+        publisher.publish(raw, scaled, 1, 0, i);
+    }
+    bench_report("publish()", hmc_nanos() - start, CALLS, "call");
+
+    start = hmc_nanos();
+    for (uint32_t i = 0; i < CALLS; i++) {
+        reader.readLatest(&frame);
+        bench_keep(frame);
+    }
+    bench_report("readLatest()", hmc_nanos() - start, CALLS, "call");
+
+    start = hmc_nanos();
+    uint32_t latest = reader.getLatestSeq();
+    for (uint32_t i = 0; i < CALLS; i++) {
+        reader.readFrame(latest - (i & 127), &frame);
+        bench_keep(frame);
+    }
+    bench_report("readFrame(), last 128 frames", hmc_nanos() - start, CALLS, "call");
+
+    start = hmc_nanos();
+    for (uint32_t i = 0; i < CALLS; i++) {
+        uint32_t token;
+        const ShmFrame *f = reader.peekLatest(&token);
+        float x = f->scaled[0];
+        bench_keep(x);
+        bench_keep(reader.validate(f, token));
+    }
+    bench_report("peekLatest() + validate()", hmc_nanos() - start, CALLS, "call");
+    reader.close();
+
+    // Start again from sequence number 1 for the reader process.
+    publisher.close(true);
+    if (publisher.open(SHM_NAME)) {
+        printf("Failed to reopen the shared memory segment %s\n", SHM_NAME);
+        return 1;
+    }
+
+    bench_header("Publish-to-read latency, reader in another process");
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int rv = run_reader();
+        fflush(stdout);
+        _exit(rv);
+    }
+
+    usleep(100000);     // Let the reader open the segment.
+    for (uint32_t i = 0; i < LATENCY_FRAMES; i++) {
+        usleep(LATENCY_PERIOD_US);
+        publisher.publish(raw, scaled, 1, 0, hmc_nanos());
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    publisher.close(true);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
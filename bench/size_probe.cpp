@@ -0,0 +1,11 @@
+/** @file
+Reserves as much RAM as the state of one `HMC5883L` object, not counting its transport, so that
+the per-instance cost shows in the `bss` column of `make size`.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <HMC5883L.h>
+
+uint8_t hmc5883l_instance[sizeof(HMC5883L) - sizeof(HMC5883LBus)];
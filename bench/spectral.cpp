@@ -0,0 +1,158 @@
+/** @file
+Benchmark of the sliding DFT against recomputing a block FFT over the same window.
+
+Tracks a few frequencies on all three axes over a window of 512 samples, either with
+`Vec3SlidingDFT` or with a radix-2 complex FFT of the whole window per axis, recomputed on every
+sample or once per hop of several samples. Costs are per input sample, with the CPU time they
+take per second at the sensor's 75 Hz and 15 Hz output rates. The FFT is a plain iterative one on
+float with precomputed twiddles; a tuned real-input FFT would be about twice as fast, which
+doesn't change the picture.
+
+With few frequencies, the sliding DFT is faster a vector at a time than in blocks: each update is
+a short chain of dependent multiply-adds, and `process()` interleaves the chains of the three
+axes where `processBlock()` runs one axis at a time.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#include <bench.h>
+#include <SlidingDFT.h>
+#include <math.h>
+
+#define WINDOW 512
+#define LOG2_WINDOW 9
+#define SAMPLES 30000
+#define BLOCK_LENGTH 75
+
+static float signal_x[SAMPLES], signal_y[SAMPLES], signal_z[SAMPLES];
+
+class BlockFFT {
+    /** In-place radix-2 FFT of `WINDOW` complex samples. */
+public:
+    BlockFFT() {
+        for (uint16_t i = 0; i < WINDOW / 2; i++) {
+            cos_table[i] = cosf(2.0f * (float)M_PI * i / WINDOW);
+            sin_table[i] = -sinf(2.0f * (float)M_PI * i / WINDOW);
+        }
+
+        for (uint16_t i = 0; i < WINDOW; i++) {
+            uint16_t r = 0;
+            for (uint8_t b = 0; b < LOG2_WINDOW; b++) {
+                r |= ((i >> b) & 1) << (LOG2_WINDOW - 1 - b);
+            }
+            reversed[i] = r;
+        }
+    }
+
+    void transform(const float *history, uint16_t newest, float *re, float *im) {
+        /** Transform the window ending at `history[newest]`, a ring of `WINDOW` samples. */
+        for (uint16_t i = 0; i < WINDOW; i++) {
+            re[reversed[i]] = history[(newest + 1 + i) & (WINDOW - 1)];
+            im[reversed[i]] = 0;
+        }
+
+        for (uint16_t half = 1, step = WINDOW / 2; half < WINDOW; half *= 2, step /= 2) {
+            for (uint16_t start = 0; start < WINDOW; start += 2 * half) {
+                for (uint16_t j = 0; j < half; j++) {
+                    float wr = cos_table[j * step], wi = sin_table[j * step];
+                    uint16_t a = start + j, b = a + half;
+                    float tr = wr * re[b] - wi * im[b];
+                    float ti = wr * im[b] + wi * re[b];
+                    re[b] = re[a] - tr;
+                    im[b] = im[a] - ti;
+                    re[a] += tr;
+                    im[a] += ti;
+                }
+            }
+        }
+    }
+
+private:
+    float cos_table[WINDOW / 2], sin_table[WINDOW / 2];
+    uint16_t reversed[WINDOW];
+};
+
+static void report(const char *name, uint64_t elapsed_ns) {
+    /** Print the cost per sample and the CPU time it takes per second at 75 Hz and 15 Hz. */
+    double per_sample = (double)elapsed_ns / SAMPLES;
+    printf("  %-40s %10.1f ns/sample %10.1f us/s at 75 Hz %10.1f us/s at 15 Hz\n", name,
+           per_sample, per_sample * 75 / 1000, per_sample * 15 / 1000);
+}
+
+template<uint8_t K> static void run_sdft(const float *frequencies) {
+    static Vec3SlidingDFT<K, WINDOW> sdft(frequencies, 75.0f);
+    char label[64];
+
+    sdft.reset();
+    uint64_t start = hmc_nanos();
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+        sdft.process(Vec3<float>(signal_x[i], signal_y[i], signal_z[i]));
+    }
+    bench_keep(sdft.amplitude(0));
+    snprintf(label, sizeof(label), "sliding DFT, %u frequenc%s", K, K == 1 ? "y" : "ies");
+    report(label, hmc_nanos() - start);
+
+    sdft.reset();
+    start = hmc_nanos();
+    for (uint32_t i = 0; i + BLOCK_LENGTH <= SAMPLES; i += BLOCK_LENGTH) {
+        sdft.processBlock(Vec3Block<float>(signal_x + i, signal_y + i, signal_z + i,
+                                           BLOCK_LENGTH));
+    }
+    bench_keep(sdft.amplitude(0));
+    snprintf(label, sizeof(label), "sliding DFT, %u frequenc%s, blocks", K, K == 1 ? "y" : "ies");
+    report(label, hmc_nanos() - start);
+}
+
+static void run_fft(uint16_t hop) {
+    /** Keep a ring of the last `WINDOW` samples per axis and transform it every `hop` samples. */
+    static BlockFFT fft;
+    static float ring_x[WINDOW], ring_y[WINDOW], ring_z[WINDOW];
+    static float re[WINDOW], im[WINDOW];
+    char label[64];
+
+    uint64_t start = hmc_nanos();
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+        uint16_t slot = i & (WINDOW - 1);
+        ring_x[slot] = signal_x[i];
+        ring_y[slot] = signal_y[i];
+        ring_z[slot] = signal_z[i];
+
+        if (i % hop == 0) {
+            fft.transform(ring_x, slot, re, im);
+            bench_keep(re);
+            fft.transform(ring_y, slot, re, im);
+            bench_keep(re);
+            fft.transform(ring_z, slot, re, im);
+            bench_keep(re);
+        }
+    }
+
+    if (hop == 1) {
+        snprintf(label, sizeof(label), "block FFT, every sample");
+    } else {
+        snprintf(label, sizeof(label), "block FFT, every %u samples", hop);
+    }
+    report(label, hmc_nanos() - start);
+}
+
+int main() {
+    const float frequencies[8] = {0.5f, 1.0f, 2.5f, 5.0f, 7.3f, 10.0f, 12.5f, 25.0f};
+
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+        float t = i / 75.0f;
+        signal_x[i] = 200.0f + 30.0f * cosf(2.0f * (float)M_PI * 7.3f * t);
+        signal_y[i] = -100.0f + 5.0f * cosf(2.0f * (float)M_PI * 12.5f * t);
+        signal_z[i] = 400.0f + 10.0f * sinf(2.0f * (float)M_PI * 1.0f * t);
+    }
+
+    bench_header("512-sample window on 3 axes");
+    run_sdft<1>(frequencies);
+    run_sdft<4>(frequencies);
+    run_sdft<8>(frequencies);
+    run_fft(1);
+    run_fft(16);
+    run_fft(75);
+
+    return 0;
+}
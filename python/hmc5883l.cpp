@@ -0,0 +1,479 @@
+/** @file
+Python extension for bulk acquisition from HMC5883L magnetometers into preallocated arrays.
+
+Samples are written straight into caller-owned buffers (NumPy arrays, `array.array`, anything that
+exports a writable C-contiguous buffer), with the GIL released for the whole acquisition, so the
+per-sample cost is that of the bus and not of the interpreter:
+
+    import numpy as np, hmc5883l
+    dev = hmc5883l.Device()
+    dev.initialize()
+    dev.configure(mode=hmc5883l.HMC_MeasurementContinuous)
+    raw = np.empty((1000, 3), np.int16)
+    mg = np.empty((1000, 3), np.float32)
+    t = np.empty(1000, np.uint64)
+    n = dev.acquire(raw, mg, t)
+
+The transport is chosen when the extension is built (see `setup.py`), exactly as for the C++
+library: the simulated device (`HMC5883L_USE_SIM`, the default, so it runs without hardware) or the
+Linux IIO driver (`HMC5883L_USE_IIO`). Capturing samples to a file and replaying them is not
+supported - the library has no such transport.
+
+Acquisition is paced by the device, not the interpreter: each sample is a new measurement, so the
+sample rate is at most the continuous output rate, or one per conversion time with `single=True`.
+
+This code is released under a Creative Commons Attribution 4.0 International license
+([CC-BY 4.0](https://creativecommons.org/licenses/by/4.0/)).
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <HMC5883L.h>
+#include <HMCSample.h>
+#include <HMCTime.h>
+#include <Vec3.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PY_MAX_STATUS_POLLS 4000    // Status polls per sample before giving up (2 s)
+#define PY_POLL_US 500              // Time between status polls, in microseconds
+#define PY_TIMEOUT 0xff             // Returned by `wait_sample()` if no sample became ready
+
+static PyObject *HMCError;
+
+struct DeviceObject {
+    PyObject_HEAD
+    HMC5883L *dev;
+    bool busy;                         /*!< A device call is running with the GIL released. */
+};
+
+static PyObject *raise_error(uint8_t code, Py_ssize_t acquired=-1) {
+    /** Raise `hmc5883l.Error` with the device error code (and the samples acquired, if known), or
+    `TimeoutError` if the device never became ready. */
+    if (code == PY_TIMEOUT) {
+        PyErr_Format(PyExc_TimeoutError, "no sample ready after %zd acquired - is the device "
+                     "measuring?", acquired);
+    } else if (acquired < 0) {
+        PyErr_SetObject(HMCError, Py_BuildValue("(is)", code, "device error"));
+    } else {
+        PyErr_SetObject(HMCError, Py_BuildValue("(isn)", code, "device error", acquired));
+    }
+    return NULL;
+}
+
+static bool check_idle(DeviceObject *self) {
+    /** Refuse to touch a device which another thread is using. */
+    if (self->dev == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "device is not constructed");
+        return false;
+    }
+
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "device is in use by another thread");
+        return false;
+    }
+    return true;
+}
+
+static bool get_buffer(PyObject *obj, Py_buffer *view, const char *formats, Py_ssize_t itemsize,
+                       const char *name) {
+    /** Get a writable C-contiguous buffer whose items are one of `formats`, each `itemsize` bytes.
+
+    Byte order and size prefixes (`<`, `=`, `@`) are accepted as long as the item size matches,
+    so e.g. NumPy's `uint64` matches `Q` whether it is exported as `Q` or `L`.
+    */
+    if (PyObject_GetBuffer(obj, view, PyBUF_WRITABLE | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS)) {
+        return false;
+    }
+
+    const char *fmt = view->format != NULL ? view->format : "B";
+    if (*fmt == '<' || *fmt == '=' || *fmt == '@') {
+        fmt++;
+    }
+
+    if (view->itemsize != itemsize || fmt[0] == '\0' || fmt[1] != '\0'
+            || strchr(formats, fmt[0]) == NULL) {
+        PyErr_Format(PyExc_TypeError, "%s: expected a buffer of %zd-byte '%s' items, got '%s'",
+                     name, itemsize, formats, view->format);
+        PyBuffer_Release(view);
+        return false;
+    }
+
+    return true;
+}
+
+static uint8_t wait_sample(HMC5883L *dev, uint32_t due_us) {
+    /** Wait until `due_us` (`hmc_micros()` time), by when a new measurement has been written, then
+    poll the status register until it is ready to read. RDY alone can't tell a new measurement from
+    one already read. Called without the GIL. */
+    int32_t remaining = (int32_t)(due_us - hmc_micros());
+    if (remaining > 0) {
+        usleep(remaining);
+    }
+
+    bool locked, ready;
+    for (uint32_t i = 0; i < PY_MAX_STATUS_POLLS; i++) {
+        if (dev->getStatus(&locked, &ready) > 3) {
+            return dev->get_error_code();
+        }
+
+        if (ready && !locked) {
+            return 0;
+        }
+
+        usleep(PY_POLL_US);
+    }
+
+    return PY_TIMEOUT;
+}
+
+static int Device_init(DeviceObject *self, PyObject *args, PyObject *kwds) {
+    /** `Device()` - or, with the IIO transport, `Device(sysfs_dir, buffer_dev)`, where either
+    can be left out (or `None`) for the default `IIODEV_SYSFS_DIR` or `IIODEV_BUFFER_DEV`. */
+#if defined(HMC5883L_USE_IIO)
+    static const char *kwlist[] = {"sysfs_dir", "buffer_dev", NULL};
+    const char *sysfs_dir = NULL, *buffer_dev = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zz", (char **)kwlist, &sysfs_dir,
+                                     &buffer_dev)) {
+        return -1;
+    }
+#else
+    static const char *kwlist[] = {NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "", (char **)kwlist)) {
+        return -1;
+    }
+#endif
+
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "device is in use by another thread");
+        return -1;
+    }
+
+    delete self->dev;
+#if defined(HMC5883L_USE_IIO)
+    if (sysfs_dir != NULL || buffer_dev != NULL) {
+        self->dev = new HMC5883L(sysfs_dir, buffer_dev);
+        return 0;
+    }
+#endif
+    self->dev = new HMC5883L();
+    return 0;
+}
+
+static void Device_dealloc(DeviceObject *self) {
+    delete self->dev;
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Device_initialize(DeviceObject *self, PyObject *args) {
+    /** `initialize()` - start communication and configure the device defaults. */
+    if (!check_idle(self)) {
+        return NULL;
+    }
+
+    uint8_t rv;
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    rv = self->dev->initialize();
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+    if (rv) {
+        return raise_error(rv);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *Device_configure(DeviceObject *self, PyObject *args, PyObject *kwds) {
+    /** `configure(gain=None, averaging=None, rate=None, mode=None)` - change any of the settings,
+    using the `HMC_*` values of the C++ library (also exported by this module). */
+    static const char *kwlist[] = {"gain", "averaging", "rate", "mode", NULL};
+    int gain = -1, averaging = -1, rate = -1, mode = -1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iiii", (char **)kwlist, &gain, &averaging,
+                                     &rate, &mode) || !check_idle(self)) {
+        return NULL;
+    }
+
+    uint8_t rv = 0;
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    if (!rv && gain >= 0) { rv = self->dev->setGain(gain); }
+    if (!rv && averaging >= 0) { rv = self->dev->setAveragingRate(averaging); }
+    if (!rv && rate >= 0) { rv = self->dev->setOutputRate(rate); }
+    if (!rv && mode >= 0) { rv = self->dev->setMeasurementMode(mode); }
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+    if (rv) {
+        return raise_error(rv);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *Device_calibrate(DeviceObject *self, PyObject *args) {
+    /** `calibrate()` - run the self-test calibration, returning the (x, y, z) scale factors. */
+    if (!check_idle(self)) {
+        return NULL;
+    }
+
+    Vec3<float> cal;
+    uint8_t rv;
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    cal = self->dev->getCalibration(true);
+    rv = self->dev->get_error_code();
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+    if (rv) {
+        return raise_error(rv);
+    }
+    return Py_BuildValue("(fff)", cal.x, cal.y, cal.z);
+}
+
+static PyObject *Device_acquire(DeviceObject *self, PyObject *args, PyObject *kwds) {
+    /** `acquire(raw=None, scaled=None, timestamps=None, count=-1, single=False)`
+
+    Acquire samples into the given buffers, each optional:
+
+      - `raw`: `int16`, 3 per sample (e.g. shape `(n, 3)`) - raw counts, x, y, z.
+      - `scaled`: `float32`, 3 per sample - calibrated field in mG.
+      - `timestamps`: `uint64`, 1 per sample - `CLOCK_MONOTONIC` time of each read, in ns.
+
+    The number of samples is the capacity of the smallest buffer given, or `count` if smaller.
+    With `single=True` a single measurement is triggered for each sample and read once the
+    conversion time has passed; otherwise the device must be in continuous mode (see `configure()`)
+    or `ValueError` is raised, and each sample is read an output period after the last, so no
+    measurement is read twice. Either way the read waits for the device's RDY flag. Returns the
+    number of samples acquired. On a device error, raises `hmc5883l.Error(code, message,
+    acquired)` - the first `acquired` samples are valid - or `TimeoutError` if no sample became
+    ready within `PY_MAX_STATUS_POLLS` polls.
+    */
+    static const char *kwlist[] = {"raw", "scaled", "timestamps", "count", "single", NULL};
+    PyObject *objs[3] = {Py_None, Py_None, Py_None};
+    Py_ssize_t count = -1;
+    int single = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOOnp", (char **)kwlist, &objs[0], &objs[1],
+                                     &objs[2], &count, &single) || !check_idle(self)) {
+        return NULL;
+    }
+
+    // Without a trigger, an idle device never sets RDY - fail now rather than time out.
+    if (!single && self->dev->getMeasurementMode() != HMC_MeasurementContinuous) {
+        PyErr_SetString(PyExc_ValueError, "the device is not in continuous mode: call "
+                        "configure(mode=HMC_MeasurementContinuous) first, or pass single=True");
+        return NULL;
+    }
+
+    static const char *formats[3] = {"h", "f", "QL"};
+    static const Py_ssize_t itemsizes[3] = {2, 4, 8};
+    static const Py_ssize_t per_sample[3] = {3, 3, 1};
+    static const char *names[3] = {"raw", "scaled", "timestamps"};
+
+    Py_buffer views[3];
+    bool have[3] = {false, false, false};
+    Py_ssize_t n = count;
+    for (uint8_t b = 0; b < 3; b++) {
+        if (objs[b] == Py_None) {
+            continue;
+        }
+
+        if (!get_buffer(objs[b], &views[b], formats[b], itemsizes[b], names[b])) {
+            for (uint8_t k = 0; k < b; k++) {
+                if (have[k]) { PyBuffer_Release(&views[k]); }
+            }
+            return NULL;
+        }
+
+        have[b] = true;
+        Py_ssize_t capacity = views[b].len / (itemsizes[b] * per_sample[b]);
+        if (n < 0 || capacity < n) {
+            n = capacity;
+        }
+    }
+
+    if (n < 0) {
+        n = 0;          // No buffers - nothing to do.
+    }
+
+    int16_t *raw = have[0] ? (int16_t *)views[0].buf : NULL;
+    float *scaled = have[1] ? (float *)views[1].buf : NULL;
+    uint64_t *timestamps = have[2] ? (uint64_t *)views[2].buf : NULL;
+    HMC5883L *dev = self->dev;
+
+    Py_ssize_t i = 0;
+    uint8_t rv = 0;
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    uint32_t conversion = HMC5883L::conversionTimeUs(dev->getAveragingRate());
+    uint32_t period = 1e6 / HMC5883L::outputRateHz(dev->getOutputRate());
+    period = period > conversion ? period : conversion;
+    uint32_t due = hmc_micros() + period;
+    for (; i < n; i++) {
+        if (single) {
+            if (rv = dev->setMeasurementMode(HMC_MeasurementSingle)) {
+                break;
+            }
+            due = hmc_micros() + conversion;
+        }
+
+        if (rv = wait_sample(dev, due)) {
+            break;
+        }
+
+        HMCSample s = dev->readSample();
+        if (rv = dev->get_error_code()) {
+            break;
+        }
+        due = hmc_micros() + period;
+
+        if (timestamps != NULL) {
+            timestamps[i] = hmc_nanos();
+        }
+
+        if (raw != NULL) {
+            raw[3 * i] = s.x();
+            raw[3 * i + 1] = s.y();
+            raw[3 * i + 2] = s.z();
+        }
+
+        if (scaled != NULL) {
+            Vec3<float> v = s.calibrated();
+            scaled[3 * i] = v.x;
+            scaled[3 * i + 1] = v.y;
+            scaled[3 * i + 2] = v.z;
+        }
+    }
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+
+    for (uint8_t b = 0; b < 3; b++) {
+        if (have[b]) { PyBuffer_Release(&views[b]); }
+    }
+
+    if (rv) {
+        return raise_error(rv, i);
+    }
+    return PyLong_FromSsize_t(i);
+}
+
+#if defined(HMC5883L_USE_SIM)
+static PyObject *Device_set_field(DeviceObject *self, PyObject *args) {
+    /** `set_field(x, y, z)` - set the simulated field, in mG. */
+    float x, y, z;
+    if (!PyArg_ParseTuple(args, "fff", &x, &y, &z) || !check_idle(self)) {
+        return NULL;
+    }
+
+    self->dev->getBus()->set_field(Vec3<float>(x, y, z));
+    Py_RETURN_NONE;
+}
+
+static PyObject *Device_set_faults(DeviceObject *self, PyObject *args, PyObject *kwds) {
+    /** `set_faults(nack=0, short_read=0, stuck=0, reset=0, seed=1)` - per-transaction fault
+    probabilities of the simulated bus, see `SimFaults`. */
+    static const char *kwlist[] = {"nack", "short_read", "stuck", "reset", "seed", NULL};
+    SimFaults faults;
+    unsigned int seed = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ffffI", (char **)kwlist, &faults.nack,
+                                     &faults.short_read, &faults.stuck, &faults.reset, &seed)
+            || !check_idle(self)) {
+        return NULL;
+    }
+
+    self->dev->getBus()->set_faults(faults, seed);
+    Py_RETURN_NONE;
+}
+
+static PyObject *Device_bus_stats(DeviceObject *self, PyObject *args) {
+    /** `bus_stats()` - `(transactions, faults, bus_time_ns)` of the simulated bus. */
+    if (!check_idle(self)) {
+        return NULL;
+    }
+
+    HMC5883LBus *bus = self->dev->getBus();
+    return Py_BuildValue("(IIK)", bus->get_transactions(), bus->get_faults(),
+                         (unsigned long long)bus->get_bus_time_ns());
+}
+#endif
+
+static PyMethodDef Device_methods[] = {
+    {"initialize", (PyCFunction)Device_initialize, METH_NOARGS, "Initialize the device."},
+    {"configure", (PyCFunction)Device_configure, METH_VARARGS | METH_KEYWORDS,
+     "configure(gain=None, averaging=None, rate=None, mode=None)"},
+    {"calibrate", (PyCFunction)Device_calibrate, METH_NOARGS,
+     "Run the self-test calibration, returning the (x, y, z) scale factors."},
+    {"acquire", (PyCFunction)Device_acquire, METH_VARARGS | METH_KEYWORDS,
+     "acquire(raw=None, scaled=None, timestamps=None, count=-1, single=False) -> int"},
+#if defined(HMC5883L_USE_SIM)
+    {"set_field", (PyCFunction)Device_set_field, METH_VARARGS, "set_field(x, y, z), in mG."},
+    {"set_faults", (PyCFunction)Device_set_faults, METH_VARARGS | METH_KEYWORDS,
+     "set_faults(nack=0, short_read=0, stuck=0, reset=0, seed=1)"},
+    {"bus_stats", (PyCFunction)Device_bus_stats, METH_NOARGS,
+     "(transactions, faults, bus_time_ns) of the simulated bus."},
+#endif
+    {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject DeviceType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+};
+
+static struct PyModuleDef hmc5883l_module = {
+    PyModuleDef_HEAD_INIT,
+    "hmc5883l",
+    "Bulk acquisition from HMC5883L magnetometers into preallocated arrays.",
+    -1,
+    NULL,
+};
+
+PyMODINIT_FUNC PyInit_hmc5883l(void) {
+    DeviceType.tp_name = "hmc5883l.Device";
+    DeviceType.tp_basicsize = sizeof(DeviceObject);
+    DeviceType.tp_flags = Py_TPFLAGS_DEFAULT;
+    DeviceType.tp_doc = "An HMC5883L magnetometer on the transport the extension was built for.";
+    DeviceType.tp_new = PyType_GenericNew;
+    DeviceType.tp_init = (initproc)Device_init;
+    DeviceType.tp_dealloc = (destructor)Device_dealloc;
+    DeviceType.tp_methods = Device_methods;
+    if (PyType_Ready(&DeviceType) < 0) {
+        return NULL;
+    }
+
+    PyObject *m = PyModule_Create(&hmc5883l_module);
+    if (m == NULL) {
+        return NULL;
+    }
+
+    HMCError = PyErr_NewException("hmc5883l.Error", NULL, NULL);
+    Py_INCREF(HMCError);
+    Py_INCREF(&DeviceType);
+    if (PyModule_AddObject(m, "Error", HMCError) || PyModule_AddObject(m, "Device",
+                                                                       (PyObject *)&DeviceType)) {
+        Py_DECREF(m);
+        return NULL;
+    }
+
+#if defined(HMC5883L_USE_SIM)
+    PyModule_AddStringConstant(m, "TRANSPORT", "sim");
+#elif defined(HMC5883L_USE_IIO)
+    PyModule_AddStringConstant(m, "TRANSPORT", "iio");
+#endif
+
+    static const struct { const char *name; int value; } constants[] = {
+        {"HMC_GAIN088", HMC_GAIN088}, {"HMC_GAIN130", HMC_GAIN130}, {"HMC_GAIN190", HMC_GAIN190},
+        {"HMC_GAIN250", HMC_GAIN250}, {"HMC_GAIN400", HMC_GAIN400}, {"HMC_GAIN470", HMC_GAIN470},
+        {"HMC_GAIN560", HMC_GAIN560}, {"HMC_GAIN810", HMC_GAIN810},
+        {"HMC_AVG1", HMC_AVG1}, {"HMC_AVG2", HMC_AVG2}, {"HMC_AVG4", HMC_AVG4},
+        {"HMC_AVG8", HMC_AVG8},
+        {"HMC_RATE0075", HMC_RATE0075}, {"HMC_RATE0150", HMC_RATE0150},
+        {"HMC_RATE0300", HMC_RATE0300}, {"HMC_RATE0750", HMC_RATE0750},
+        {"HMC_RATE1500", HMC_RATE1500}, {"HMC_RATE3000", HMC_RATE3000},
+        {"HMC_RATE7500", HMC_RATE7500},
+        {"HMC_MeasurementContinuous", HMC_MeasurementContinuous},
+        {"HMC_MeasurementSingle", HMC_MeasurementSingle},
+        {"HMC_MeasurementIdle", HMC_MeasurementIdle},
+    };
+    for (size_t c = 0; c < sizeof(constants) / sizeof(constants[0]); c++) {
+        PyModule_AddIntConstant(m, constants[c].name, constants[c].value);
+    }
+
+    return m;
+}
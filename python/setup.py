@@ -0,0 +1,37 @@
+"""Build the `hmc5883l` Python extension from the library sources in the parent directory.
+
+The transport is fixed at build time. By default the extension runs against the simulated device,
+so it works without hardware; set `HMC5883L_TRANSPORT=iio` to build against the Linux IIO driver:
+
+    python setup.py build_ext --inplace
+    HMC5883L_TRANSPORT=iio python setup.py build_ext --inplace
+"""
+
+import os
+from setuptools import setup, Extension
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir)
+
+transports = {
+    "sim": ("HMC5883L_USE_SIM", "SimI2CDev.cpp"),
+    "iio": ("HMC5883L_USE_IIO", "IIODev.cpp"),
+}
+macro, transport_source = transports[os.environ.get("HMC5883L_TRANSPORT", "sim")]
+
+sources = ["HMC5883L.cpp", "HMCSample.cpp", "HMCTrace.cpp", transport_source]
+
+setup(
+    name="hmc5883l",
+    version="0.1",
+    description="Bulk acquisition from HMC5883L magnetometers into preallocated arrays",
+    license="CC-BY-4.0",
+    ext_modules=[
+        Extension(
+            "hmc5883l",
+            sources=["hmc5883l.cpp"] + [os.path.relpath(os.path.join(ROOT, s)) for s in sources],
+            include_dirs=[ROOT],
+            define_macros=[(macro, None)],
+            extra_compile_args=["-Wno-parentheses"],
+        )
+    ],
+)